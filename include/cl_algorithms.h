@@ -0,0 +1,293 @@
+#include <stdint.h>
+#include "cl_iterators.h"
+
+#ifndef CL_ALGORITHMS_H
+#define CL_ALGORITHMS_H
+
+// ranges of at most this many elements are insertion sorted
+#ifndef CL_SORT_INSERTION
+#define CL_SORT_INSERTION 16
+#endif // CL_SORT_INSERTION
+
+// arrays shorter than this are sorted by comparison in type##_radix_sort
+#ifndef CL_RADIX_MIN
+#define CL_RADIX_MIN 256
+#endif // CL_RADIX_MIN
+
+// default strict weak ordering of the algorithms, inlined at every comparison
+#define CL_LESS(a, b) ((a) < (b))
+
+#define CL_SORT_SWAP(type, a, b) { type tmp_ = (a); (a) = (b); (b) = tmp_; }
+
+/*
+this macro generates the declarations of the algorithms over arrays of type 'type' named name##_*
+
+name##_sort sorts in place with introsort, i.e. quicksort falling back to heapsort when partitions
+are unbalanced
+name##_lower_bound returns the index of the first element not less than value in a sorted array,
+num if there is none
+name##_bsearch returns an element equal to value in a sorted array or NULL
+name##_partition moves the elements less than pivot before the others and returns their number
+name##_nth_element moves the element that would be at index nth if sorted there, with no greater
+element before it and no lesser one after it
+name##Iterator_sort sorts the elements an iterator, e.g. from name##_slice, has not returned yet so
+that it returns them in order
+*/
+#define declare_sort_(storage, type, name)                                                          \
+storage void name##_sort(type * array, size_t num);                                                 \
+storage size_t name##_lower_bound(type * array, size_t num, type value);                            \
+storage type * name##_bsearch(type * array, size_t num, type value);                                \
+storage size_t name##_partition(type * array, size_t num, type pivot);                              \
+storage void name##_nth_element(type * array, size_t num, size_t nth);                              \
+storage enum cl_status name##Iterator_sort(name##Iterator * iter);
+
+#define declare_sort(type) declare_sort_(, type, type)
+
+// LSD radix sort of integer keys one byte at a time. Needs a buffer of num elements
+#define declare_radix_sort(type)                                                                    \
+enum cl_status type##_radix_sort(type * array, size_t num);
+
+declare_sort(double)
+declare_sort(float)
+declare_sort(long)
+declare_sort(int)
+declare_sort(char)
+declare_sort(size_t)
+
+declare_radix_sort(long)
+declare_radix_sort(int)
+declare_radix_sort(char)
+declare_radix_sort(size_t)
+
+/*
+this macro generates the definitions of declare_sort_ with the ordering LESS(a, b), a macro or
+function-like expression that is inlined wherever elements are compared. name##Iterator must exist
+*/
+#define define_sort_(storage, type, name, LESS)                                                     \
+static void name##_insertion_sort(type * array, size_t num) {                                       \
+    for (size_t i = 1; i < num; i++) {                                                              \
+        type value = array[i];                                                                      \
+        size_t j = i;                                                                               \
+        for (; j > 0 && LESS(value, array[j-1]); j--) {                                             \
+            array[j] = array[j-1];                                                                  \
+        }                                                                                           \
+        array[j] = value;                                                                           \
+    }                                                                                               \
+}                                                                                                   \
+static void name##_sift_down(type * array, size_t root, size_t num) {                               \
+    type value = array[root];                                                                       \
+    for (size_t child = 2*root + 1; child < num; child = 2*root + 1) {                              \
+        if (child + 1 < num && LESS(array[child], array[child+1])) {                                \
+            child++;                                                                                \
+        }                                                                                           \
+        if (!LESS(value, array[child])) {                                                           \
+            break;                                                                                  \
+        }                                                                                           \
+        array[root] = array[child];                                                                 \
+        root = child;                                                                               \
+    }                                                                                               \
+    array[root] = value;                                                                            \
+}                                                                                                   \
+static void name##_heap_sort(type * array, size_t num) {                                            \
+    for (size_t i = num / 2; i > 0; i--) {                                                          \
+        name##_sift_down(array, i - 1, num);                                                        \
+    }                                                                                               \
+    for (size_t end = num; end > 1; end--) {                                                        \
+        CL_SORT_SWAP(type, array[0], array[end-1])                                                  \
+        name##_sift_down(array, 0, end - 1);                                                        \
+    }                                                                                               \
+}                                                                                                   \
+/* partitions around the median of the second, middle and last elements and returns its index. */  \
+/* num > 2. Elements before the index are not greater and elements after are not less */           \
+static size_t name##_pivot_partition(type * array, size_t num) {                                    \
+    size_t mid = num / 2, last = num - 1;                                                           \
+    if (LESS(array[mid], array[1])) CL_SORT_SWAP(type, array[1], array[mid])                        \
+    if (LESS(array[last], array[mid])) CL_SORT_SWAP(type, array[mid], array[last])                  \
+    if (LESS(array[mid], array[1])) CL_SORT_SWAP(type, array[1], array[mid])                        \
+    CL_SORT_SWAP(type, array[0], array[mid])                                                        \
+    type pivot = array[0];                                                                          \
+    size_t i = 0, j = num;                                                                          \
+    while (true) {                                                                                  \
+        while (++i < num && LESS(array[i], pivot)) {}                                               \
+        while (LESS(pivot, array[--j])) {} /* stops at the pivot in array[0] */                     \
+        if (i >= j) {                                                                               \
+            break;                                                                                  \
+        }                                                                                           \
+        CL_SORT_SWAP(type, array[i], array[j])                                                      \
+    }                                                                                               \
+    CL_SORT_SWAP(type, array[0], array[j])                                                          \
+    return j;                                                                                       \
+}                                                                                                   \
+static size_t name##_depth_limit(size_t num) {                                                      \
+    size_t depth = 0;                                                                               \
+    for (; num > 1; num >>= 1) {                                                                    \
+        depth += 2;                                                                                 \
+    }                                                                                               \
+    return depth;                                                                                   \
+}                                                                                                   \
+static void name##_intro_sort(type * array, size_t num, size_t depth) {                             \
+    while (num > CL_SORT_INSERTION) {                                                               \
+        if (!depth--) {                                                                             \
+            name##_heap_sort(array, num);                                                           \
+            return;                                                                                 \
+        }                                                                                           \
+        size_t p = name##_pivot_partition(array, num);                                              \
+        /* recurse into the smaller side to bound the stack */                                      \
+        if (p < num - p - 1) {                                                                      \
+            name##_intro_sort(array, p, depth);                                                     \
+            array += p + 1;                                                                         \
+            num -= p + 1;                                                                           \
+        } else {                                                                                    \
+            name##_intro_sort(array + p + 1, num - p - 1, depth);                                   \
+            num = p;                                                                                \
+        }                                                                                           \
+    }                                                                                               \
+    name##_insertion_sort(array, num);                                                              \
+}                                                                                                   \
+storage void name##_sort(type * array, size_t num) {                                                \
+    if (!array || num < 2) {                                                                        \
+        return;                                                                                     \
+    }                                                                                               \
+    name##_intro_sort(array, num, name##_depth_limit(num));                                         \
+}                                                                                                   \
+storage size_t name##_lower_bound(type * array, size_t num, type value) {                           \
+    if (!array || !num) {                                                                           \
+        return 0;                                                                                   \
+    }                                                                                               \
+    type * base = array;                                                                            \
+    while (num > 1) { /* the comparison selects the half without a branch */                       \
+        size_t half = num / 2;                                                                      \
+        base = LESS(base[half - 1], value) ? base + half : base;                                    \
+        num -= half;                                                                                \
+    }                                                                                               \
+    return (size_t) (base - array) + (LESS(*base, value) ? 1 : 0);                                  \
+}                                                                                                   \
+storage type * name##_bsearch(type * array, size_t num, type value) {                               \
+    size_t index = name##_lower_bound(array, num, value);                                           \
+    return (index < num && !LESS(value, array[index])) ? array + index : NULL;                      \
+}                                                                                                   \
+storage size_t name##_partition(type * array, size_t num, type pivot) {                             \
+    if (!array) {                                                                                   \
+        return 0;                                                                                   \
+    }                                                                                               \
+    size_t i = 0, j = num;                                                                          \
+    while (true) {                                                                                  \
+        while (i < j && LESS(array[i], pivot)) {                                                    \
+            i++;                                                                                    \
+        }                                                                                           \
+        while (i < j && !LESS(array[j-1], pivot)) {                                                 \
+            j--;                                                                                    \
+        }                                                                                           \
+        if (i >= j) {                                                                               \
+            return i;                                                                               \
+        }                                                                                           \
+        CL_SORT_SWAP(type, array[i], array[j-1])                                                    \
+    }                                                                                               \
+}                                                                                                   \
+storage void name##_nth_element(type * array, size_t num, size_t nth) {                             \
+    if (!array || nth >= num) {                                                                     \
+        return;                                                                                     \
+    }                                                                                               \
+    size_t depth = name##_depth_limit(num);                                                         \
+    while (num > CL_SORT_INSERTION) {                                                               \
+        if (!depth--) {                                                                             \
+            name##_heap_sort(array, num);                                                           \
+            return;                                                                                 \
+        }                                                                                           \
+        size_t p = name##_pivot_partition(array, num);                                              \
+        if (nth == p) {                                                                             \
+            return;                                                                                 \
+        } else if (nth < p) {                                                                       \
+            num = p;                                                                                \
+        } else {                                                                                    \
+            array += p + 1;                                                                         \
+            num -= p + 1;                                                                           \
+            nth -= p + 1;                                                                           \
+        }                                                                                           \
+    }                                                                                               \
+    name##_insertion_sort(array, num);                                                              \
+}                                                                                                   \
+storage enum cl_status name##Iterator_sort(name##Iterator * iter) {                                 \
+    if (!iter) {                                                                                    \
+        return CL_FAILURE;                                                                          \
+    }                                                                                               \
+    size_t first = 0;                                                                               \
+    size_t num = name##Iterator_remaining(iter, &first);                                            \
+    if (iter->step == 1) {                                                                          \
+        name##_sort(iter->array + first, num);                                                      \
+        return CL_SUCCESS;                                                                          \
+    }                                                                                               \
+    if (num < 2) {                                                                                  \
+        return CL_SUCCESS;                                                                          \
+    }                                                                                               \
+    /* strided elements are gathered, sorted and put back in the order the iterator visits them */ \
+    type * buffer = (type *) CL_MALLOC(sizeof(type) * num);                                         \
+    if (!buffer) {                                                                                  \
+        return CL_FAILURE;                                                                          \
+    }                                                                                               \
+    type * elem = iter->array + first;                                                              \
+    for (size_t i = 0; i < num; i++, elem += iter->step) {                                          \
+        buffer[i] = *elem;                                                                          \
+    }                                                                                               \
+    name##_sort(buffer, num);                                                                       \
+    elem = iter->array + first;                                                                     \
+    for (size_t i = 0; i < num; i++, elem += iter->step) {                                          \
+        *elem = buffer[i];                                                                          \
+    }                                                                                               \
+    CL_FREE(buffer);                                                                                \
+    return CL_SUCCESS;                                                                              \
+}
+
+#define define_sort(type) define_sort_(, type, type, CL_LESS)
+
+// maps an integer to an unsigned key of the same order, flipping the sign bit of signed types
+#define CL_RADIX_KEY(type, x) ((uint64_t) (x) ^ (((type) -1 < (type) 1) ? (uint64_t) 1 << (8 * sizeof(type) - 1) : 0))
+
+// type must be an integer type with define_sort(type)
+#define define_radix_sort(type)                                                                     \
+enum cl_status type##_radix_sort(type * array, size_t num) {                                        \
+    if (!array) {                                                                                   \
+        return CL_FAILURE;                                                                          \
+    }                                                                                               \
+    if (num < CL_RADIX_MIN) {                                                                       \
+        type##_sort(array, num);                                                                    \
+        return CL_SUCCESS;                                                                          \
+    }                                                                                               \
+    type * buffer = (type *) CL_MALLOC(sizeof(type) * num);                                         \
+    if (!buffer) {                                                                                  \
+        return CL_FAILURE;                                                                          \
+    }                                                                                               \
+    size_t counts[sizeof(type)][256] = {{0}};                                                       \
+    for (size_t i = 0; i < num; i++) { /* histograms of every byte in one pass */                   \
+        uint64_t key = CL_RADIX_KEY(type, array[i]);                                                \
+        for (size_t d = 0; d < sizeof(type); d++) {                                                 \
+            counts[d][(key >> (8 * d)) & 0xFF]++;                                                   \
+        }                                                                                           \
+    }                                                                                               \
+    type * src = array, * dest = buffer;                                                            \
+    for (size_t d = 0; d < sizeof(type); d++) {                                                     \
+        size_t * count = counts[d];                                                                 \
+        if (count[(CL_RADIX_KEY(type, src[0]) >> (8 * d)) & 0xFF] == num) {                         \
+            continue; /* every key has the same byte */                                             \
+        }                                                                                           \
+        size_t offset = 0;                                                                          \
+        for (size_t b = 0; b < 256; b++) {                                                          \
+            size_t n = count[b];                                                                    \
+            count[b] = offset;                                                                      \
+            offset += n;                                                                            \
+        }                                                                                           \
+        for (size_t i = 0; i < num; i++) {                                                          \
+            dest[count[(CL_RADIX_KEY(type, src[i]) >> (8 * d)) & 0xFF]++] = src[i];                 \
+        }                                                                                           \
+        type * tmp = src;                                                                           \
+        src = dest;                                                                                 \
+        dest = tmp;                                                                                 \
+    }                                                                                               \
+    if (src != array) {                                                                             \
+        memcpy(array, src, sizeof(type) * num);                                                     \
+    }                                                                                               \
+    CL_FREE(buffer);                                                                                \
+    return CL_SUCCESS;                                                                              \
+}
+
+#endif // CL_ALGORITHMS_H
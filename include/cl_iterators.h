@@ -89,6 +89,11 @@ but say you want to change the point at which the stop condition is checked, e.g
 #define COMPREHENSION_SCALE 2
 #endif // COMPREHENSION_SCALE
 
+// maximum number of elements gathered by next_block from a strided array iterator
+#ifndef ITERATOR_BLOCK_SIZE
+#define ITERATOR_BLOCK_SIZE 64
+#endif // ITERATOR_BLOCK_SIZE
+
 enum iterator_status {
     ITERATOR_FAIL = -1,
     ITERATOR_GO,
@@ -97,12 +102,27 @@ enum iterator_status {
 };
 
 /* 
-this macro generates the header declarations for an array of type 'type', e.g. if your container 
-is type * object, declare_array_iterator(type) will make all the appropriate declarations for 
-typeIterator objects
+type-erased adapters objtype##Iterator_next_erased and objtype##Iterator_stop_erased for the Iterable 
+struct, which cannot call objtype##Iterator_next through a function pointer of another type. 
+define_sized_iterable also adds objtype##Iterator_length_erased
 */
-#define declare_array_iterator(type)                                        \
-typedef struct type##Iterator {                                                                     \
+#define define_iterable(objtype)                                                            \
+static inline void * objtype##Iterator_next_erased(void * iter) {                           \
+    return (void *) objtype##Iterator_next((objtype##Iterator *) iter);                     \
+}                                                                                           \
+static inline enum iterator_status objtype##Iterator_stop_erased(void * iter) {             \
+    return objtype##Iterator_stop((objtype##Iterator *) iter);                              \
+}
+
+#define define_sized_iterable(objtype)                                                      \
+define_iterable(objtype)                                                                    \
+static inline size_t objtype##Iterator_length_erased(void * iter) {                        \
+    return objtype##Iterator_length((objtype##Iterator *) iter);                            \
+}
+
+/* the struct of an iterator named name##Iterator over an array of type */
+#define declare_array_iterator_struct(type, name)                                                   \
+typedef struct name##Iterator {                                                                     \
     type * array;                                                                           \
     size_t num;                                                                             \
     size_t loc;                                                                             \
@@ -110,18 +130,39 @@ typedef struct type##Iterator {
     size_t end;                                                                             \
     long long int step;                                                                     \
     enum iterator_status stop;                                                              \
-}type##Iterator, type##IteratorIterator;                                    \
-type##Iterator * type##Iterator_new(type * array, size_t num);              \
-void type##Iterator_init(type##Iterator * iter, type * array, size_t num);  \
-void type##Iterator_del(type##Iterator * iter);                             \
-type * type##Iterator_next(type##Iterator * iter);                          \
-enum iterator_status type##Iterator_stop(type##Iterator * iter);            \
-size_t type##Iterator_elem_size(type##Iterator *iter);                      \
-void type##IteratorIterator_init(type##IteratorIterator *iter_iter, type##Iterator * iter);         \
-type * type##IteratorIterator_next(type##Iterator *iter);                   \
-enum iterator_status type##IteratorIterator_stop(type##Iterator *iter);     \
-size_t type##IteratorIterator_elem_size(type##Iterator *iter);              \
-type##Iterator * type##_slice(type * array, size_t num, size_t start, size_t stop, long long int step); \
+    Allocator * allocator; /* of the iterator itself if made by name##Iterator_new_with */  \
+}name##Iterator, name##IteratorIterator;
+
+/* the functions of name##Iterator, with storage class storage */
+#define declare_array_iterator_functions(storage, type, name)                               \
+storage name##Iterator * name##Iterator_new(type * array, size_t num);              \
+storage name##Iterator * name##Iterator_new_with(Allocator * allocator, type * array, size_t num); \
+storage void name##Iterator_init(name##Iterator * iter, type * array, size_t num);  \
+storage void name##Iterator_del(name##Iterator * iter);                             \
+storage type * name##Iterator_next(name##Iterator * iter);                          \
+storage size_t name##Iterator_last(name##Iterator * iter);                          \
+storage size_t name##Iterator_remaining(name##Iterator * iter, size_t * first);     \
+storage size_t name##Iterator_length(name##Iterator * iter);                        \
+storage type * name##Iterator_next_block(name##Iterator * iter, type * buffer, size_t * count); \
+storage enum iterator_status name##Iterator_stop(name##Iterator * iter);            \
+storage size_t name##Iterator_elem_size(name##Iterator *iter);                      \
+storage void name##IteratorIterator_init(name##IteratorIterator *iter_iter, name##Iterator * iter);         \
+storage type * name##IteratorIterator_next(name##Iterator *iter);                   \
+storage type * name##IteratorIterator_next_block(name##Iterator *iter, type * buffer, size_t * count); \
+storage size_t name##IteratorIterator_length(name##Iterator *iter);                 \
+storage enum iterator_status name##IteratorIterator_stop(name##Iterator *iter);     \
+storage size_t name##IteratorIterator_elem_size(name##Iterator *iter);              \
+storage name##Iterator * name##_slice(type * array, size_t num, size_t start, size_t stop, long long int step);
+
+/* 
+this macro generates the header declarations for an array of type 'type', e.g. if your container 
+is type * object, declare_array_iterator(type) will make all the appropriate declarations for 
+typeIterator objects
+*/
+#define declare_array_iterator(type)                                        \
+declare_array_iterator_struct(type, type)                                   \
+declare_array_iterator_functions(, type, type)                              \
+define_sized_iterable(type)
 
 declare_array_iterator(double)
 declare_array_iterator(float)
@@ -139,19 +180,23 @@ definitions for typeIterator objects
 type must be a single token. To use with pointers, have to typedef the pointer (not recommended for readability)
 also, have to typedef the multiple reserved word types: long [long] [int], unsigned long [long] [int], etc.
 */
-#define define_array_iterator(type)                                                         \
-type##Iterator * type##Iterator_new(type * array, size_t num) {                             \
+#define define_array_iterator_(storage, type, name)                                                     \
+storage name##Iterator * name##Iterator_new(type * array, size_t num) {                             \
+    return name##Iterator_new_with(NULL, array, num);                                       \
+}                                                                                           \
+storage name##Iterator * name##Iterator_new_with(Allocator * allocator, type * array, size_t num) { \
     if (!array || !num) {                                                                   \
         return NULL;                                                                        \
     }                                                                                       \
-    type##Iterator * iter = (type##Iterator *) CL_MALLOC(sizeof(type##Iterator));           \
+    name##Iterator * iter = (name##Iterator *) cl_alloc(allocator, sizeof(name##Iterator)); \
     if (!iter) {                                                                            \
         return NULL;                                                                        \
     }                                                                                       \
-    type##Iterator_init(iter, array, num);                                                  \
+    name##Iterator_init(iter, array, num);                                                  \
+    iter->allocator = allocator;                                                            \
     return iter;                                                                            \
 }                                                                                           \
-void type##Iterator_init(type##Iterator * iter, type * array, size_t num) {                 \
+storage void name##Iterator_init(name##Iterator * iter, type * array, size_t num) {                 \
     if (!iter) {                                                                            \
         return;                                                                             \
     }                                                                                       \
@@ -162,22 +207,27 @@ void type##Iterator_init(type##Iterator * iter, type * array, size_t num) {
     iter->step = 1;                                                                         \
     iter->end = num-1;                                                                      \
     iter->stop = ITERATOR_PAUSE;                                                            \
+    iter->allocator = NULL;                                                                 \
 }                                                                                           \
-void type##Iterator_del(type##Iterator * iter) {                                            \
-    CL_FREE(iter);                                                                          \
+storage void name##Iterator_del(name##Iterator * iter) {                                            \
+    if (iter) {                                                                             \
+        cl_free(iter->allocator, iter);                                                     \
+    }                                                                                       \
 }                                                                                           \
-type * type##Iterator_next(type##Iterator * iter) {                                         \
+storage type * name##Iterator_next(name##Iterator * iter) {                                         \
     if (!iter) {                                                                            \
         return NULL;                                                                        \
     }                                                                                       \
     if (iter->stop == ITERATOR_GO) {                                                        \
-        if (((iter->step > 0) && (iter->end - iter->loc < iter->step)) || ((iter->step < 0) && (iter->loc - iter->end < -iter->step))) {    \
+        size_t last = name##Iterator_last(iter);                                            \
+        if (((iter->step > 0) && (iter->loc >= last || last - iter->loc < (size_t) iter->step)) || ((iter->step < 0) && (iter->loc <= last || iter->loc - last < (size_t) -iter->step))) { \
             iter->stop = ITERATOR_STOP;                                                     \
             return NULL;                                                                    \
         }                                                                                   \
         iter->loc += iter->step;                                                            \
     } else if (iter->stop == ITERATOR_PAUSE) {                                              \
-        if (!iter->num) {                                                                   \
+        size_t last = name##Iterator_last(iter);                                            \
+        if (!iter->num || (iter->step > 0 && iter->loc > last) || (iter->step < 0 && iter->loc < last)) { \
             iter->stop = ITERATOR_STOP;                                                     \
             return NULL;                                                                    \
         }                                                                                   \
@@ -188,16 +238,73 @@ type * type##Iterator_next(type##Iterator * iter) {
                                                                                             \
     return iter->array + iter->loc;                                                         \
 }                                                                                           \
-enum iterator_status type##Iterator_stop(type##Iterator * iter) {                           \
+/* index of the last element the slice can reach, bounded by the array */                   \
+storage size_t name##Iterator_last(name##Iterator * iter) {                                 \
+    if (iter->step > 0) {                                                                   \
+        return iter->end < iter->num ? iter->end : iter->num - 1;                           \
+    }                                                                                       \
+    return iter->end == SIZE_MAX ? 0 : iter->end;                                           \
+}                                                                                           \
+/* returns the number of elements not yet returned and sets first to the index of the first */ \
+storage size_t name##Iterator_remaining(name##Iterator * iter, size_t * first) {            \
+    if (!iter || !iter->num || (iter->stop != ITERATOR_GO && iter->stop != ITERATOR_PAUSE)) { \
+        return 0;                                                                           \
+    }                                                                                       \
+    size_t stride = iter->step > 0 ? (size_t) iter->step : (size_t) -iter->step;           \
+    size_t last = name##Iterator_last(iter);                                                \
+    *first = iter->loc;                                                                     \
+    if ((iter->step > 0 && *first > last) || (iter->step < 0 && *first < last)) {           \
+        return 0;                                                                           \
+    }                                                                                       \
+    size_t distance = iter->step > 0 ? last - *first : *first - last;                      \
+    if (iter->stop == ITERATOR_GO) { /* loc was already returned */                         \
+        if (distance < stride) {                                                            \
+            return 0;                                                                       \
+        }                                                                                   \
+        *first += iter->step;                                                               \
+        distance -= stride;                                                                 \
+    }                                                                                       \
+    return distance / stride + 1;                                                           \
+}                                                                                           \
+/* number of elements not yet returned */                                                  \
+storage size_t name##Iterator_length(name##Iterator * iter) {                               \
+    size_t first = 0;                                                                       \
+    return name##Iterator_remaining(iter, &first);                                          \
+}                                                                                           \
+/* returns the next *count elements, contiguous in the array for step 1 and otherwise gathered in \
+   buffer of ITERATOR_BLOCK_SIZE elements, and advances past them. Can be mixed with name##Iterator_next */ \
+storage type * name##Iterator_next_block(name##Iterator * iter, type * buffer, size_t * count) {    \
+    size_t first = 0;                                                                       \
+    *count = name##Iterator_remaining(iter, &first);                                        \
+    if (!*count) {                                                                          \
+        if (iter) {                                                                         \
+            iter->stop = iter->stop == ITERATOR_FAIL ? ITERATOR_FAIL : ITERATOR_STOP;       \
+        }                                                                                   \
+        return NULL;                                                                        \
+    }                                                                                       \
+    iter->stop = ITERATOR_GO;                                                               \
+    if (iter->step == 1) {                                                                  \
+        iter->loc = first + *count - 1;                                                     \
+        return iter->array + first;                                                         \
+    }                                                                                       \
+    *count = *count < ITERATOR_BLOCK_SIZE ? *count : ITERATOR_BLOCK_SIZE;                   \
+    type * elem = iter->array + first;                                                      \
+    for (size_t i = 0; i < *count; i++, elem += iter->step) {                               \
+        buffer[i] = *elem;                                                                  \
+    }                                                                                       \
+    iter->loc = first + (*count - 1) * iter->step;                                          \
+    return buffer;                                                                          \
+}                                                                                           \
+storage enum iterator_status name##Iterator_stop(name##Iterator * iter) {                           \
     if (!iter) {                                                                            \
         return ITERATOR_STOP;                                                               \
     }                                                                                       \
     return iter->stop;                                                                      \
 }                                                                                           \
-size_t type##Iterator_elem_size(type##Iterator *iter) {                                     \
+storage size_t name##Iterator_elem_size(name##Iterator *iter) {                                     \
     return sizeof(type);                                                                    \
 }                                                                                           \
-void type##IteratorIterator_init(type##IteratorIterator * iter_iter, type##Iterator * iter) {\
+storage void name##IteratorIterator_init(name##IteratorIterator * iter_iter, name##Iterator * iter) {\
     if (!iter_iter) {                                                                       \
         return;                                                                             \
     }                                                                                       \
@@ -207,27 +314,46 @@ void type##IteratorIterator_init(type##IteratorIterator * iter_iter, type##Itera
     }                                                                                       \
     *iter_iter = *iter;                                                                     \
 }                                                                                           \
-type * type##IteratorIterator_next(type##IteratorIterator * iter) {                         \
-    return type##Iterator_next(iter);                                                       \
+storage type * name##IteratorIterator_next(name##IteratorIterator * iter) {                         \
+    return name##Iterator_next(iter);                                                       \
+}                                                                                           \
+storage type * name##IteratorIterator_next_block(name##IteratorIterator * iter, type * buffer, size_t * count) { \
+    return name##Iterator_next_block(iter, buffer, count);                                  \
 }                                                                                           \
-enum iterator_status type##IteratorIterator_stop(type##Iterator * iter) {                   \
-    return type##Iterator_stop(iter);                                                       \
+storage size_t name##IteratorIterator_length(name##IteratorIterator * iter) {              \
+    return name##Iterator_length(iter);                                                     \
 }                                                                                           \
-size_t type##IteratorIterator_elem_size(type##Iterator * iter) {                            \
+storage enum iterator_status name##IteratorIterator_stop(name##Iterator * iter) {                   \
+    return name##Iterator_stop(iter);                                                       \
+}                                                                                           \
+storage size_t name##IteratorIterator_elem_size(name##Iterator * iter) {                            \
     return sizeof(type);                                                                    \
 }                                                                                           \
-type##Iterator * type##_slice(type * array, size_t num, size_t start, size_t end, long long int step) {                    \
+storage name##Iterator * name##_slice(type * array, size_t num, size_t start, size_t end, long long int step) {                    \
     if (start >= num || (end > num && !(end == SIZE_MAX)) || start == end || !step || (step > 0 && start > end) || (step < 0 && start < end && end != SIZE_MAX)) { \
         return NULL;                                                                        \
     }                                                                                       \
-    type##Iterator * iter = type##Iterator_new(array, num);                                 \
+    name##Iterator * iter = name##Iterator_new(array, num);                                 \
     iter->start = start;                                                                    \
     iter->loc = start;                                                                      \
     iter->end = end;                                                                        \
     iter->step = step;                                                                      \
     /*printf("\nslice: num %zu, loc %zu, start %zu, stop %zu, %lld step", iter->num, iter->loc, iter->start, iter->end, iter->step);*/\
     return iter;                                                                            \
-}                                                                                           \
+}
+
+#define define_array_iterator(type) define_array_iterator_(, type, type)
+
+/*
+generates static inline definitions of typeInlineIterator objects, which behave as typeIterator
+objects, for use in a single translation unit. This lets the compiler reduce e.g.
+for_each(double, v, doubleInline, array, num) to a plain indexed loop
+*/
+#define define_array_iterator_inline(type)                                                  \
+declare_array_iterator_struct(type, type##Inline)                                           \
+declare_array_iterator_functions(static inline, type, type##Inline)                         \
+define_sized_iterable(type##Inline)                                                         \
+define_array_iterator_(static inline, type, type##Inline)
 
 // The combination (objtype, inst) must be unique within a local scope
 // variadic argument are the arguments in available constructors 
@@ -243,6 +369,116 @@ objtype##Iterator objtype##_##inst##_iter;
 objtype##Iterator_init(&objtype##_##inst##_iter, __VA_ARGS__);                      \
 for (struct {size_t i; insttype * val;} inst = { 0, (insttype *) objtype##Iterator_next(&objtype##_##inst##_iter)}; !objtype##Iterator_stop(&objtype##_##inst##_iter); inst.i++, inst.val = (insttype *) objtype##Iterator_next(&objtype##_##inst##_iter))
 
+// iterates blocks of elements, inst points to the count elements of each block, gathered on the stack 
+// for strided slices
+// The combination (objtype, inst) must be unique within a local scope as well as count itself as a variable
+// variadic argument are the arguments in available constructors
+#define for_each_block(insttype, inst, count, objtype, ...)                         \
+objtype##Iterator objtype##_##inst##_iter;                                          \
+objtype##Iterator_init(&objtype##_##inst##_iter, __VA_ARGS__);                      \
+insttype objtype##_##inst##_block[ITERATOR_BLOCK_SIZE];                             \
+size_t count = 0;                                                                   \
+for (insttype * inst = (insttype *) objtype##Iterator_next_block(&objtype##_##inst##_iter, objtype##_##inst##_block, &count); !objtype##Iterator_stop(&objtype##_##inst##_iter); inst = (insttype *) objtype##Iterator_next_block(&objtype##_##inst##_iter, objtype##_##inst##_block, &count))
+
+/*
+the fused forms below continue the statement following a for_each or another fused form, so that
+e.g. for_each(char, tok, Token, ...) then_filter(*tok != '#') then_map(size_t, len, strlen(tok)) {...}
+compiles to a single loop without iterator objects in between. A break inside then_map only leaves 
+the current element. then_take(counter, n) ends the loop once n elements reached it, so after a 
+then_filter it counts only the elements that passed, and uses an existing size_t counter set to 0
+*/
+#define then_filter(condition) if (!(condition)) {} else
+#define then_map(out_type, out, expression)                                         \
+for (bool out##_once = true; out##_once; out##_once = false)                        \
+for (out_type out = (expression); out##_once; out##_once = false)
+#define then_take(counter, n) if ((counter)++ >= (n)) break; else
+
+typedef void * (*iterator_next_fn)(void * iter);
+typedef enum iterator_status (*iterator_stop_fn)(void * iter);
+typedef size_t (*iterator_length_fn)(void * iter);
+
+// type-erased for_each-compatible iterator that the lazy combinators below wrap
+typedef struct Iterable {
+    void * iter; // NOT owned by the Iterable
+    iterator_next_fn next;
+    iterator_stop_fn stop;
+    iterator_length_fn length; // number of elements left if known, else NULL
+} Iterable;
+
+// e.g. ITERABLE(Token, &tokens), ITERABLE(double, &doubles) or ITERABLE(Filter, &filter). objtype 
+// needs define_iterable(objtype)
+#define ITERABLE(objtype, iter) ((Iterable) {(void *) (iter), objtype##Iterator_next_erased, objtype##Iterator_stop_erased, NULL})
+// for objtypes with define_sized_iterable(objtype)
+#define SIZED_ITERABLE(objtype, iter) ((Iterable) {(void *) (iter), objtype##Iterator_next_erased, objtype##Iterator_stop_erased, objtype##Iterator_length_erased})
+
+/*
+lazy combinators. They allocate nothing, pull one element from their sources per element they 
+return and are for_each-compatible, e.g. for_each(char, tok, Filter, ITERABLE(Token, &tokens), fn, NULL)
+*/
+// returns fn(elem, data) for each element of source
+typedef struct MapIterator {
+    Iterable source;
+    void * (*fn)(void * elem, void * data);
+    void * data;
+    enum iterator_status stop;
+} MapIterator;
+
+// returns the elements of source for which predicate(elem, data) is true
+typedef struct FilterIterator {
+    Iterable source;
+    bool (*predicate)(void * elem, void * data);
+    void * data;
+    enum iterator_status stop;
+} FilterIterator;
+
+// returns an array of the next element of each source until either stops
+typedef struct ZipIterator {
+    Iterable sources[2];
+    void * elems[2];
+    enum iterator_status stop;
+} ZipIterator;
+
+// returns the first num elements of source
+typedef struct TakeIterator {
+    Iterable source;
+    size_t num;
+    size_t taken;
+    enum iterator_status stop;
+} TakeIterator;
+
+// returns the elements of first, then those of second
+typedef struct ChainIterator {
+    Iterable sources[2];
+    size_t active;
+    enum iterator_status stop;
+} ChainIterator;
+
+void MapIterator_init(MapIterator * map, Iterable source, void * (*fn)(void * elem, void * data), void * data);
+void * MapIterator_next(MapIterator * map);
+enum iterator_status MapIterator_stop(MapIterator * map);
+
+void FilterIterator_init(FilterIterator * filter, Iterable source, bool (*predicate)(void * elem, void * data), void * data);
+void * FilterIterator_next(FilterIterator * filter);
+enum iterator_status FilterIterator_stop(FilterIterator * filter);
+
+void ZipIterator_init(ZipIterator * zip, Iterable first, Iterable second);
+void ** ZipIterator_next(ZipIterator * zip);
+enum iterator_status ZipIterator_stop(ZipIterator * zip);
+
+void TakeIterator_init(TakeIterator * take, Iterable source, size_t num);
+void * TakeIterator_next(TakeIterator * take);
+enum iterator_status TakeIterator_stop(TakeIterator * take);
+
+void ChainIterator_init(ChainIterator * chain, Iterable first, Iterable second);
+void * ChainIterator_next(ChainIterator * chain);
+enum iterator_status ChainIterator_stop(ChainIterator * chain);
+
+define_iterable(Map)
+define_iterable(Filter)
+define_iterable(Zip)
+define_iterable(Take)
+define_iterable(Chain)
+
 #define RESIZE_REALLOC(result, elem_type, obj, num)                                 \
 { /* encapsulate to ensure temp_obj can be reused */                                \
 elem_type* temp_obj = (elem_type*) CL_REALLOC(obj, sizeof(elem_type) * (num));      \
@@ -256,36 +492,60 @@ if (temp_obj) {
 
 void iterative_parray_del(void ** obj, size_t num);
 
-// if it fails, no object is created and new_obj##_size is set to 0. Do not use the new_obj##_size as failure. failure is indicated by new_obj == NULL
-// only does a shallow copy
+#define comprehension_unknown_length(iter) 0
+
 /*
-// expression must take an inst_type * input and result in out_type *
-#define array_comprehension(out_type, new_obj, expression, inst_type, inst, objtype, ...)                                                    \
-size_t new_obj##_size = INIT_COMPREHENSION_SIZE;                                                                \
-out_type * new_obj = (out_type *) CL_ITERATOR_MALLOC(sizeof(out_type) * new_obj##_size);                           \
+collects expression, evaluated for each inst of the objtype iterator constructed from the variadic 
+arguments, into out_type * new_obj with new_obj##_size elements. new_obj grows by 
+COMPREHENSION_SCALE from INIT_COMPREHENSION_SIZE and is trimmed to size at the end, so n elements 
+take O(log n) reallocations. array_comprehension_sized instead allocates objtype##Iterator_length
+elements up front, for iterators that know their length (array iterators, CSVFileIterator)
+
+if it fails, no object is created and new_obj##_size is set to 0. Do not use the new_obj##_size as 
+failure. failure is indicated by new_obj == NULL, as is an empty iterator. Only does a shallow copy
+*/
+#define array_comprehension(out_type, new_obj, expression, inst_type, inst, objtype, ...)         \
+array_comprehension_(out_type, new_obj, expression, inst_type, inst, objtype, comprehension_unknown_length, __VA_ARGS__)
+
+#define array_comprehension_sized(out_type, new_obj, expression, inst_type, inst, objtype, ...)   \
+array_comprehension_(out_type, new_obj, expression, inst_type, inst, objtype, objtype##Iterator_length, __VA_ARGS__)
+
+#define array_comprehension_(out_type, new_obj, expression, inst_type, inst, objtype, length, ...)                \
+size_t new_obj##_size = 0;                                                                                      \
+out_type * new_obj = NULL;                                                                                      \
 {                                                                                                               \
-objtype##Iterator * objtype##new_obj##iter = objtype##Iterator_iter(__VA_ARGS__);
-bool comprehension_go = true;
-size_t comprehension_i = 0;
-inst_type * inst = objtype##Iterator_next(objtype##new_obj##iter);
-while (comprehension_go && !(objtype##Iteratorend(objtype##new_obj##iter)==ITERATOR_STOP)) {
-    if (comprehension_i >= new_obj##_size) {
-        RESIZE_REALLOC(comprehension_go, out_type, new_obj, new_obj##_size * COMPREHENSION_SCALE);
-        if (!comprehension_go) {
-            objtype##Iterator_del(objtype##new_obj##iter);
-            ITERATOR_FREE(new_obj);
-            continue;
-        }
-        new_obj##_size *= COMPREHENSION_SCALE;
-    }
-    new_obj[comprehension_i] = expression;
-    comprehension_i++;
-    inst = objtype##Iterator_next(objtype##new_obj##iter);
-}
-if (new_obj##_size > comprehension_i) {
-    RESIZE_REALLOC(comprehension_go, out_type, new_obj, comprehension_i);
-    new_obj##_size = comprehension_i;
+objtype##Iterator new_obj##_iter;                                                                               \
+objtype##Iterator_init(&new_obj##_iter, __VA_ARGS__);                                                           \
+size_t new_obj##_alloc = length(&new_obj##_iter);                                                               \
+bool comprehension_go = !new_obj##_alloc || (new_obj = (out_type *) CL_MALLOC(sizeof(out_type) * new_obj##_alloc)); \
+for (inst_type * inst = comprehension_go ? (inst_type *) objtype##Iterator_next(&new_obj##_iter) : NULL; comprehension_go && !objtype##Iterator_stop(&new_obj##_iter); inst = (inst_type *) objtype##Iterator_next(&new_obj##_iter)) { \
+    if (new_obj##_size == new_obj##_alloc) {                                                                    \
+        size_t new_obj##_new_alloc = new_obj##_alloc ? new_obj##_alloc * COMPREHENSION_SCALE : INIT_COMPREHENSION_SIZE; \
+        RESIZE_REALLOC(comprehension_go, out_type, new_obj, new_obj##_new_alloc);                               \
+        if (!comprehension_go) {                                                                                \
+            break;                                                                                              \
+        }                                                                                                       \
+        new_obj##_alloc = new_obj##_new_alloc;                                                                  \
+    }                                                                                                           \
+    new_obj[new_obj##_size++] = (expression);                                                                   \
+}                                                                                                               \
+if (!comprehension_go) {                                                                                        \
+    CL_FREE(new_obj);                                                                                           \
+    new_obj = NULL;                                                                                             \
+    new_obj##_size = 0;                                                                                         \
+} else if (!new_obj##_size) {                                                                                   \
+    CL_FREE(new_obj);                                                                                           \
+    new_obj = NULL;                                                                                             \
+} else if (new_obj##_size < new_obj##_alloc) {                                                                  \
+    RESIZE_REALLOC(comprehension_go, out_type, new_obj, new_obj##_size); /* keeps new_obj if it fails */        \
+}                                                                                                               \
 }
-*/
+
+// copies the elem_size bytes of each element of source into one array and sets num. Sized by 
+// source.length when available. NULL if it fails or source is empty
+void * Iterable_collect(Iterable source, size_t elem_size, size_t * num);
+// copies each string of source into a single allocation holding the array of num pointers and the 
+// strings, freed with one CL_FREE. NULL if it fails or source is empty
+char ** Iterable_collect_strings(Iterable source, size_t * num);
 
 #endif // ITERATORS_H
\ No newline at end of file
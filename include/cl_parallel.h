@@ -0,0 +1,175 @@
+#include <math.h> // NAN
+#include "cl_iterators.h"
+
+#ifndef CL_PARALLEL_H
+#define CL_PARALLEL_H
+
+// chunks per thread handed out by cl_parallel_for, more chunks balance uneven work better
+#ifndef CL_PARALLEL_CHUNKS_PER_THREAD
+#define CL_PARALLEL_CHUNKS_PER_THREAD 8
+#endif // CL_PARALLEL_CHUNKS_PER_THREAD
+
+enum cl_reduction {
+    CL_REDUCE_SUM,
+    CL_REDUCE_MIN,
+    CL_REDUCE_MAX,
+    CL_REDUCE_COUNT,
+};
+
+// function called on the count indices starting at first of chunk
+typedef void (*cl_parallel_fn)(void * data, size_t chunk, size_t first, size_t count);
+
+/*
+splits [0, num) into n_chunks contiguous chunks and runs fn on each of them from nthreads threads, 
+including the calling thread, which take the next chunk when they finish one. Returns when all 
+chunks are done. The other threads are workers of a pool, started by the first call that needs them 
+and reused by later calls. If threads cannot be started, the remaining threads do their work. A call 
+made while another is using the pool, e.g. from fn, runs in the calling thread alone
+*/
+void cl_parallel_for(size_t num, size_t n_chunks, size_t nthreads, cl_parallel_fn fn, void * data);
+
+// joins the workers of the pool, e.g. before exiting. The next cl_parallel_for starts them again
+void cl_parallel_stop(void);
+
+/*
+this macro generates the declarations of the parallel functions of typeIterator objects. They 
+consume the elements the iterator has not returned and leave it stopped
+
+type##Iterator_parallel_for_each calls fn on each element from nthreads threads
+type##Iterator_parallel_reduce reduces the elements passing filter (all if NULL) into result, 0 for 
+an empty sum or count and NAN for an empty min or max. Partial results are combined in element 
+order so that sums do not depend on scheduling
+*/
+#define declare_parallel_array_iterator(type)                                                       \
+enum iterator_status type##Iterator_parallel_for_each(type##Iterator * iter, size_t nthreads, void (*fn)(type * elem, void * data), void * data); \
+enum iterator_status type##Iterator_parallel_reduce(type##Iterator * iter, size_t nthreads, enum cl_reduction reduction, bool (*filter)(type * elem, void * data), void * data, double * result); \
+enum iterator_status type##IteratorIterator_parallel_for_each(type##Iterator * iter, size_t nthreads, void (*fn)(type * elem, void * data), void * data); \
+enum iterator_status type##IteratorIterator_parallel_reduce(type##Iterator * iter, size_t nthreads, enum cl_reduction reduction, bool (*filter)(type * elem, void * data), void * data, double * result);
+
+declare_parallel_array_iterator(double)
+declare_parallel_array_iterator(float)
+declare_parallel_array_iterator(long)
+declare_parallel_array_iterator(int)
+declare_parallel_array_iterator(char)
+declare_parallel_array_iterator(size_t)
+
+// task shared by the threads of a parallel iteration over an array
+typedef struct ParallelArrayTask {
+    char * first; // first element
+    long long int step; // in bytes
+    void (*fn)(void); // cast back to the function types of the iterator
+    void (*filter)(void);
+    void * data;
+    double * partials; // 2 per chunk, the value and the number of elements reduced
+    size_t chunk_size;
+    enum cl_reduction reduction;
+} ParallelArrayTask;
+
+#define define_parallel_array_iterator(type)                                                        \
+static void type##Iterator_parallel_apply(void * data, size_t chunk, size_t first, size_t count) {  \
+    ParallelArrayTask * task = (ParallelArrayTask *) data;                                          \
+    void (*fn)(type *, void *) = (void (*)(type *, void *)) task->fn;                               \
+    char * elem = task->first + (long long int) first * task->step;                                \
+    for (size_t i = 0; i < count; i++, elem += task->step) {                                       \
+        fn((type *) elem, task->data);                                                              \
+    }                                                                                               \
+}                                                                                                   \
+static void type##Iterator_parallel_fold(void * data, size_t chunk, size_t first, size_t count) {   \
+    ParallelArrayTask * task = (ParallelArrayTask *) data;                                          \
+    bool (*filter)(type *, void *) = (bool (*)(type *, void *)) task->filter;                       \
+    char * elem = task->first + (long long int) first * task->step;                                \
+    double value = 0.0;                                                                             \
+    size_t n = 0;                                                                                   \
+    for (size_t i = 0; i < count; i++, elem += task->step) {                                       \
+        if (filter && !filter((type *) elem, task->data)) {                                         \
+            continue;                                                                               \
+        }                                                                                           \
+        double x = (double) *(type *) elem;                                                         \
+        switch (task->reduction) {                                                                  \
+            case CL_REDUCE_SUM: value += x; break;                                                  \
+            case CL_REDUCE_MIN: value = (!n || x < value) ? x : value; break;                       \
+            case CL_REDUCE_MAX: value = (!n || x > value) ? x : value; break;                       \
+            default: break; /* CL_REDUCE_COUNT */                                                   \
+        }                                                                                           \
+        n++;                                                                                        \
+    }                                                                                               \
+    task->partials[2*chunk] = value;                                                                \
+    task->partials[2*chunk + 1] = (double) n;                                                       \
+}                                                                                                   \
+/* sets up task for the remaining elements of iter and stops iter, returns the number of elements */ \
+static size_t type##Iterator_parallel_task(type##Iterator * iter, ParallelArrayTask * task) {      \
+    size_t first = 0;                                                                               \
+    size_t num = type##Iterator_remaining(iter, &first);                                            \
+    task->first = (char *) (iter->array + first);                                                   \
+    task->step = iter->step * (long long int) sizeof(type);                                         \
+    iter->stop = ITERATOR_STOP;                                                                     \
+    return num;                                                                                     \
+}                                                                                                   \
+enum iterator_status type##Iterator_parallel_for_each(type##Iterator * iter, size_t nthreads, void (*fn)(type * elem, void * data), void * data) { \
+    if (!iter || !fn || iter->stop == ITERATOR_FAIL) {                                              \
+        return ITERATOR_FAIL;                                                                       \
+    }                                                                                               \
+    ParallelArrayTask task = {.fn = (void (*)(void)) fn, .data = data};                                     \
+    size_t num = type##Iterator_parallel_task(iter, &task);                                         \
+    size_t n_chunks = (nthreads ? nthreads : 1) * CL_PARALLEL_CHUNKS_PER_THREAD;                                   \
+    cl_parallel_for(num, n_chunks < num ? n_chunks : num, nthreads, type##Iterator_parallel_apply, &task); \
+    return ITERATOR_STOP;                                                                           \
+}                                                                                                   \
+enum iterator_status type##Iterator_parallel_reduce(type##Iterator * iter, size_t nthreads, enum cl_reduction reduction, bool (*filter)(type * elem, void * data), void * data, double * result) { \
+    if (!iter || !result || iter->stop == ITERATOR_FAIL) {                                          \
+        return ITERATOR_FAIL;                                                                       \
+    }                                                                                               \
+    ParallelArrayTask task = {.filter = (void (*)(void)) filter, .data = data, .reduction = reduction};     \
+    size_t num = type##Iterator_parallel_task(iter, &task);                                         \
+    size_t n_chunks = (nthreads ? nthreads : 1) * CL_PARALLEL_CHUNKS_PER_THREAD;                                   \
+    n_chunks = n_chunks < num ? n_chunks : num;                                                     \
+    task.partials = (double *) CL_MALLOC(sizeof(double) * 2 * (n_chunks + 1));                      \
+    if (!task.partials) {                                                                           \
+        iter->stop = ITERATOR_FAIL;                                                                 \
+        return ITERATOR_FAIL;                                                                       \
+    }                                                                                               \
+    cl_parallel_for(num, n_chunks, nthreads, type##Iterator_parallel_fold, &task);                  \
+    double value = 0.0, n = 0.0;                                                                    \
+    for (size_t chunk = 0; chunk < n_chunks; chunk++) {                                             \
+        double x = task.partials[2*chunk];                                                          \
+        if (!task.partials[2*chunk + 1]) {                                                          \
+            continue;                                                                               \
+        }                                                                                           \
+        switch (reduction) {                                                                        \
+            case CL_REDUCE_SUM: value += x; break;                                                  \
+            case CL_REDUCE_MIN: value = (!n || x < value) ? x : value; break;                       \
+            case CL_REDUCE_MAX: value = (!n || x > value) ? x : value; break;                       \
+            default: break;                                                                         \
+        }                                                                                           \
+        n += task.partials[2*chunk + 1];                                                            \
+    }                                                                                               \
+    CL_FREE(task.partials);                                                                         \
+    *result = reduction == CL_REDUCE_COUNT ? n : ((n || reduction == CL_REDUCE_SUM) ? value : NAN); \
+    return ITERATOR_STOP;                                                                           \
+}                                                                                                   \
+enum iterator_status type##IteratorIterator_parallel_for_each(type##Iterator * iter, size_t nthreads, void (*fn)(type * elem, void * data), void * data) { \
+    return type##Iterator_parallel_for_each(iter, nthreads, fn, data);                              \
+}                                                                                                   \
+enum iterator_status type##IteratorIterator_parallel_reduce(type##Iterator * iter, size_t nthreads, enum cl_reduction reduction, bool (*filter)(type * elem, void * data), void * data, double * result) { \
+    return type##Iterator_parallel_reduce(iter, nthreads, reduction, filter, data, result);         \
+}
+
+// calls fn(elem, data) on every element of the objtype iterator constructed from the variadic 
+// arguments, from nthreads threads in no particular order
+#define parallel_for_each(objtype, nthreads, fn, data, ...)                         \
+{                                                                                   \
+objtype##Iterator objtype##_parallel_iter;                                          \
+objtype##Iterator_init(&objtype##_parallel_iter, __VA_ARGS__);                      \
+objtype##Iterator_parallel_for_each(&objtype##_parallel_iter, nthreads, fn, data);  \
+}
+
+// reduces every element of the objtype iterator constructed from the variadic arguments into the
+// double result
+#define parallel_reduce(objtype, nthreads, reduction, result, ...)                                  \
+{                                                                                                   \
+objtype##Iterator objtype##_parallel_iter;                                                          \
+objtype##Iterator_init(&objtype##_parallel_iter, __VA_ARGS__);                                      \
+objtype##Iterator_parallel_reduce(&objtype##_parallel_iter, nthreads, reduction, NULL, NULL, &result); \
+}
+
+#endif // CL_PARALLEL_H
@@ -120,11 +120,100 @@ enum cl_status {
 
 size_t shift_index_to_positive(long long index, size_t container_size);
 
+// elements larger than CL_SWAP_CHUNK bytes are swapped in blocks of CL_SWAP_CHUNK bytes on the stack
+#ifndef CL_SWAP_CHUNK
+#define CL_SWAP_CHUNK 64
+#endif // CL_SWAP_CHUNK
+
 void cl_swap_unbuffered(void *, void *, size_t);
 void cl_swap_buffered(void *, void *, size_t, void *);
 enum cl_status cl_reverse_unbuffered(void *, void *, size_t);
 enum cl_status cl_reverse_buffered(void *, void *, size_t, void *);
 
+/********************************** MEMORY ***********************************/
+
+// alignment of the allocations of an Arena or a Pool
+#ifndef CL_ALLOC_ALIGNMENT
+#define CL_ALLOC_ALIGNMENT (2 * sizeof(void *))
+#endif // CL_ALLOC_ALIGNMENT
+
+#ifndef CL_ARENA_BLOCK_SIZE
+#define CL_ARENA_BLOCK_SIZE 65536
+#endif // CL_ARENA_BLOCK_SIZE
+
+// runtime allocator. Wherever an Allocator * is accepted, NULL means the CL_MALLOC/CL_REALLOC/CL_FREE macros
+typedef struct Allocator {
+	void * (*alloc)(void * context, size_t size);
+	void * (*realloc)(void * context, void * ptr, size_t size);
+	void (*free)(void * context, void * ptr); // NULL if memory is only released all at once, e.g. by an arena
+	void * context;
+} Allocator;
+
+void * cl_alloc(Allocator * allocator, size_t size);
+void * cl_realloc(Allocator * allocator, void * ptr, size_t size);
+void cl_free(Allocator * allocator, void * ptr);
+// whether the objects of allocator must be freed one by one
+bool cl_frees(Allocator * allocator);
+
+// block of an Arena or a Pool
+typedef struct AllocBlock {
+	struct AllocBlock * prev;
+	size_t size; // bytes after the header
+	size_t used;
+} AllocBlock;
+
+// bump allocator. Allocations are never freed individually but all at once by Arena_reset/Arena_del. 
+// realloc grows the latest allocation in place when possible
+typedef struct Arena {
+	AllocBlock * head; // block allocations come from, prev points to full blocks
+	size_t block_size;
+	Allocator allocator; // see Arena_allocator
+} Arena;
+
+void Arena_init(Arena * arena, size_t block_size);
+// frees every allocation
+void Arena_reset(Arena * arena);
+void Arena_del(Arena * arena);
+Allocator * Arena_allocator(Arena * arena);
+
+// allocator of objects of at most a fixed size, recycled through a free list
+typedef struct Pool {
+	AllocBlock * head;
+	void * free_list;
+	size_t elem_size;
+	size_t elems_per_block;
+	size_t n_allocs; // allocations served
+	size_t n_reuses; // allocations served by a freed element instead of new memory
+	Allocator allocator; // see Pool_allocator
+} Pool;
+
+void Pool_init(Pool * pool, size_t elem_size, size_t elems_per_block);
+void Pool_del(Pool * pool);
+Allocator * Pool_allocator(Pool * pool);
+
+#ifndef CL_POOL_CLASSES
+#define CL_POOL_CLASSES 8
+#endif // CL_POOL_CLASSES
+
+// smallest size class of a PoolSet, each next class doubles
+#ifndef CL_POOL_MIN_SIZE
+#define CL_POOL_MIN_SIZE 16
+#endif // CL_POOL_MIN_SIZE
+
+// a Pool per size class for objects of varying size, e.g. iterators and their buffers. Freed objects 
+// are reused, and realloc within the size class of an object does not move it. Objects larger than 
+// the largest class come from CL_MALLOC
+typedef struct PoolSet {
+	Pool pools[CL_POOL_CLASSES];
+	size_t n_allocs; // allocations served
+	size_t n_reuses; // allocations served by a freed object instead of new memory
+	Allocator allocator; // see PoolSet_allocator
+} PoolSet;
+
+void PoolSet_init(PoolSet * set, size_t elems_per_block);
+void PoolSet_del(PoolSet * set);
+Allocator * PoolSet_allocator(PoolSet * set);
+
 /************************* HANDLING SIGNS *************************/
 
 /******************************** COMPARISON *********************************/
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include "io_ext.h"
 
 /*
@@ -15,10 +16,6 @@ Specification following https://www.rfc-editor.org/rfc/rfc4180 with 2 exceptions
     precede a line break.
 */
 
-/*
-TODO: need to be able to track the max field count in the CSVFile struct so that I can validate enough fields exist SOMEWHERE
-*/
-
 // defaults
 #define DEFAULT_N_RECORDS 32
 #define DEFAULT_N_FIELDS 8
@@ -34,6 +31,13 @@ TODO: need to be able to track the max field count in the CSVFile struct so that
 
 #define FIELD_BUFFER_SIZE 32
 
+#ifndef CSV_WRITE_BUFFER_SIZE
+#define CSV_WRITE_BUFFER_SIZE 1048576
+#endif // CSV_WRITE_BUFFER_SIZE
+
+// marks a source column that is dropped by a column projection
+#define CSV_NOT_PROJECTED SIZE_MAX
+
 #define select_CSVFileIterator_iter(_1,_2,_3,_4, NAME,...) NAME
 #define CSVFileIterator_iter(...) Select_CSVFileIterator_iter(__VA_ARGS__, CSVFileIterator_new, CSVFileIterator_iter3, NONE, NONE, UNUSED)(__VA_ARGS__)
 
@@ -45,11 +49,170 @@ enum csv_status {
     CSV_SUCCESS = 0,
 };
 
+enum csv_error_kind {
+    CSV_ERROR_QUOTE_IN_FIELD, // quote within an unquoted field
+    CSV_ERROR_AFTER_QUOTE, // closing quote not followed by a delimiter or line ending
+    CSV_ERROR_EOF_IN_QUOTES, // file ended within a quoted field
+    CSV_ERROR_DANGLING_ESCAPE, // file ended after an escape character
+};
+
 enum csv_axis {
     CSV_COLUMN,
     CSV_ROW,
 };
 
+enum csv_filter_kind {
+    CSV_FILTER_EQUALS,
+    CSV_FILTER_PREFIX,
+    CSV_FILTER_RANGE,
+    CSV_FILTER_IN_SET,
+    CSV_FILTER_CALLBACK,
+};
+
+// field is the unquoted, nul-terminated contents of the field and size its length
+typedef bool (*csv_filter_callback)(char * field, size_t size, void * data);
+
+// row predicate evaluated on a single source column while the file is indexed
+typedef struct CSVFilter {
+    char * value; // EQUALS/PREFIX, NOT owned
+    char ** set; // IN_SET, NOT owned
+    csv_filter_callback callback; // CALLBACK
+    void * data; // passed to callback, NOT owned
+    size_t column; // source column
+    size_t value_size;
+    size_t n_set;
+    size_t span_start; // raw field in the record being scanned
+    size_t span_end; // 0 if the record being scanned does not have the column
+    double low; // RANGE, inclusive
+    double high; // RANGE, inclusive
+    enum csv_filter_kind kind;
+} CSVFilter;
+
+// special characters of a delimited text format. A '\0' quote, escape or comment disables the feature
+typedef struct CSVDialect {
+    char delimiter;
+    char quote; // quoted fields may contain the delimiter and line endings. Doubled quotes are literal
+    char escape; // makes the following character literal
+    char comment; // lines starting with comment are skipped
+    bool trim; // ignore spaces (and tabs unless they delimit) around fields
+} CSVDialect;
+
+#define CSV_DIALECT_RFC4180 ((CSVDialect) {.delimiter = ',', .quote = '"'})
+#define CSV_DIALECT_TSV ((CSVDialect) {.delimiter = '\t', .quote = '"'})
+#define CSV_DIALECT_PIPE ((CSVDialect) {.delimiter = '|', .quote = '"'})
+#define CSV_DIALECT_SEMICOLON ((CSVDialect) {.delimiter = ';', .quote = '"'})
+
+#ifndef CSV_ERROR_SAMPLES
+#define CSV_ERROR_SAMPLES 16
+#endif // CSV_ERROR_SAMPLES
+
+#ifndef CSV_SNIFF_SIZE
+#define CSV_SNIFF_SIZE 8192
+#endif // CSV_SNIFF_SIZE
+
+// format of a file guessed from its first bytes
+typedef struct CSVSniff {
+    CSVDialect dialect;
+    char * line_ending; // "\r\n", "\n" or "\r", static
+    bool has_header;
+} CSVSniff;
+
+enum csv_key_type {
+    CSV_KEY_STRING, // compared bytewise
+    CSV_KEY_NUMBER, // compared as doubles, fields that are not numbers sort last
+};
+
+// column and ordering of a sort key for CSVFile_sort_to
+typedef struct CSVSortKey {
+    size_t column;
+    enum csv_key_type type;
+    bool descending;
+} CSVSortKey;
+
+enum csv_aggregate_kind {
+    CSV_AGGREGATE_COUNT, // non-empty fields
+    CSV_AGGREGATE_SUM, // the aggregates below skip fields that are not numbers
+    CSV_AGGREGATE_MIN,
+    CSV_AGGREGATE_MAX,
+    CSV_AGGREGATE_MEAN,
+};
+
+typedef struct CSVAggregate {
+    size_t column;
+    enum csv_aggregate_kind kind;
+} CSVAggregate;
+
+// hash aggregation of records grouped by the decoded bytes of key columns
+typedef struct CSVGroupBy {
+    size_t * key_columns; // owned
+    CSVAggregate * aggregates; // owned
+    size_t * slots; // open addressing table of group + 1, 0 if empty
+    uint64_t * hashes; // hash of the key of each group
+    char * keys; // key of each group, for each key column a size_t length followed by the bytes
+    size_t * key_offsets; // start of the key of each group in keys, n_groups + 1 entries
+    double * accumulators; // value and number of fields folded in, for each aggregate of each group
+    char * record; // fields of the record being aggregated
+    size_t * field_offsets;
+    size_t n_keys;
+    size_t n_aggregates;
+    size_t n_slots; // power of 2
+    size_t n_groups;
+    size_t n_groups_alloc;
+    size_t keys_size;
+    size_t keys_alloc;
+    size_t record_size;
+    size_t n_field_offsets;
+} CSVGroupBy;
+
+enum csv_join_kind {
+    CSV_JOIN_INNER, // left records with at least one match
+    CSV_JOIN_LEFT, // every left record, with empty right fields if it has no match
+};
+
+// receives each joined row, the fields of the left record followed by those of the right record
+typedef enum csv_status (*CSVJoinCallback)(void * data, char ** fields, size_t * sizes, size_t n_fields);
+
+// malformed record found while indexing
+typedef struct CSVError {
+    size_t start; // byte range of the record up to and including the first line ending
+    size_t end;
+    enum csv_error_kind kind;
+} CSVError;
+
+#define CSV_CACHE_BUCKETS 64
+
+// decoded record held by a CSVRowCache. The fields follow offsets in the same allocation
+typedef struct CSVCacheRow {
+    struct CSVCacheRow * next_bucket; // chain of rows with the same hash
+    struct CSVCacheRow * newer; // LRU order
+    struct CSVCacheRow * older;
+    size_t record;
+    size_t n_fields;
+    size_t size; // bytes of the allocation
+    size_t offsets[]; // start of each nul-terminated field after offsets, CSV_NOT_PROJECTED if missing
+} CSVCacheRow;
+
+// bounded LRU cache of decoded records for random access through CSVFile_get_cell
+typedef struct CSVRowCache {
+    CSVCacheRow ** buckets; // hashed by record index
+    CSVCacheRow * newest;
+    CSVCacheRow * oldest;
+    size_t n_buckets; // power of 2
+    size_t n_rows;
+    size_t size; // bytes held by rows
+    size_t capacity; // bytes
+    size_t hits;
+    size_t misses;
+} CSVRowCache;
+
+// pending cell edit in CSV_AMENDER mode
+typedef struct CSVEdit {
+    char * value; // owned, unquoted
+    size_t record;
+    size_t field;
+    size_t size;
+} CSVEdit;
+
 typedef struct CSVRecord {
     // replace with a stack of size_t
     size_t * field_pos; // positions of fields. allocation size if n_fields_alloc + 1, First value is start of record, each subsequent value is the end of a field
@@ -57,6 +220,7 @@ typedef struct CSVRecord {
     char ** fields; // array of c strings for fields. For writing only
     size_t n_fields; // number of fields found
     size_t n_fields_alloc; // number of fields allocated. 
+    bool quoted; // a field is quoted, so reading the record must remove the quotes
 } CSVRecord;
 
 typedef struct CSVFile {
@@ -69,6 +233,42 @@ typedef struct CSVFile {
     char * filename;
     char * file_out;
     char * line_ending; // normally just "\r\n"
+    size_t * projection; // source column of each projected field. NULL means all fields are indexed
+    char ** projection_names; // header names resolved into projection on read, NOT owned
+    size_t * projection_map; // source column -> projected field or CSV_NOT_PROJECTED
+    size_t n_projection; // number of projected fields
+    size_t projection_map_size; // number of source columns covered by projection_map
+    CSVFilter * filters; // all must match for a record to be indexed
+    size_t n_filters;
+    size_t n_filtered; // number of records dropped by filters
+    char * filter_buffer; // holds the field being tested by filters
+    size_t filter_buffer_size;
+    // field count statistics of the indexed records, counted in source columns
+    size_t * n_fields_histogram; // number of records with i fields for i in [0, max_n_fields]
+    size_t max_n_fields;
+    size_t min_n_fields;
+    bool rectangular; // all records have max_n_fields fields
+    CSVEdit * edits; // CSV_AMENDER overlay, sorted by (record, field)
+    size_t n_edits;
+    size_t n_edits_alloc;
+    // reader state saved for CSVFile_refresh
+    size_t scan_resume; // start of the final record, where indexing resumes
+    size_t scan_partial_columns; // source columns in the partial final record
+    bool scan_partial; // final record had no line ending and is indexed again on refresh
+    bool scan_partial_kept; // partial final record passed the filters
+    CSVDialect dialect; // CSV_READER only, others use CSV_DIALECT_RFC4180
+    CSVRowCache * cache; // NULL unless enabled by CSVFile_set_cache
+    Allocator * allocator; // of the records and their field positions, NULL for IO_MALLOC. NOT owned
+    Allocator * iterator_allocator; // of the iterators from CSVFile_get_column/row, NULL for IO_MALLOC. NOT owned
+    CSVError * errors; // the first malformed records found
+    size_t n_errors; // number of malformed records found
+    size_t n_error_samples; // number of errors kept in errors
+    size_t max_error_samples;
+    struct CSVFile * parent; // owner of the shared index of a view from CSVFile_open_rows, NOT owned
+    size_t range_start; // only records starting in [range_start, range_end) are indexed
+    size_t range_end;
+    enum csv_error_kind scan_error; // reason of the last malformed record
+    bool recover; // skip malformed records instead of failing the read
     char mode; // read, write, amend
     bool has_header;
 } CSVFile;
@@ -83,26 +283,52 @@ typedef struct CSVFileIterator {
     size_t end;
     size_t step;
     enum csv_axis axis;
+    Allocator * allocator; // of the CSVFileIterator and its buffer if made by CSVFileIterator_new_with
     enum iterator_status stop;
     bool buffer_reclaim;
 } CSVFileIterator, CSVFileIteratorIterator;
 
+// streams records to a file through a buffer of constant size, for output that does not fit in memory
+typedef struct CSVWriter {
+    FILE * handle; // NOT owned by the CSVWriter
+    char * buffer; // owned by the CSVWriter if buffer_reclaim
+    char * line_ending;
+    size_t buffer_size; // the buffer is written to the file when full
+    size_t size; // bytes in buffer
+    size_t line_ending_size;
+    size_t n_fields; // fields written to the current record
+    size_t n_records; // records completed
+    enum csv_status status; // first failure is sticky
+    bool empty; // current record has no content
+    bool buffer_reclaim;
+} CSVWriter;
+
 CSVFile * CSVFile_new(char * filename, char mode, bool has_header, char * line_ending, char * file_out);
+// same as CSVFile_new but does not index the file so that reader options can be set before CSVFile_read
+CSVFile * CSVFile_open(char * filename, char mode, bool has_header, char * line_ending, char * file_out);
+// same as CSVFile_new with the index from allocator, e.g. an Arena so that CSVFile_del does not visit the records
+CSVFile * CSVFile_new_with(Allocator * allocator, char * filename, char mode, bool has_header, char * line_ending, char * file_out);
 void CSVFile_init(CSVFile * csv, char * filename, char mode, bool has_header, char * line_ending, char * file_out);
 void CSVFile_del(CSVFile * csv);
 enum csv_status CSVFile_append_record(CSVFile * csv, size_t pos);
 
 CSVFileIterator * CSVFileIterator_new(CSVFile * csv, size_t index, enum csv_axis axis, size_t buffer_size);
+CSVFileIterator * CSVFileIterator_new_with(Allocator * allocator, CSVFile * csv, size_t index, enum csv_axis axis, size_t buffer_size);
 //CSVFileIterator * CSVFileIterator_iter3(CSVFile * csv, size_t index, enum csv_axis axis);
 void CSVFileIterator_init(CSVFileIterator * csv_iter, CSVFile * csv, size_t index, enum csv_axis axis, char * buffer, size_t buffer_size);
 void CSVFileIterator_del(CSVFileIterator * csv_iter);
 // NULL means failure or stop condition and NOT an empty field
 char * CSVFileIterator_next(CSVFileIterator * csv_iter);
+// number of cells not yet returned
+size_t CSVFileIterator_length(CSVFileIterator * csv_iter);
 enum iterator_status CSVFileIterator_stop(CSVFileIterator * csv_iter);
 //CSVFileIterator * CSVFileIteratorIterator_iter(CSVFileIterator * csv_iter);
 void CSVFileIteratorIterator_init(CSVFileIteratorIterator * csv_iter_iter, CSVFileIterator * csv_iter);
 char * CSVFileIteratorIterator_next(CSVFileIteratorIterator * csv_iter);
 enum iterator_status CSVFileIteratorIterator_stop(CSVFileIteratorIterator * csv_iter);
+size_t CSVFileIteratorIterator_length(CSVFileIteratorIterator * csv_iter);
+define_sized_iterable(CSVFile)
+define_sized_iterable(CSVFileIterator)
 
 CSVRecord * CSVRecord_new(char mode, size_t start, size_t init_field_alloc);
 void CSVRecord_init(CSVRecord * csvr, char mode, size_t start, size_t init_field_alloc);
@@ -110,8 +336,98 @@ void CSVRecord_del(CSVRecord * csvr);
 // only use in CSV_READER mode or when adding a new record, otherwise do not use in CSV_AMENDER mode
 enum csv_status CSVRecord_append_field_pos(CSVRecord * csvr, size_t pos);
 
+// column projection, CSV_READER mode only and must be set before CSVFile_read. Only the listed 
+// source columns are indexed and they become fields 0..n_columns-1 of every record
+enum csv_status CSVFile_set_projection(CSVFile * csv, size_t * columns, size_t n_columns);
+// same as CSVFile_set_projection, but columns are looked up by name in the header record. names must 
+// outlive CSVFile_read
+enum csv_status CSVFile_set_projection_names(CSVFile * csv, char ** names, size_t n_names);
+// sets the delimiter, quoting, escaping, comments and trimming used to read the file. Must be called 
+// before CSVFile_read on a CSV_READER from CSVFile_open
+enum csv_status CSVFile_set_dialect(CSVFile * csv, CSVDialect dialect);
+// skips malformed records while reading instead of failing, resuming after the first line ending of 
+// the record. Must be called before CSVFile_read on a CSV_READER from CSVFile_open
+enum csv_status CSVFile_set_recovery(CSVFile * csv, size_t max_error_samples);
+// allocates the records and their field positions from allocator, which must outlive csv. Must be 
+// called before any record is indexed or added
+enum csv_status CSVFile_set_allocator(CSVFile * csv, Allocator * allocator);
+// allocates the iterators of CSVFile_get_column/row and their buffers from allocator, e.g. a PoolSet so 
+// that iterators deleted in a loop are reused by the next call
+enum csv_status CSVFile_set_iterator_allocator(CSVFile * csv, Allocator * allocator);
+// caches up to capacity bytes of decoded records read by CSVFile_get_cell, evicting the least recently 
+// used. A capacity of 0 removes the cache
+enum csv_status CSVFile_set_cache(CSVFile * csv, size_t capacity);
+// writes the records of an indexed, unprojected csv to out_path ordered by keys, ties keeping file 
+// order. Records are copied from the source as is, and the header stays first. Sorting uses at most 
+// about memory_budget bytes, spilling sorted runs to temporary files that are merged when they do not fit
+enum csv_status CSVFile_sort_to(CSVFile * csv, char * out_path, CSVSortKey * keys, size_t n_keys, size_t memory_budget);
+CSVGroupBy * CSVGroupBy_new(size_t * key_columns, size_t n_keys, CSVAggregate * aggregates, size_t n_aggregates);
+void CSVGroupBy_del(CSVGroupBy * groups);
+// aggregates all records of an indexed, unprojected csv (except its header) in a single pass
+enum csv_status CSVGroupBy_add(CSVGroupBy * groups, CSVFile * csv);
+// folds the partial aggregation other, e.g. built by another worker on a range of the file, into groups
+enum csv_status CSVGroupBy_merge(CSVGroupBy * groups, CSVGroupBy * other);
+// returns the bytes of a key column of group, not nul-terminated, and sets size
+char * CSVGroupBy_key(CSVGroupBy * groups, size_t group, size_t key, size_t * size);
+// NAN for the min, max or mean of a group without numbers
+double CSVGroupBy_value(CSVGroupBy * groups, size_t group, size_t aggregate);
+// hash join of the records of left and right whose key fields are equal. right is the build side and 
+// should be the smaller file. When its hash table would exceed memory_budget bytes (0 for no limit), 
+// both files are partitioned by key to temporary files and joined one partition at a time, which 
+// emits rows grouped by partition instead of in the order of left. Headers are joined into a header row
+enum csv_status CSVFile_join(CSVFile * left, size_t left_column, CSVFile * right, size_t right_column, enum csv_join_kind kind, size_t memory_budget, CSVJoinCallback callback, void * data);
+// CSVJoinCallback writing each row as a record of the CSVWriter data
+enum csv_status CSVWriter_join_callback(void * data, char ** fields, size_t * sizes, size_t n_fields);
+// returns the index-th malformed record kept, NULL if out of range
+CSVError * CSVFile_get_error(CSVFile * csv, size_t index);
+// guesses the line ending, delimiter, quote and header from up to prefix_size bytes (CSV_SNIFF_SIZE if 
+// 0) at the current position of handle, which is restored
+enum csv_status CSVSniff_init(CSVSniff * sniff, FILE * handle, size_t prefix_size);
+// sniffs the file and sets its line ending, dialect and has_header. Must be called before CSVFile_read 
+// on a CSV_READER from CSVFile_open
+enum csv_status CSVFile_sniff(CSVFile * csv);
+
+// row filters, CSV_READER mode only and must be added before CSVFile_read. column is the source 
+// column and all filters must match a record for it to be indexed. A header record is always kept. 
+// Records without the column never match. Comparisons are on the unquoted field
+enum csv_status CSVFile_filter_equals(CSVFile * csv, size_t column, char * value);
+enum csv_status CSVFile_filter_prefix(CSVFile * csv, size_t column, char * prefix);
+// field must parse entirely as a number in [low, high]
+enum csv_status CSVFile_filter_range(CSVFile * csv, size_t column, double low, double high);
+enum csv_status CSVFile_filter_in_set(CSVFile * csv, size_t column, char ** values, size_t n_values);
+enum csv_status CSVFile_filter_callback(CSVFile * csv, size_t column, csv_filter_callback callback, void * data);
+
 enum csv_status CSVFile_read(CSVFile * csv);
-int CSVFile_write(CSVFile * csv);
+// opens a CSV_READER that indexes only the records starting in [byte_start, byte_end), so that adjacent 
+// ranges partition the records of the file. The final record is indexed in full even if it ends after 
+// byte_end. The header is only recognized in the range containing the start of the file
+CSVFile * CSVFile_open_range(char * filename, bool has_header, char * line_ending, size_t byte_start, size_t byte_end);
+// view of count records of csv starting at record first. The view shares the index and file handle of 
+// csv, which must outlive it, and is read-only
+CSVFile * CSVFile_open_rows(CSVFile * csv, size_t first, size_t count);
+// indexes only the bytes appended to the file since the last CSVFile_read or CSVFile_refresh. A final 
+// record without a line ending is indexed again in case it was still being written
+enum csv_status CSVFile_refresh(CSVFile * csv);
+// CSV_WRITER mode writes all records set with CSVFile_set_cell to the file.
+// CSV_AMENDER mode applies the cell edits. Without file_out, edits that keep the byte width of their 
+// cell are patched in place, otherwise the file is rewritten and indexed again. With file_out, the 
+// amended file is written there, replacing what a previous call wrote, and the edits are kept. 
+// Unedited bytes are copied and never re-parsed
+enum csv_status CSVFile_write(CSVFile * csv);
+
+// flush_threshold is the buffer size, defaults to CSV_WRITE_BUFFER_SIZE. line_ending defaults to DEFAULT_LINE_ENDING
+CSVWriter * CSVWriter_new(FILE * handle, char * line_ending, size_t flush_threshold);
+void CSVWriter_init(CSVWriter * writer, FILE * handle, char * line_ending, char * buffer, size_t flush_threshold);
+// flushes and frees the writer, the handle is not closed
+enum csv_status CSVWriter_del(CSVWriter * writer);
+enum csv_status CSVWriter_flush(CSVWriter * writer);
+void CSVWriter_begin_record(CSVWriter * writer);
+// field does not need to be nul-terminated. Quoted only if it contains a delimiter, quote or line ending
+enum csv_status CSVWriter_write_field(CSVWriter * writer, const char * field, size_t size);
+enum csv_status CSVWriter_write_field_int64(CSVWriter * writer, int64_t value);
+// up to 15 significant digits, without trailing zeros
+enum csv_status CSVWriter_write_field_double(CSVWriter * writer, double value);
+enum csv_status CSVWriter_end_record(CSVWriter * writer);
 
 // for builders
 /*
@@ -119,7 +435,10 @@ int CSVFile_append_record(CSVFile * csv, char ** record, size_t n_fields);
 int CSVFile_append_field(CSVFile * csv, size_t record, char * format, ...);
 */
 
-int CSVFile_set_cell(CSVFile * csv, size_t record, size_t field, char * format, ...);
+// printf-style formatting of the cell at (record, field). In CSV_WRITER mode, records and fields 
+// are added as needed and skipped fields are empty. In CSV_AMENDER mode, the cell must exist and the 
+// edit is held in an overlay until CSVFile_write
+enum csv_status CSVFile_set_cell(CSVFile * csv, size_t record, size_t field, char * format, ...);
 // NOTE: to actually read a cell into a single string, format should be %[^\0] as just %s will stop at the first space. %[^\0] will collect all characters until string terminator
 enum csv_status CSVFile_get_cell(CSVFile * csv, size_t record, size_t field, char * format, ...);
 CSVFileIterator * CSVFile_get_column(CSVFile * csv, size_t icolumn);
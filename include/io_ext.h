@@ -44,6 +44,23 @@
 #define IO_FREE free
 #endif // IO_FREE
 
+// IO_MALLOC, IO_REALLOC and IO_FREE through allocator if not NULL
+static inline void * io_alloc(Allocator * allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->context, size) : IO_MALLOC(size);
+}
+
+static inline void * io_realloc(Allocator * allocator, void * ptr, size_t size) {
+    return allocator ? allocator->realloc(allocator->context, ptr, size) : IO_REALLOC(ptr, size);
+}
+
+static inline void io_free(Allocator * allocator, void * ptr) {
+    if (!allocator) {
+        IO_FREE(ptr);
+    } else if (allocator->free) {
+        allocator->free(allocator->context, ptr);
+    }
+}
+
 /*
 #define Select_TokenIterator_iter(_1,_2,_3,NAME,...) NAME
 #define TokenIterator_iter(...) Select_TokenIterator_iter(__VA_ARGS__, TokenIterator_new, TokenIterator_iter2, TokenIterator_iter1, UNUSED)(__VA_ARGS__)
@@ -61,6 +78,9 @@ typedef struct LineIterator {
     FILE * handle;                  // NOT owned by the LineIterator
     char * next;                // owned by LineIterator
     size_t buffer_size;
+    size_t follow_ms;           // poll interval while waiting for appended lines, 0 stops at EOF
+    size_t follow_timeout_ms;   // stop after waiting this long for a line, 0 waits forever
+    Allocator * allocator;      // of the LineIterator and its reclaimed buffer, NULL for IO_MALLOC
     enum iterator_status stop;
     bool buffer_reclaim;
 } LineIterator;
@@ -79,6 +99,7 @@ typedef struct TokenIterator {
     char * next;                // owned by TokenIterator
     size_t buffer_size;
     long long int loc;          // location index of last delimiter, -1 means not yet found
+    Allocator * allocator;      // of the TokenIterator and its reclaimed buffer, NULL for IO_MALLOC
     enum iterator_status stop;
     bool group;                // internal, do not set
     bool buffer_reclaim;
@@ -99,10 +120,12 @@ char * String_strip(char * string);
 
 
 LineIterator * LineIterator_new(FILE * handle, size_t buffer_size);
+LineIterator * LineIterator_new_with(Allocator * allocator, FILE * handle, size_t buffer_size);
 //LineIterator * LineIterator_iter1(FILE * fstr);
 void LineIterator_init(LineIterator * lines, FILE * handle, char * buffer, size_t buffer_size);
 void LineIterator_del(LineIterator * lines);
 char * LineIterator_next(LineIterator * lines);
+void LineIterator_follow(LineIterator * lines, size_t poll_ms, size_t timeout_ms);
 enum iterator_status LineIterator_stop(LineIterator * lines);
 
 FileLineIterator * FileLineIterator_new(const char * filename, const char * mode, size_t buffer_size);
@@ -114,6 +137,7 @@ char * FileLineIterator_next(FileLineIterator * file_iter);
 enum iterator_status FileLineIterator_stop(FileLineIterator * file_iter);
 
 TokenIterator * TokenIterator_new(char * string, char * delimiters, size_t buffer_size);
+TokenIterator * TokenIterator_new_with(Allocator * allocator, char * string, char * delimiters, size_t buffer_size);
 //TokenIterator * TokenIterator_iter2(char * string, char * delimiters);
 //TokenIterator * TokenIterator_iter1(char * string);
 void TokenIterator_init(TokenIterator * tokens, char * string, char * delimiters, char * buffer, size_t buffer_size);
@@ -121,4 +145,8 @@ void TokenIterator_del(TokenIterator * tokens);
 char * TokenIterator_next(TokenIterator * tokens);
 enum iterator_status TokenIterator_stop(TokenIterator * tokens);
 
+define_iterable(Line)
+define_iterable(FileLine)
+define_iterable(Token)
+
 #endif // IOEXT_H
\ No newline at end of file
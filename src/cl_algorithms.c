@@ -0,0 +1,13 @@
+#include "cl_algorithms.h"
+
+define_sort(double)
+define_sort(float)
+define_sort(long)
+define_sort(int)
+define_sort(char)
+define_sort(size_t)
+
+define_radix_sort(long)
+define_radix_sort(int)
+define_radix_sort(char)
+define_radix_sort(size_t)
@@ -19,3 +19,210 @@ void iterative_parray_del(void ** obj, size_t num) {
         }
     }
 }
+
+void MapIterator_init(MapIterator * map, Iterable source, void * (*fn)(void * elem, void * data), void * data) {
+    if (!map) {
+        return;
+    }
+    *map = (MapIterator) {.source = source, .fn = fn, .data = data, .stop = fn ? ITERATOR_PAUSE : ITERATOR_FAIL};
+}
+
+void * MapIterator_next(MapIterator * map) {
+    if (!map || map->stop == ITERATOR_STOP || map->stop == ITERATOR_FAIL) {
+        return NULL;
+    }
+    void * elem = map->source.next(map->source.iter);
+    if ((map->stop = map->source.stop(map->source.iter))) {
+        return NULL;
+    }
+    return map->fn(elem, map->data);
+}
+
+enum iterator_status MapIterator_stop(MapIterator * map) {
+    return map ? map->stop : ITERATOR_STOP;
+}
+
+void FilterIterator_init(FilterIterator * filter, Iterable source, bool (*predicate)(void * elem, void * data), void * data) {
+    if (!filter) {
+        return;
+    }
+    *filter = (FilterIterator) {.source = source, .predicate = predicate, .data = data, .stop = predicate ? ITERATOR_PAUSE : ITERATOR_FAIL};
+}
+
+void * FilterIterator_next(FilterIterator * filter) {
+    if (!filter || filter->stop == ITERATOR_STOP || filter->stop == ITERATOR_FAIL) {
+        return NULL;
+    }
+    while (true) {
+        void * elem = filter->source.next(filter->source.iter);
+        if ((filter->stop = filter->source.stop(filter->source.iter))) {
+            return NULL;
+        }
+        if (filter->predicate(elem, filter->data)) {
+            return elem;
+        }
+    }
+}
+
+enum iterator_status FilterIterator_stop(FilterIterator * filter) {
+    return filter ? filter->stop : ITERATOR_STOP;
+}
+
+void ZipIterator_init(ZipIterator * zip, Iterable first, Iterable second) {
+    if (!zip) {
+        return;
+    }
+    *zip = (ZipIterator) {.sources = {first, second}, .stop = ITERATOR_PAUSE};
+}
+
+void ** ZipIterator_next(ZipIterator * zip) {
+    if (!zip || zip->stop == ITERATOR_STOP || zip->stop == ITERATOR_FAIL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < 2; i++) {
+        zip->elems[i] = zip->sources[i].next(zip->sources[i].iter);
+        if ((zip->stop = zip->sources[i].stop(zip->sources[i].iter))) {
+            return NULL;
+        }
+    }
+    return zip->elems;
+}
+
+enum iterator_status ZipIterator_stop(ZipIterator * zip) {
+    return zip ? zip->stop : ITERATOR_STOP;
+}
+
+void TakeIterator_init(TakeIterator * take, Iterable source, size_t num) {
+    if (!take) {
+        return;
+    }
+    *take = (TakeIterator) {.source = source, .num = num, .stop = ITERATOR_PAUSE};
+}
+
+void * TakeIterator_next(TakeIterator * take) {
+    if (!take || take->stop == ITERATOR_STOP || take->stop == ITERATOR_FAIL) {
+        return NULL;
+    }
+    if (take->taken == take->num) { // without pulling another element from source
+        take->stop = ITERATOR_STOP;
+        return NULL;
+    }
+    void * elem = take->source.next(take->source.iter);
+    if ((take->stop = take->source.stop(take->source.iter))) {
+        return NULL;
+    }
+    take->taken++;
+    return elem;
+}
+
+enum iterator_status TakeIterator_stop(TakeIterator * take) {
+    return take ? take->stop : ITERATOR_STOP;
+}
+
+void ChainIterator_init(ChainIterator * chain, Iterable first, Iterable second) {
+    if (!chain) {
+        return;
+    }
+    *chain = (ChainIterator) {.sources = {first, second}, .stop = ITERATOR_PAUSE};
+}
+
+void * ChainIterator_next(ChainIterator * chain) {
+    if (!chain || chain->stop == ITERATOR_STOP || chain->stop == ITERATOR_FAIL) {
+        return NULL;
+    }
+    while (chain->active < 2) {
+        Iterable * source = chain->sources + chain->active;
+        void * elem = source->next(source->iter);
+        if (!(chain->stop = source->stop(source->iter))) {
+            return elem;
+        }
+        if (chain->stop == ITERATOR_FAIL) {
+            return NULL;
+        }
+        chain->active++;
+    }
+    return NULL;
+}
+
+enum iterator_status ChainIterator_stop(ChainIterator * chain) {
+    return chain ? chain->stop : ITERATOR_STOP;
+}
+
+void * Iterable_collect(Iterable source, size_t elem_size, size_t * num) {
+    *num = 0;
+    size_t alloc = source.length ? source.length(source.iter) : 0;
+    char * array = alloc ? (char *) CL_MALLOC(elem_size * alloc) : NULL;
+    if (alloc && !array) {
+        return NULL;
+    }
+    for (void * elem = source.next(source.iter); !source.stop(source.iter); elem = source.next(source.iter)) {
+        if (*num == alloc) {
+            size_t new_alloc = alloc ? alloc * COMPREHENSION_SCALE : INIT_COMPREHENSION_SIZE;
+            bool res = true;
+            RESIZE_REALLOC(res, char, array, elem_size * new_alloc)
+            if (!res) {
+                CL_FREE(array);
+                *num = 0;
+                return NULL;
+            }
+            alloc = new_alloc;
+        }
+        memcpy(array + elem_size * (*num)++, elem, elem_size);
+    }
+    if (!*num) {
+        CL_FREE(array);
+        return NULL;
+    }
+    if (*num < alloc) {
+        char * trimmed = (char *) CL_REALLOC(array, elem_size * *num);
+        return trimmed ? trimmed : array;
+    }
+    return array;
+}
+
+char ** Iterable_collect_strings(Iterable source, size_t * num) {
+    *num = 0;
+    // offsets of the strings in arena until its final size is known
+    size_t * offsets = NULL;
+    char * arena = NULL;
+    size_t alloc = 0, arena_size = 0, arena_alloc = 0;
+    bool res = true;
+    for (char * elem = (char *) source.next(source.iter); res && !source.stop(source.iter); elem = (char *) source.next(source.iter)) {
+        size_t size = strlen(elem) + 1;
+        if (*num == alloc) {
+            size_t new_alloc = alloc ? alloc * COMPREHENSION_SCALE : INIT_COMPREHENSION_SIZE;
+            RESIZE_REALLOC(res, size_t, offsets, new_alloc)
+            alloc = res ? new_alloc : alloc;
+        }
+        if (res && arena_size + size > arena_alloc) {
+            size_t new_alloc = arena_alloc ? arena_alloc * COMPREHENSION_SCALE : INIT_COMPREHENSION_SIZE;
+            new_alloc = new_alloc > arena_size + size ? new_alloc : arena_size + size;
+            RESIZE_REALLOC(res, char, arena, new_alloc)
+            arena_alloc = res ? new_alloc : arena_alloc;
+        }
+        if (res) {
+            memcpy(arena + arena_size, elem, size);
+            offsets[(*num)++] = arena_size;
+            arena_size += size;
+        }
+    }
+    char ** strings = NULL;
+    if (res && *num) {
+        // the pointers go in front of the strings in the same block
+        RESIZE_REALLOC(res, char, arena, sizeof(char *) * *num + arena_size)
+        if (res) {
+            memmove(arena + sizeof(char *) * *num, arena, arena_size);
+            strings = (char **) arena;
+            for (size_t i = 0; i < *num; i++) {
+                strings[i] = arena + sizeof(char *) * *num + offsets[i];
+            }
+            arena = NULL;
+        }
+    }
+    CL_FREE(arena);
+    CL_FREE(offsets);
+    if (!strings) {
+        *num = 0;
+    }
+    return strings;
+}
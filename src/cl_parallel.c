@@ -0,0 +1,160 @@
+#include <pthread.h>
+#include "cl_parallel.h"
+
+// chunks of a cl_parallel_for call, taken in order by the threads
+typedef struct ParallelQueue {
+    pthread_mutex_t lock;
+    cl_parallel_fn fn;
+    void * data;
+    size_t num;
+    size_t n_chunks;
+    size_t next_chunk;
+} ParallelQueue;
+
+// returns the number of indices of chunk and sets first, the first num % n_chunks chunks take one more
+static size_t parallel_chunk(size_t num, size_t n_chunks, size_t chunk, size_t * first) {
+    size_t size = num / n_chunks, extra = num % n_chunks;
+    *first = chunk * size + (chunk < extra ? chunk : extra);
+    return size + (chunk < extra);
+}
+
+static void * parallel_worker(void * arg) {
+    ParallelQueue * queue = (ParallelQueue *) arg;
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        size_t chunk = queue->next_chunk;
+        if (chunk < queue->n_chunks) {
+            queue->next_chunk++;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (chunk >= queue->n_chunks) {
+            return NULL;
+        }
+        size_t first = 0;
+        size_t count = parallel_chunk(queue->num, queue->n_chunks, chunk, &first);
+        queue->fn(queue->data, chunk, first, count);
+    }
+}
+
+// workers kept between cl_parallel_for calls. They are started as calls need them and wait for the 
+// next queue, which workers join until the calling thread has run out of chunks
+static struct ParallelPool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a queue was posted or the workers must exit
+    pthread_cond_t done; // a worker left the queue
+    pthread_t * threads;
+    size_t n_threads;
+    ParallelQueue * queue; // NULL when no call is running
+    size_t generation; // number of queues posted
+    size_t n_wanted; // workers that may join the queue
+    size_t n_joined;
+    size_t n_active; // workers still running chunks of the queue
+    bool exiting;
+} pool = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, NULL, 0, 0, 0, 0, false};
+
+static void * parallel_pool_worker(void * arg) {
+    (void) arg;
+    size_t seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    while (true) {
+        while (!pool.exiting && (seen == pool.generation || pool.n_joined >= pool.n_wanted)) {
+            pthread_cond_wait(&pool.work, &pool.lock);
+        }
+        if (pool.exiting) {
+            pthread_mutex_unlock(&pool.lock);
+            return NULL;
+        }
+        seen = pool.generation;
+        pool.n_joined++;
+        pool.n_active++;
+        ParallelQueue * queue = pool.queue;
+        pthread_mutex_unlock(&pool.lock);
+        parallel_worker(queue);
+        pthread_mutex_lock(&pool.lock);
+        if (!--pool.n_active) {
+            pthread_cond_signal(&pool.done);
+        }
+    }
+}
+
+// runs all chunks in the calling thread
+static void parallel_serial(ParallelQueue * queue) {
+    for (size_t chunk = 0; chunk < queue->n_chunks; chunk++) {
+        size_t first = 0;
+        size_t count = parallel_chunk(queue->num, queue->n_chunks, chunk, &first);
+        queue->fn(queue->data, chunk, first, count);
+    }
+}
+
+void cl_parallel_for(size_t num, size_t n_chunks, size_t nthreads, cl_parallel_fn fn, void * data) {
+    if (!num || !fn) {
+        return;
+    }
+    n_chunks = n_chunks ? (n_chunks < num ? n_chunks : num) : 1;
+    nthreads = nthreads ? (nthreads < n_chunks ? nthreads : n_chunks) : 1;
+    ParallelQueue queue = {.fn = fn, .data = data, .num = num, .n_chunks = n_chunks};
+    if (nthreads == 1 || pthread_mutex_init(&queue.lock, NULL)) {
+        parallel_serial(&queue);
+        return;
+    }
+    pthread_mutex_lock(&pool.lock);
+    if (pool.queue || pool.exiting) { // the pool serves one call at a time, e.g. not the calls nested in fn
+        pthread_mutex_unlock(&pool.lock);
+        parallel_serial(&queue);
+        pthread_mutex_destroy(&queue.lock);
+        return;
+    }
+    if (pool.n_threads < nthreads - 1) {
+        pthread_t * threads = (pthread_t *) CL_REALLOC(pool.threads, sizeof(pthread_t) * (nthreads - 1));
+        if (threads) {
+            pool.threads = threads;
+            while (pool.n_threads < nthreads - 1 && !pthread_create(pool.threads + pool.n_threads, NULL, parallel_pool_worker, NULL)) {
+                pool.n_threads++;
+            }
+        }
+    }
+    pool.queue = &queue;
+    pool.generation++;
+    pool.n_wanted = nthreads - 1;
+    pool.n_joined = 0;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+
+    parallel_worker(&queue);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.n_wanted = pool.n_joined; // workers that have not joined yet would find no chunks left
+    while (pool.n_active) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pool.queue = NULL;
+    pthread_mutex_unlock(&pool.lock);
+    pthread_mutex_destroy(&queue.lock);
+}
+
+void cl_parallel_stop(void) {
+    pthread_mutex_lock(&pool.lock);
+    if (pool.queue) {
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+    pool.exiting = true;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for (size_t i = 0; i < pool.n_threads; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    pthread_mutex_lock(&pool.lock);
+    CL_FREE(pool.threads);
+    pool.threads = NULL;
+    pool.n_threads = 0;
+    pool.exiting = false;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+define_parallel_array_iterator(double)
+define_parallel_array_iterator(float)
+define_parallel_array_iterator(long)
+define_parallel_array_iterator(int)
+define_parallel_array_iterator(char)
+define_parallel_array_iterator(size_t)
@@ -1,5 +1,9 @@
 #include "cl_utils.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif // __SSE2__
+
 size_t shift_index_to_positive(long long index, size_t container_size) {
 	if (index < 0) {
 		if (container_size >= (size_t) (-index)) {
@@ -10,18 +14,43 @@ size_t shift_index_to_positive(long long index, size_t container_size) {
 	return (size_t) index;
 }
 
-// DISCOURAGED temporary buffer is malloc'd internally and memory monitoring is bypassed
+// copies are of constant size so they compile to register moves and vector copies
+#define CL_SWAP_FIXED(a, b, SIZE) {                 \
+	unsigned char tmp_[SIZE];                       \
+	memcpy(tmp_, a, SIZE);                          \
+	memcpy(a, b, SIZE);                             \
+	memcpy(b, tmp_, SIZE);                          \
+}
+
+// block swap of large elements through a stack buffer of CL_SWAP_CHUNK bytes
+static void cl_swap_chunks(unsigned char * a, unsigned char * b, size_t size) {
+	for (; size >= CL_SWAP_CHUNK; size -= CL_SWAP_CHUNK, a += CL_SWAP_CHUNK, b += CL_SWAP_CHUNK) {
+		CL_SWAP_FIXED(a, b, CL_SWAP_CHUNK)
+	}
+	if (size) {
+		unsigned char tmp[CL_SWAP_CHUNK];
+		memcpy(tmp, a, size);
+		memcpy(a, b, size);
+		memcpy(b, tmp, size);
+	}
+}
+
+// no temporary buffer is allocated, elements are swapped through registers or the stack
 void cl_swap_unbuffered(void * src, void * dest, size_t size)
 {
-	void * buf = CL_MALLOC(size);
-	memcpy(buf, src, size);
-	memcpy(src, dest, size);
-	memcpy(dest, buf, size);
-	CL_FREE(buf);
+	unsigned char *a = (unsigned char *) src, *b = (unsigned char *) dest;
+	switch (size) {
+		case 1: CL_SWAP_FIXED(a, b, 1) break;
+		case 2: CL_SWAP_FIXED(a, b, 2) break;
+		case 4: CL_SWAP_FIXED(a, b, 4) break;
+		case 8: CL_SWAP_FIXED(a, b, 8) break;
+		case 16: CL_SWAP_FIXED(a, b, 16) break;
+		default: cl_swap_chunks(a, b, size);
+	}
 	return;
 }
 
-// PREFERRED temporary buffer is malloc'd/provided by caller
+// temporary buffer is provided by caller
 void cl_swap_buffered(void * src, void * dest, size_t size, void * buf)
 {
 	memcpy(buf, src, size);
@@ -30,42 +59,356 @@ void cl_swap_buffered(void * src, void * dest, size_t size, void * buf)
 	return;
 }
 
+#ifdef __SSE2__
+// reverse the elements within a vector of 16 bytes
+static inline __m128i cl_mm_reverse8(__m128i x) {
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+}
+
+static inline __m128i cl_mm_reverse4(__m128i x) {
+	return _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+}
+
+static inline __m128i cl_mm_reverse2(__m128i x) {
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	return cl_mm_reverse8(x);
+}
+
+static inline __m128i cl_mm_reverse1(__m128i x) {
+	x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8)); // swap the bytes of each pair
+	return cl_mm_reverse2(x);
+}
+
+// swaps and reverses 16 byte vectors from both ends until they would overlap. *a and *b are the 
+// first and last elements left to reverse
+#define CL_REVERSE_VECTORS(a, b, SIZE)                                          \
+if ((size_t) (*(b) - *(a)) + (SIZE) >= 32) {                                    \
+	unsigned char * hi_ = *(b) + (SIZE) - 16;                                   \
+	while (*(a) + 16 <= hi_) {                                                  \
+		__m128i lo_vec_ = _mm_loadu_si128((__m128i *) *(a));                    \
+		__m128i hi_vec_ = _mm_loadu_si128((__m128i *) hi_);                     \
+		_mm_storeu_si128((__m128i *) *(a), cl_mm_reverse##SIZE(hi_vec_));       \
+		_mm_storeu_si128((__m128i *) hi_, cl_mm_reverse##SIZE(lo_vec_));        \
+		*(a) += 16;                                                             \
+		hi_ -= 16;                                                              \
+	}                                                                           \
+	*(b) = hi_ + 16 - (SIZE);                                                   \
+}
+#else
+#define CL_REVERSE_VECTORS(a, b, SIZE)
+#endif // __SSE2__
+
+// reverses elements of a size with a fast swap, vectorized for sizes that divide 16
+#define define_cl_reverse_fixed(SIZE)                                           \
+static void cl_reverse_##SIZE(unsigned char * a, unsigned char * b) {           \
+	CL_REVERSE_VECTORS(&a, &b, SIZE)                                            \
+	for (; a < b; a += (SIZE), b -= (SIZE)) {                                   \
+		CL_SWAP_FIXED(a, b, SIZE)                                               \
+	}                                                                           \
+}
+
+define_cl_reverse_fixed(1)
+define_cl_reverse_fixed(2)
+define_cl_reverse_fixed(4)
+define_cl_reverse_fixed(8)
+
+static void cl_reverse_16(unsigned char * a, unsigned char * b) {
+	for (; a < b; a += 16, b -= 16) {
+		CL_SWAP_FIXED(a, b, 16)
+	}
+}
+
+// no temporary buffer is allocated. start and end are the first and last elements
 enum cl_status cl_reverse_unbuffered(void * start, void * end, size_t size) {
-	unsigned char *a = (unsigned char *) start, *b = (unsigned char *) end, *buf; // cast as unsigned char so that pointer arithmetic can go one byte at a time
+	unsigned char *a = (unsigned char *) start, *b = (unsigned char *) end; // cast as unsigned char so that pointer arithmetic can go one byte at a time
 	if (a > b) { 
 		return CL_FAILURE;
 	} else if (a == b) { // start = end does nothing and should return success
 		return CL_SUCCESS;
 	}
 
-	buf = (unsigned char *) CL_MALLOC(size);
-	
-	while (a < b) {
-		cl_swap(a, b, size, buf);
-		a += size; // looks portable?!
-		b -= size; // looks portable?!
+	switch (size) {
+		case 1: cl_reverse_1(a, b); break;
+		case 2: cl_reverse_2(a, b); break;
+		case 4: cl_reverse_4(a, b); break;
+		case 8: cl_reverse_8(a, b); break;
+		case 16: cl_reverse_16(a, b); break;
+		default: {
+			for (; a < b; a += size, b -= size) {
+				cl_swap_chunks(a, b, size);
+			}
+		}
 	}
 
-	CL_FREE(buf);
 	return CL_SUCCESS;
 }
 
-// buf must at least be as long as 'size' bytes
+// buf is no longer needed and kept for compatibility, see cl_reverse_unbuffered
 enum cl_status cl_reverse_buffered(void * start, void * end, size_t size, void * buf) {
-	unsigned char *a = (unsigned char *)start, *b = (unsigned char *)end; // cast as unsigned char so that pointer arithmetic can go one byte at a time
-	if (a > b) { 
-		return CL_FAILURE;
-	} else if (a == b) { // start = end does nothing and should return success
-		return CL_SUCCESS;
-	}
-	
-	while (a < b) {
-		cl_swap(a, b, size, buf);
-		a += size; // looks portable?!
-		b -= size; // looks portable?!
-	}
+	(void) buf;
+	return cl_reverse_unbuffered(start, end, size);
+}
 
-	return CL_SUCCESS;
+/********************************** MEMORY ***********************************/
+
+void * cl_alloc(Allocator * allocator, size_t size) {
+    return allocator ? allocator->alloc(allocator->context, size) : CL_MALLOC(size);
+}
+
+void * cl_realloc(Allocator * allocator, void * ptr, size_t size) {
+    return allocator ? allocator->realloc(allocator->context, ptr, size) : CL_REALLOC(ptr, size);
+}
+
+void cl_free(Allocator * allocator, void * ptr) {
+    if (!allocator) {
+        CL_FREE(ptr);
+    } else if (allocator->free) {
+        allocator->free(allocator->context, ptr);
+    }
+}
+
+bool cl_frees(Allocator * allocator) {
+    return !allocator || allocator->free;
+}
+
+#define ALIGN_UP(size) (((size) + CL_ALLOC_ALIGNMENT - 1) / CL_ALLOC_ALIGNMENT * CL_ALLOC_ALIGNMENT)
+// start of the memory of a block
+#define BLOCK_DATA(block) ((char *) (block) + ALIGN_UP(sizeof(AllocBlock)))
+
+static AllocBlock * alloc_block(AllocBlock * prev, size_t size) {
+    AllocBlock * block = (AllocBlock *) CL_MALLOC(ALIGN_UP(sizeof(AllocBlock)) + size);
+    if (block) {
+        *block = (AllocBlock) {.prev = prev, .size = size};
+    }
+    return block;
+}
+
+static void free_blocks(AllocBlock * block) {
+    while (block) {
+        AllocBlock * prev = block->prev;
+        CL_FREE(block);
+        block = prev;
+    }
+}
+
+// each arena allocation is preceded by CL_ALLOC_ALIGNMENT bytes holding its size
+static void * arena_alloc(void * context, size_t size) {
+    Arena * arena = (Arena *) context;
+    size_t needed = CL_ALLOC_ALIGNMENT + ALIGN_UP(size);
+    if (!arena->head || arena->head->size - arena->head->used < needed) {
+        size_t block_size = needed > arena->block_size ? needed : arena->block_size;
+        AllocBlock * block = alloc_block(arena->head, block_size);
+        if (!block) {
+            return NULL;
+        }
+        arena->head = block;
+    }
+    char * ptr = BLOCK_DATA(arena->head) + arena->head->used + CL_ALLOC_ALIGNMENT;
+    memcpy(ptr - sizeof(size_t), &size, sizeof(size_t));
+    arena->head->used += needed;
+    return ptr;
+}
+
+static void * arena_realloc(void * context, void * ptr, size_t size) {
+    Arena * arena = (Arena *) context;
+    if (!ptr) {
+        return arena_alloc(context, size);
+    }
+    size_t old_size = 0;
+    memcpy(&old_size, (char *) ptr - sizeof(size_t), sizeof(size_t));
+    AllocBlock * head = arena->head;
+    char * end = BLOCK_DATA(head) + head->used;
+    if ((char *) ptr + ALIGN_UP(old_size) == end && (size_t) ((char *) ptr - BLOCK_DATA(head)) + ALIGN_UP(size) <= head->size) {
+        // latest allocation, grow or shrink in place
+        head->used = (size_t) ((char *) ptr - BLOCK_DATA(head)) + ALIGN_UP(size);
+        memcpy((char *) ptr - sizeof(size_t), &size, sizeof(size_t));
+        return ptr;
+    }
+    if (size <= old_size) {
+        return ptr;
+    }
+    void * new_ptr = arena_alloc(context, size);
+    if (new_ptr) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+void Arena_init(Arena * arena, size_t block_size) {
+    if (!arena) {
+        return;
+    }
+    *arena = (Arena) {.head = NULL, .block_size = block_size ? block_size : CL_ARENA_BLOCK_SIZE};
+    arena->allocator = (Allocator) {.alloc = arena_alloc, .realloc = arena_realloc, .free = NULL, .context = arena};
+}
+
+void Arena_reset(Arena * arena) {
+    if (!arena) {
+        return;
+    }
+    free_blocks(arena->head);
+    arena->head = NULL;
+}
+
+void Arena_del(Arena * arena) {
+    Arena_reset(arena);
+}
+
+Allocator * Arena_allocator(Arena * arena) {
+    return arena ? &arena->allocator : NULL;
+}
+
+static void * pool_alloc(void * context, size_t size) {
+    Pool * pool = (Pool *) context;
+    if (size > pool->elem_size) {
+        return NULL;
+    }
+    void * elem = pool->free_list;
+    if (elem) { // recycle a freed element
+        memcpy(&pool->free_list, elem, sizeof(void *));
+        pool->n_reuses++;
+    } else {
+        if (!pool->head || pool->head->used == pool->head->size) {
+            AllocBlock * block = alloc_block(pool->head, pool->elem_size * pool->elems_per_block);
+            if (!block) {
+                return NULL;
+            }
+            pool->head = block;
+        }
+        elem = BLOCK_DATA(pool->head) + pool->head->used;
+        pool->head->used += pool->elem_size;
+    }
+    pool->n_allocs++;
+    return elem;
+}
+
+static void * pool_realloc(void * context, void * ptr, size_t size) {
+    Pool * pool = (Pool *) context;
+    if (!ptr) {
+        return pool_alloc(context, size);
+    }
+    return size <= pool->elem_size ? ptr : NULL;
+}
+
+static void pool_free(void * context, void * ptr) {
+    Pool * pool = (Pool *) context;
+    if (ptr) {
+        memcpy(ptr, &pool->free_list, sizeof(void *));
+        pool->free_list = ptr;
+    }
+}
+
+void Pool_init(Pool * pool, size_t elem_size, size_t elems_per_block) {
+    if (!pool) {
+        return;
+    }
+    elem_size = ALIGN_UP(elem_size > sizeof(void *) ? elem_size : sizeof(void *));
+    *pool = (Pool) {.elem_size = elem_size, .elems_per_block = elems_per_block ? elems_per_block : CL_ARENA_BLOCK_SIZE / elem_size + 1};
+    pool->allocator = (Allocator) {.alloc = pool_alloc, .realloc = pool_realloc, .free = pool_free, .context = pool};
+}
+
+void Pool_del(Pool * pool) {
+    if (!pool) {
+        return;
+    }
+    free_blocks(pool->head);
+    pool->head = NULL;
+    pool->free_list = NULL;
+}
+
+Allocator * Pool_allocator(Pool * pool) {
+    return pool ? &pool->allocator : NULL;
+}
+
+// each PoolSet allocation is preceded by CL_ALLOC_ALIGNMENT bytes holding its size class, 
+// CL_POOL_CLASSES for allocations from CL_MALLOC
+static size_t pool_class(size_t size) {
+    size_t class = 0;
+    while (class < CL_POOL_CLASSES && ((size_t) CL_POOL_MIN_SIZE << class) < size) {
+        class++;
+    }
+    return class;
+}
+
+static void * pool_set_alloc(void * context, size_t size) {
+    PoolSet * set = (PoolSet *) context;
+    size_t class = pool_class(size);
+    char * ptr;
+    if (class < CL_POOL_CLASSES) {
+        set->n_reuses += set->pools[class].free_list != NULL;
+        ptr = (char *) pool_alloc(set->pools + class, CL_ALLOC_ALIGNMENT + size);
+    } else {
+        ptr = (char *) CL_MALLOC(CL_ALLOC_ALIGNMENT + size);
+    }
+    if (!ptr) {
+        return NULL;
+    }
+    memcpy(ptr, &class, sizeof(size_t));
+    set->n_allocs++;
+    return ptr + CL_ALLOC_ALIGNMENT;
+}
+
+static void pool_set_free(void * context, void * ptr) {
+    PoolSet * set = (PoolSet *) context;
+    if (!ptr) {
+        return;
+    }
+    char * base = (char *) ptr - CL_ALLOC_ALIGNMENT;
+    size_t class = 0;
+    memcpy(&class, base, sizeof(size_t));
+    if (class < CL_POOL_CLASSES) {
+        pool_free(set->pools + class, base);
+    } else {
+        CL_FREE(base);
+    }
+}
+
+static void * pool_set_realloc(void * context, void * ptr, size_t size) {
+    if (!ptr) {
+        return pool_set_alloc(context, size);
+    }
+    size_t class = 0;
+    memcpy(&class, (char *) ptr - CL_ALLOC_ALIGNMENT, sizeof(size_t));
+    if (class < CL_POOL_CLASSES) {
+        size_t capacity = (size_t) CL_POOL_MIN_SIZE << class;
+        if (size <= capacity) { // still fits its size class
+            return ptr;
+        }
+        void * new_ptr = pool_set_alloc(context, size);
+        if (new_ptr) {
+            memcpy(new_ptr, ptr, capacity);
+            pool_set_free(context, ptr);
+        }
+        return new_ptr;
+    }
+    char * base = (char *) CL_REALLOC((char *) ptr - CL_ALLOC_ALIGNMENT, CL_ALLOC_ALIGNMENT + size);
+    return base ? base + CL_ALLOC_ALIGNMENT : NULL;
+}
+
+void PoolSet_init(PoolSet * set, size_t elems_per_block) {
+    if (!set) {
+        return;
+    }
+    for (size_t i = 0; i < CL_POOL_CLASSES; i++) {
+        Pool_init(set->pools + i, CL_ALLOC_ALIGNMENT + ((size_t) CL_POOL_MIN_SIZE << i), elems_per_block);
+    }
+    set->n_allocs = 0;
+    set->n_reuses = 0;
+    set->allocator = (Allocator) {.alloc = pool_set_alloc, .realloc = pool_set_realloc, .free = pool_set_free, .context = set};
+}
+
+void PoolSet_del(PoolSet * set) {
+    if (!set) {
+        return;
+    }
+    for (size_t i = 0; i < CL_POOL_CLASSES; i++) {
+        Pool_del(set->pools + i);
+    }
+}
+
+Allocator * PoolSet_allocator(PoolSet * set) {
+    return set ? &set->allocator : NULL;
 }
 
 /******************************** COMPARISON *********************************/
@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <math.h>
 #include "csv.h"
 
 /*
@@ -17,6 +20,8 @@ READER STATE MACHINE:
 3 - ESCAPING_QUOTES - indicates currently in field that is enclosed with quotes and a quote is encountered. Can be followed by IN_QUOTES (successfully escaped quote), END_FIELD, END_RECORD, END_CSV
 4 - END_RECORD - indicates a line is ending. Can be followed by END_RECORD, IN_FIELD, or IN_QUOTES, END_CSV
 5 - END_CSV
+6 - IN_COMMENT - indicates a comment line of the dialect. Can be followed by IN_COMMENT, END_COMMENT, END_CSV
+7 - END_COMMENT - indicates a comment line is ending. Transitions as END_RECORD
 
 */
 enum reader_states {
@@ -27,22 +32,34 @@ enum reader_states {
     IN_QUOTES,
     ESCAPING_QUOTES,
     END_RECORD,
-    END_CSV
+    END_CSV,
+    IN_COMMENT,
+    END_COMMENT
 };
 
 static char cell_buffer[CSV_CELL_BUFFER_SIZE] = {'\0'};
 
+static void csv_setup(CSVFile * csv, char * filename, char mode, bool has_header, char * line_ending, char * file_out);
+static CSVRecord * csv_record_new(Allocator * allocator, char mode, size_t start, size_t init_field_alloc);
+static void csv_record_del(Allocator * allocator, CSVRecord * csvr);
+static enum csv_status csv_record_append_field_pos(Allocator * allocator, CSVRecord * csvr, size_t pos);
+
 CSVRecord * CSVRecord_new(char mode, size_t start, size_t init_field_alloc) {
+    return csv_record_new(NULL, mode, start, init_field_alloc);
+}
+
+// the record and its field_pos come from allocator, the fields of a writer always from IO_MALLOC
+static CSVRecord * csv_record_new(Allocator * allocator, char mode, size_t start, size_t init_field_alloc) {
     if (!init_field_alloc) {
         init_field_alloc = DEFAULT_N_FIELDS;
     }
-    CSVRecord * new_record = (CSVRecord * ) IO_MALLOC(sizeof(CSVRecord));
+    CSVRecord * new_record = (CSVRecord * ) io_alloc(allocator, sizeof(CSVRecord));
     if (!new_record) {
         goto failed_csvrecord_alloc;
     }
 
     if (mode == CSV_READER || mode == CSV_AMENDER) {
-        new_record->field_pos = (size_t *) IO_MALLOC(sizeof(size_t) * (init_field_alloc + 1));
+        new_record->field_pos = (size_t *) io_alloc(allocator, sizeof(size_t) * (init_field_alloc + 1));
         if (!new_record->field_pos) {
             goto failed_field_pos_alloc;
         }
@@ -50,8 +67,8 @@ CSVRecord * CSVRecord_new(char mode, size_t start, size_t init_field_alloc) {
         new_record->field_pos = NULL;
     }
 
-    if (mode == CSV_WRITER || mode == CSV_AMENDER) {
-        new_record->fields = (char **) IO_MALLOC(sizeof(size_t) * (init_field_alloc));
+    if (mode == CSV_WRITER) {
+        new_record->fields = (char **) IO_MALLOC(sizeof(char *) * (init_field_alloc));
         if (!new_record->fields) {
             goto failed_fields_alloc;
         }
@@ -65,10 +82,10 @@ CSVRecord * CSVRecord_new(char mode, size_t start, size_t init_field_alloc) {
 
 failed_fields_alloc:
     if (new_record->field_pos) {
-        IO_FREE(new_record->field_pos);
+        io_free(allocator, new_record->field_pos);
     }
 failed_field_pos_alloc:
-    IO_FREE(new_record);
+    io_free(allocator, new_record);
 failed_csvrecord_alloc:
     return NULL;
 }
@@ -84,11 +101,12 @@ void CSVRecord_init(CSVRecord * csvr, char mode, size_t start, size_t init_field
             csvr->field_pos[i] = 0;
         }
     }
-    if (csvr->n_fields_alloc) {
+    if (csvr->field_pos) {
         csvr->field_pos[0] = start;
     }
+    csvr->quoted = false;
 
-    if (mode == CSV_WRITER || mode == CSV_AMENDER) {
+    if (mode == CSV_WRITER) {
         for (size_t i = 0; i < csvr->n_fields_alloc; i++) {
             csvr->fields[i] = NULL;
         }
@@ -98,21 +116,54 @@ void CSVRecord_init(CSVRecord * csvr, char mode, size_t start, size_t init_field
 }
 
 void CSVRecord_del(CSVRecord * csvr) {
+    csv_record_del(NULL, csvr);
+}
+
+static void csv_record_del(Allocator * allocator, CSVRecord * csvr) {
     if (csvr->field_pos) {
-        IO_FREE(csvr->field_pos);
+        io_free(allocator, csvr->field_pos);
     }
     if (csvr->fields) {
+        for (size_t i = 0; i < csvr->n_fields; i++) {
+            IO_FREE(csvr->fields[i]);
+        }
         IO_FREE(csvr->fields);
     }
-    IO_FREE(csvr);
+    io_free(allocator, csvr);
+}
+
+// takes ownership of value and places it in field, growing the record with empty fields as needed
+static enum csv_status csv_record_set_field(CSVRecord * csvr, size_t field, char * value) {
+    if (field >= csvr->n_fields_alloc) {
+        size_t new_alloc = csvr->n_fields_alloc * RESIZE_SCALE;
+        if (new_alloc <= field) {
+            new_alloc = field + 1;
+        }
+        bool res = true;
+        RESIZE_REALLOC(res, char *, csvr->fields, new_alloc)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        csvr->n_fields_alloc = new_alloc;
+    }
+    for (; csvr->n_fields <= field; csvr->n_fields++) {
+        csvr->fields[csvr->n_fields] = NULL;
+    }
+    IO_FREE(csvr->fields[field]);
+    csvr->fields[field] = value;
+    return CSV_SUCCESS;
 }
 
 // only use in CSV_READER mode or when adding a new record, otherwise do not use in CSV_AMENDER mode
 enum csv_status CSVRecord_append_field_pos(CSVRecord * csvr, size_t pos) {
+    return csv_record_append_field_pos(NULL, csvr, pos);
+}
+
+static enum csv_status csv_record_append_field_pos(Allocator * allocator, CSVRecord * csvr, size_t pos) {
     if (csvr->n_fields == csvr->n_fields_alloc) {
-        bool result;
-        RESIZE_REALLOC(result, size_t, csvr->field_pos, csvr->n_fields_alloc*RESIZE_SCALE + 1)
-        if (result) {
+        size_t * field_pos = (size_t *) io_realloc(allocator, csvr->field_pos, sizeof(size_t) * (csvr->n_fields_alloc*RESIZE_SCALE + 1));
+        if (field_pos) {
+            csvr->field_pos = field_pos;
             csvr->n_fields_alloc *= RESIZE_SCALE;
             for (size_t i = csvr->n_fields; i < csvr->n_fields_alloc; i++) {
                 csvr->field_pos[i+1] = 0;
@@ -126,6 +177,33 @@ enum csv_status CSVRecord_append_field_pos(CSVRecord * csvr, size_t pos) {
 }
 
 CSVFile * CSVFile_new(char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
+    CSVFile * new_csv = CSVFile_open(filename, mode, has_header, line_ending, file_out);
+    if (!new_csv) {
+        return NULL;
+    }
+
+    if (mode == CSV_READER || mode == CSV_AMENDER) {
+        CSVFile_read(new_csv);
+    }
+
+    return new_csv;
+}
+
+CSVFile * CSVFile_new_with(Allocator * allocator, char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
+    CSVFile * new_csv = CSVFile_open(filename, mode, has_header, line_ending, file_out);
+    if (!new_csv) {
+        return NULL;
+    }
+
+    CSVFile_set_allocator(new_csv, allocator);
+    if (mode == CSV_READER || mode == CSV_AMENDER) {
+        CSVFile_read(new_csv);
+    }
+
+    return new_csv;
+}
+
+CSVFile * CSVFile_open(char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
     if (!(mode == CSV_READER || mode == CSV_WRITER || mode == CSV_AMENDER)) {
         goto failed_mode;
     }
@@ -149,7 +227,7 @@ CSVFile * CSVFile_new(char * filename, char mode, bool has_header, char * line_e
         line_ending = DEFAULT_LINE_ENDING;
     }
 
-    CSVFile_init(new_csv, filename, mode, has_header, line_ending, file_out);
+    csv_setup(new_csv, filename, mode, has_header, line_ending, file_out);
     if (!new_csv->handle) {
         goto failed_init;
     }
@@ -168,7 +246,8 @@ failed_mode:
     
 }
 
-void CSVFile_init(CSVFile * csv, char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
+// opens the file handles and initializes all members without indexing the file
+static void csv_setup(CSVFile * csv, char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
     csv->handle = NULL;
     csv->handle_file_out = NULL;
     csv->filename = filename;
@@ -203,309 +282,3159 @@ void CSVFile_init(CSVFile * csv, char * filename, char mode, bool has_header, ch
         }
     }
 
-    csv->line_ending = line_ending;
-    csv->line_ending_size = strlen(line_ending);
-    csv->mode = mode;
-    csv->has_header = has_header;
-    csv->n_records = 0;
+    csv->line_ending = line_ending;
+    csv->line_ending_size = strlen(line_ending);
+    csv->mode = mode;
+    csv->has_header = has_header;
+    csv->n_records = 0;
+    csv->projection = NULL;
+    csv->projection_names = NULL;
+    csv->projection_map = NULL;
+    csv->n_projection = 0;
+    csv->projection_map_size = 0;
+    csv->filters = NULL;
+    csv->n_filters = 0;
+    csv->n_filtered = 0;
+    csv->filter_buffer = NULL;
+    csv->filter_buffer_size = 0;
+    csv->n_fields_histogram = NULL;
+    csv->max_n_fields = 0;
+    csv->min_n_fields = 0;
+    csv->rectangular = true;
+    csv->edits = NULL;
+    csv->n_edits = 0;
+    csv->n_edits_alloc = 0;
+    csv->scan_resume = 0;
+    csv->scan_partial_columns = 0;
+    csv->scan_partial = false;
+    csv->scan_partial_kept = false;
+    csv->dialect = CSV_DIALECT_RFC4180;
+    csv->cache = NULL;
+    csv->allocator = NULL;
+    csv->iterator_allocator = NULL;
+    csv->errors = NULL;
+    csv->n_errors = 0;
+    csv->n_error_samples = 0;
+    csv->max_error_samples = CSV_ERROR_SAMPLES;
+    csv->scan_error = CSV_ERROR_QUOTE_IN_FIELD;
+    csv->recover = false;
+    csv->parent = NULL;
+    csv->range_start = 0;
+    csv->range_end = SIZE_MAX;
+}
+
+void CSVFile_init(CSVFile * csv, char * filename, char mode, bool has_header, char * line_ending, char * file_out) {
+    csv_setup(csv, filename, mode, has_header, line_ending, file_out);
+    if (csv->handle && (mode == CSV_READER || mode == CSV_AMENDER)) {
+        CSVFile_read(csv);
+    }
+}
+
+static enum csv_status csv_build_projection_map(CSVFile * csv) {
+    size_t map_size = 0;
+    for (size_t i = 0; i < csv->n_projection; i++) {
+        if (csv->projection[i] >= map_size) {
+            map_size = csv->projection[i] + 1;
+        }
+    }
+    size_t * map = (size_t *) IO_MALLOC(sizeof(size_t) * map_size);
+    if (!map) {
+        return CSV_MEMORY_ERROR;
+    }
+    for (size_t i = 0; i < map_size; i++) {
+        map[i] = CSV_NOT_PROJECTED;
+    }
+    for (size_t i = 0; i < csv->n_projection; i++) {
+        if (map[csv->projection[i]] != CSV_NOT_PROJECTED) { // each source column may only be projected once
+            IO_FREE(map);
+            return CSV_FAILURE;
+        }
+        map[csv->projection[i]] = i;
+    }
+    csv->projection_map = map;
+    csv->projection_map_size = map_size;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_projection(CSVFile * csv, size_t * columns, size_t n_columns) {
+    if (!csv || !columns || !n_columns || csv->mode != CSV_READER || csv->n_records || csv->projection) {
+        return CSV_FAILURE;
+    }
+    csv->projection = (size_t *) IO_MALLOC(sizeof(size_t) * n_columns);
+    if (!csv->projection) {
+        return CSV_MEMORY_ERROR;
+    }
+    memcpy(csv->projection, columns, sizeof(size_t) * n_columns);
+    csv->n_projection = n_columns;
+    enum csv_status res = csv_build_projection_map(csv);
+    if (res) {
+        IO_FREE(csv->projection);
+        csv->projection = NULL;
+        csv->n_projection = 0;
+    }
+    return res;
+}
+
+enum csv_status CSVFile_set_projection_names(CSVFile * csv, char ** names, size_t n_names) {
+    if (!csv || !names || !n_names || csv->mode != CSV_READER || !csv->has_header || csv->n_records || csv->projection) {
+        return CSV_FAILURE;
+    }
+    // resolved once the header record is scanned
+    csv->projection_names = names;
+    csv->n_projection = n_names;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_dialect(CSVFile * csv, CSVDialect dialect) {
+    if (!csv || csv->mode != CSV_READER || csv->n_records) {
+        return CSV_FAILURE;
+    }
+    // the special characters must be distinct from each other and from the line ending
+    char special[4] = {dialect.delimiter, dialect.quote, dialect.escape, dialect.comment};
+    for (size_t i = 0; i < 4; i++) {
+        if (!special[i]) {
+            if (!i) { // a delimiter is required
+                return CSV_FAILURE;
+            }
+            continue;
+        }
+        if (memchr(csv->line_ending, special[i], csv->line_ending_size) || memchr(special + i + 1, special[i], 3 - i)) {
+            return CSV_FAILURE;
+        }
+    }
+    if (dialect.trim && (dialect.delimiter == ' ' || dialect.quote == ' ' || dialect.escape == ' ' || dialect.comment == ' ')) {
+        return CSV_FAILURE;
+    }
+    csv->dialect = dialect;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_recovery(CSVFile * csv, size_t max_error_samples) {
+    if (!csv || csv->mode != CSV_READER || csv->n_records) {
+        return CSV_FAILURE;
+    }
+    csv->recover = true;
+    csv->max_error_samples = max_error_samples;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_allocator(CSVFile * csv, Allocator * allocator) {
+    if (!csv || csv->n_records || csv->parent) {
+        return CSV_FAILURE;
+    }
+    csv->allocator = allocator;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_iterator_allocator(CSVFile * csv, Allocator * allocator) {
+    if (!csv) {
+        return CSV_FAILURE;
+    }
+    csv->iterator_allocator = allocator;
+    return CSV_SUCCESS;
+}
+
+CSVError * CSVFile_get_error(CSVFile * csv, size_t index) {
+    if (!csv || index >= csv->n_error_samples) {
+        return NULL;
+    }
+    return csv->errors + index;
+}
+
+// bytes after the start of a range used to find its first record
+#define CSV_RANGE_WINDOW 65536
+
+// maximum number of rows of the prefix that are parsed when sniffing
+#define CSV_SNIFF_ROWS 256
+
+static char * csv_sniff_delimiters = ",\t;|";
+static char csv_sniff_quotes[] = {'"', '\''};
+
+// finds the most common line ending outside of double quotes, NULL if none is found
+static char * csv_sniff_line_ending(char * buffer, size_t size) {
+    size_t n_crlf = 0, n_lf = 0, n_cr = 0;
+    bool quoted = false;
+    for (size_t i = 0; i < size; i++) {
+        if (buffer[i] == '"') {
+            quoted = !quoted;
+        } else if (quoted) {
+            continue;
+        } else if (buffer[i] == '\n') {
+            n_lf++;
+        } else if (buffer[i] == '\r') {
+            if (i + 1 < size && buffer[i+1] == '\n') {
+                n_crlf++;
+                i++;
+            } else if (i + 1 < size || !n_crlf) { // a final '\r' may be cut from a "\r\n"
+                n_cr++;
+            }
+        }
+    }
+    if (n_crlf && n_crlf >= n_lf && n_crlf >= n_cr) {
+        return "\r\n";
+    } else if (n_lf && n_lf >= n_cr) {
+        return "\n";
+    }
+    return n_cr ? "\r" : NULL;
+}
+
+// parses the field starting at pos and returns the position of its delimiter or line ending. *end is 
+// set to 1 at a delimiter, 2 at a line ending, 0 if the buffer ended first (field may be truncated) 
+// and *valid to false for quoting that the candidate dialect does not allow
+static size_t csv_sniff_field(char * buffer, size_t size, size_t pos, char * line_ending, size_t line_ending_size, char delimiter, char quote, int * end, bool * valid) {
+    bool quoted = pos < size && buffer[pos] == quote;
+    size_t i = pos + quoted;
+    while (quoted && i < size) { // find the closing quote
+        if (buffer[i] == quote) {
+            if (i + 1 < size && buffer[i+1] == quote) {
+                i += 2;
+                continue;
+            }
+            quoted = false;
+        }
+        i++;
+    }
+    for (; i < size; i++) {
+        if (buffer[i] == delimiter) {
+            *end = 1;
+            return i;
+        } else if (buffer[i] == line_ending[0] && i + line_ending_size <= size && !memcmp(buffer + i, line_ending, line_ending_size)) {
+            *end = 2;
+            return i;
+        } else if (buffer[i] == quote) { // quote within an unquoted field or after a closing quote
+            *valid = false;
+        }
+    }
+    *end = 0;
+    return size;
+}
+
+// field counts of the first rows parsed with a candidate dialect. complete is whether the buffer holds 
+// the rest of the file so the final row is not truncated. returns the number of rows, rows with 
+// invalid quoting are counted as 0 fields
+static size_t csv_sniff_counts(char * buffer, size_t size, bool complete, char * line_ending, char delimiter, char quote, size_t * counts) {
+    size_t line_ending_size = strlen(line_ending);
+    size_t n_rows = 0, pos = 0, n_fields = 0;
+    bool valid = true;
+    while (pos < size && n_rows < CSV_SNIFF_ROWS) {
+        int end = 0;
+        size_t next = csv_sniff_field(buffer, size, pos, line_ending, line_ending_size, delimiter, quote, &end, &valid);
+        n_fields++;
+        if (end == 1) {
+            pos = next + 1;
+            continue;
+        }
+        if (end == 2 || complete) {
+            counts[n_rows++] = valid ? n_fields : 0;
+        }
+        pos = next + line_ending_size;
+        n_fields = 0;
+        valid = true;
+    }
+    return n_rows;
+}
+
+// most common non-zero field count and the number of rows that have it
+static size_t csv_sniff_mode(size_t * counts, size_t n_rows, size_t * n_mode) {
+    size_t mode = 0;
+    *n_mode = 0;
+    for (size_t i = 0; i < n_rows; i++) {
+        size_t n = 0;
+        for (size_t j = 0; j < n_rows; j++) {
+            n += counts[j] == counts[i];
+        }
+        if (counts[i] && (n > *n_mode || (n == *n_mode && counts[i] > mode))) {
+            mode = counts[i];
+            *n_mode = n;
+        }
+    }
+    return mode;
+}
+
+static bool csv_sniff_is_number(char * field, size_t size) {
+    char number[64];
+    if (!size || size >= sizeof(number)) {
+        return false;
+    }
+    memcpy(number, field, size);
+    number[size] = '\0';
+    char * end = NULL;
+    strtod(number, &end);
+    return end == number + size;
+}
+
+// a header is likely if, for most columns, the first row differs in type or length from the values 
+// that follow it
+static bool csv_sniff_header(char * buffer, size_t size, bool complete, char * line_ending, CSVDialect * dialect, size_t n_fields) {
+    size_t line_ending_size = strlen(line_ending);
+    int votes = 0;
+    for (size_t column = 0; column < n_fields; column++) {
+        size_t pos = 0, header_size = 0, common_size = 0, n_rows = 0;
+        bool header_number = false, all_numbers = true, same_size = true;
+        while (pos < size && n_rows < CSV_SNIFF_ROWS) {
+            size_t field = 0, field_size = 0;
+            bool valid = true, found = false, number = false, truncated = false;
+            int end = 1;
+            for (; end == 1; field++) { // walk the fields of the row
+                size_t next = csv_sniff_field(buffer, size, pos, line_ending, line_ending_size, dialect->delimiter, dialect->quote, &end, &valid);
+                if (field == column) {
+                    size_t start = pos;
+                    field_size = next - pos;
+                    if (field_size > 1 && buffer[pos] == dialect->quote) { // compare the unquoted values
+                        start++;
+                        field_size -= 2;
+                    }
+                    found = true;
+                    number = csv_sniff_is_number(buffer + start, field_size);
+                }
+                truncated = !end && !complete;
+                pos = next + (end == 2 ? line_ending_size : 1);
+            }
+            if (truncated || !found) {
+                continue;
+            }
+            if (!n_rows) {
+                header_size = field_size;
+                header_number = number;
+            } else {
+                all_numbers = all_numbers && number;
+                same_size = same_size && (n_rows == 1 || field_size == common_size);
+                common_size = field_size;
+            }
+            n_rows++;
+        }
+        if (n_rows < 2) {
+            continue;
+        }
+        if (all_numbers) {
+            votes += header_number ? -1 : 1;
+        } else if (same_size) {
+            votes += header_size == common_size ? -1 : 1;
+        }
+    }
+    return votes > 0;
+}
+
+enum csv_status CSVSniff_init(CSVSniff * sniff, FILE * handle, size_t prefix_size) {
+    if (!sniff || !handle) {
+        return CSV_FAILURE;
+    }
+    sniff->dialect = CSV_DIALECT_RFC4180;
+    sniff->line_ending = DEFAULT_LINE_ENDING;
+    sniff->has_header = false;
+    if (!prefix_size) {
+        prefix_size = CSV_SNIFF_SIZE;
+    }
+    char * buffer = (char *) IO_MALLOC(sizeof(char) * prefix_size);
+    size_t * counts = (size_t *) IO_MALLOC(sizeof(size_t) * CSV_SNIFF_ROWS);
+    long loc = ftell(handle);
+    if (!buffer || !counts || loc < 0) {
+        IO_FREE(buffer);
+        IO_FREE(counts);
+        return loc < 0 ? CSV_READ_ERROR : CSV_MEMORY_ERROR;
+    }
+    size_t size = fread(buffer, sizeof(char), prefix_size, handle);
+    bool complete = size < prefix_size;
+    enum csv_status res = (ferror(handle) || fseek(handle, loc, SEEK_SET)) ? CSV_READ_ERROR : CSV_SUCCESS;
+
+    char * line_ending = csv_sniff_line_ending(buffer, size);
+    if (line_ending) {
+        sniff->line_ending = line_ending;
+    }
+    // the most consistent multi-column parse wins, ties go to the more common delimiter and quote
+    size_t best_rows = 0, best_fields = 1;
+    for (size_t i = 0; !res && csv_sniff_delimiters[i]; i++) {
+        for (size_t j = 0; j < sizeof(csv_sniff_quotes); j++) {
+            size_t n_mode = 0;
+            size_t n_rows = csv_sniff_counts(buffer, size, complete, sniff->line_ending, csv_sniff_delimiters[i], csv_sniff_quotes[j], counts);
+            size_t mode = csv_sniff_mode(counts, n_rows, &n_mode);
+            if (mode > 1 && (n_mode > best_rows || (n_mode == best_rows && mode > best_fields))) {
+                best_rows = n_mode;
+                best_fields = mode;
+                sniff->dialect.delimiter = csv_sniff_delimiters[i];
+                sniff->dialect.quote = csv_sniff_quotes[j];
+            }
+        }
+    }
+    if (!res) {
+        sniff->has_header = csv_sniff_header(buffer, size, complete, sniff->line_ending, &sniff->dialect, best_fields);
+    }
+    IO_FREE(buffer);
+    IO_FREE(counts);
+    return res;
+}
+
+enum csv_status CSVFile_sniff(CSVFile * csv) {
+    if (!csv || csv->mode != CSV_READER || csv->n_records) {
+        return CSV_FAILURE;
+    }
+    CSVSniff sniff;
+    enum csv_status res = CSVSniff_init(&sniff, csv->handle, CSV_SNIFF_SIZE);
+    if (res) {
+        return res;
+    }
+    csv->line_ending = sniff.line_ending;
+    csv->line_ending_size = strlen(sniff.line_ending);
+    csv->has_header = sniff.has_header;
+    return CSVFile_set_dialect(csv, sniff.dialect);
+}
+
+enum csv_status CSVFile_append_record(CSVFile * csv, size_t pos) {
+    if (csv->n_records == csv->n_records_alloc) {
+        int res = true;
+        // a reader shrinks records to fit after indexing, which may be 0 if all records were filtered
+        size_t new_alloc = csv->n_records_alloc ? csv->n_records_alloc * RESIZE_SCALE : DEFAULT_N_RECORDS;
+        RESIZE_REALLOC(res, CSVRecord *, csv->records, new_alloc)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        csv->n_records_alloc = new_alloc;
+    }
+    // projected records hold a (start, end) pair per projected field and never grow
+    csv->records[csv->n_records] = csv_record_new(csv->allocator, csv->mode, pos, csv->projection_map ? 2*csv->n_projection : 0);
+    if (!csv->records[csv->n_records]) {
+        return CSV_MEMORY_ERROR;
+    }
+    
+    csv->n_records++;
+    return CSV_SUCCESS;
+}
+
+CSVRecord * CSVFile_pop_record(CSVFile * csv) {
+    if (!csv->n_records) {
+        return NULL;
+    }
+    CSVRecord * out = csv->records[csv->n_records-1];
+    csv->records[--csv->n_records] = NULL;
+    return out;
+}
+
+#define CSV_ONES ((uint64_t) 0x0101010101010101ULL)
+// non-zero if any byte of v is zero
+#define CSV_HAS_ZERO_BYTE(v) (((v) - CSV_ONES) & ~(v) & (CSV_ONES * 0x80))
+
+// bytes read from the file at once by the reader state machines
+#define CSV_SCAN_BUFFER_SIZE 65536
+
+// chunk of the file read by the state machines, which then find the special bytes of a field without 
+// a stdio call per byte. The handle is positioned after the chunk
+typedef struct CSVScanBuffer {
+    FILE * handle;
+    char * data;
+    size_t pos; // next byte of data
+    size_t size; // bytes in data
+    size_t offset; // file offset of data[0]
+} CSVScanBuffer;
+
+// starts reading at the current position of handle
+static enum csv_status csv_scan_buffer_init(CSVScanBuffer * in, FILE * handle) {
+    in->data = (char *) IO_MALLOC(sizeof(char) * CSV_SCAN_BUFFER_SIZE);
+    if (!in->data) {
+        return CSV_MEMORY_ERROR;
+    }
+    in->handle = handle;
+    in->pos = 0;
+    in->size = 0;
+    in->offset = (size_t) ftell(handle);
+    return CSV_SUCCESS;
+}
+
+// moves the handle back to the next unread byte and frees the chunk
+static void csv_scan_buffer_release(CSVScanBuffer * in) {
+    fseek(in->handle, in->offset + in->pos, SEEK_SET);
+    IO_FREE(in->data);
+    in->data = NULL;
+}
+
+// reads the chunk after the current one. false at the end of the file
+static bool csv_scan_fill(CSVScanBuffer * in) {
+    in->offset += in->size;
+    in->pos = 0;
+    in->size = fread(in->data, sizeof(char), CSV_SCAN_BUFFER_SIZE, in->handle);
+    return in->size;
+}
+
+// file offset of the next byte, as ftell
+static inline size_t csv_scan_tell(CSVScanBuffer * in) {
+    return in->offset + in->pos;
+}
+
+// as fgetc. Does not advance at the end of the file
+static inline int csv_scan_getc(CSVScanBuffer * in) {
+    if (in->pos == in->size && !csv_scan_fill(in)) {
+        return EOF;
+    }
+    return (unsigned char) in->data[in->pos++];
+}
+
+// moves to the file offset pos, keeping the chunk if it holds pos
+static void csv_scan_seek(CSVScanBuffer * in, size_t pos) {
+    if (pos >= in->offset && pos <= in->offset + in->size) {
+        in->pos = pos - in->offset;
+        return;
+    }
+    fseek(in->handle, pos, SEEK_SET);
+    in->offset = pos;
+    in->pos = 0;
+    in->size = 0;
+}
+
+// advances past the bytes that are none of a, b, c and d, testing 8 bytes at a time
+static inline void csv_scan_skip(CSVScanBuffer * in, char a, char b, char c, char d) {
+    const uint64_t as = CSV_ONES * (unsigned char) a, bs = CSV_ONES * (unsigned char) b;
+    const uint64_t cs = CSV_ONES * (unsigned char) c, ds = CSV_ONES * (unsigned char) d;
+    do {
+        const char * data = in->data;
+        size_t pos = in->pos, size = in->size;
+        for (; pos + sizeof(uint64_t) <= size; pos += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, data + pos, sizeof(uint64_t));
+            if (CSV_HAS_ZERO_BYTE(word ^ as) | CSV_HAS_ZERO_BYTE(word ^ bs) | CSV_HAS_ZERO_BYTE(word ^ cs) | CSV_HAS_ZERO_BYTE(word ^ ds)) {
+                break;
+            }
+        }
+        for (; pos < size; pos++) {
+            if (data[pos] == a || data[pos] == b || data[pos] == c || data[pos] == d) {
+                in->pos = pos;
+                return;
+            }
+        }
+        in->pos = pos;
+    } while (csv_scan_fill(in));
+}
+
+// records why the state machine is about to return FAILURE
+#define CSV_SCAN_ERROR(kind) (csv->scan_error = (kind), FAILURE)
+
+// matches the rest of csv->line_ending after its first byte was read. On a partial match, the 
+// mismatched byte is pushed back and ch is set to it
+#define CSV_MATCH_LINE_ENDING(ch, matched) do { \
+    size_t ct_ = 1; \
+    while (ct_ < csv->line_ending_size && ((ch) = csv_scan_getc(in)) == csv->line_ending[ct_]) { \
+        ct_++; \
+    } \
+    (matched) = ct_ == csv->line_ending_size; \
+    if (!(matched) && (ch) != EOF) { /* csv_scan_getc does not advance at the end of the file */ \
+        in->pos--; /* move back one since we read a character that was not a line_ending */ \
+    } \
+} while (0)
+
+// skips spaces (and tabs unless they delimit) before a field or after its closing quote
+#define CSV_SKIP_SPACE(ch, DELIMITER, TRIM) \
+    if (TRIM) { \
+        while ((ch) == ' ' || ((ch) == '\t' && (DELIMITER) != '\t')) { \
+            (ch) = csv_scan_getc(in); \
+        } \
+    }
+
+/*
+defines the reader state machine csv_next_state_SUFFIX for a dialect, reading from the chunk in. When 
+the dialect arguments are constants, the checks for disabled features ('\0' quote, escape or comment 
+and false trim) compile away so the common dialects get a dedicated scanner. Passing the members of 
+csv->dialect instead gives a scanner for any dialect. Unused special bytes are replaced by the 
+delimiter in the calls to csv_scan_skip
+*/
+#define define_csv_state_machine(SUFFIX, DELIMITER, QUOTE, ESCAPE, COMMENT, TRIM) \
+static enum reader_states csv_next_state_##SUFFIX(CSVFile * csv, CSVScanBuffer * in, int state) { \
+    const char line_end = csv->line_ending[0]; \
+    int ch = csv_scan_getc(in); \
+    bool matched = false; \
+    switch (state) { \
+        case IN_FIELD: { \
+            /* consumes the plain bytes of the field in this call, skipping them a word at a time */ \
+            while (ch != (DELIMITER) && ch != line_end && ch != EOF && \
+                    !((ESCAPE) && ch == (ESCAPE)) && !((QUOTE) && ch == (QUOTE))) { \
+                csv_scan_skip(in, (DELIMITER), line_end, (QUOTE) ? (QUOTE) : (DELIMITER), (ESCAPE) ? (ESCAPE) : (DELIMITER)); \
+                ch = csv_scan_getc(in); \
+            } \
+            if (ch == (DELIMITER)) { \
+                return END_FIELD; \
+            } else if (ch == line_end) { \
+                CSV_MATCH_LINE_ENDING(ch, matched); \
+                return matched ? END_RECORD : IN_FIELD; \
+            } else if (ch == EOF) { \
+                return END_CSV; \
+            } else if ((ESCAPE) && ch == (ESCAPE)) { \
+                return csv_scan_getc(in) == EOF ? CSV_SCAN_ERROR(CSV_ERROR_DANGLING_ESCAPE) : IN_FIELD; \
+            } else if ((QUOTE) && ch == (QUOTE)) { /* malformed csv */ \
+                return CSV_SCAN_ERROR(CSV_ERROR_QUOTE_IN_FIELD); \
+            } \
+            return IN_FIELD; \
+        } \
+        case END_FIELD: { \
+            CSV_SKIP_SPACE(ch, DELIMITER, TRIM) \
+            if (ch == line_end) { \
+                CSV_MATCH_LINE_ENDING(ch, matched); \
+                return matched ? END_RECORD : IN_FIELD; \
+            } \
+            break; /* starts a field, shared with END_RECORD */ \
+        } \
+        case IN_QUOTES: { \
+            while (ch != (QUOTE) && ch != EOF && !((ESCAPE) && ch == (ESCAPE))) { \
+                csv_scan_skip(in, (QUOTE), (QUOTE), (QUOTE), (ESCAPE) ? (ESCAPE) : (QUOTE)); \
+                ch = csv_scan_getc(in); \
+            } \
+            if (ch == (QUOTE)) { \
+                return ESCAPING_QUOTES; \
+            } else if ((ESCAPE) && ch == (ESCAPE)) { \
+                ch = csv_scan_getc(in); \
+            } \
+            if (ch == EOF) { /* malformed csv EOF within field */ \
+                return CSV_SCAN_ERROR(CSV_ERROR_EOF_IN_QUOTES); \
+            } \
+            return IN_QUOTES; \
+        } \
+        case ESCAPING_QUOTES: { \
+            if (ch == (QUOTE)) { \
+                return IN_QUOTES; \
+            } \
+            CSV_SKIP_SPACE(ch, DELIMITER, TRIM) \
+            if (ch == (DELIMITER)) { \
+                return END_FIELD; \
+            } else if (ch == line_end) { \
+                CSV_MATCH_LINE_ENDING(ch, matched); \
+                if (!matched) { /* this cannot actually happen in a well-formed csv file */ \
+                    return CSV_SCAN_ERROR(CSV_ERROR_AFTER_QUOTE); \
+                } \
+                return END_RECORD; \
+            } else if (ch == EOF) { \
+                return END_CSV; \
+            } \
+            return CSV_SCAN_ERROR(CSV_ERROR_AFTER_QUOTE); /* any other condition than the 4 above is a malformed csv */ \
+        } \
+        case IN_COMMENT: { \
+            if (ch != line_end && ch != EOF) { \
+                csv_scan_skip(in, line_end, line_end, line_end, line_end); \
+                ch = csv_scan_getc(in); \
+            } \
+            if (ch == line_end) { \
+                CSV_MATCH_LINE_ENDING(ch, matched); \
+                if (matched) { \
+                    return END_COMMENT; \
+                } \
+            } \
+            return ch == EOF ? END_CSV : IN_COMMENT; \
+        } \
+        case UNINITIALIZED: /* fall through */ \
+        case END_COMMENT: /* fall through */ \
+        case END_RECORD: { \
+            if ((COMMENT) && ch == (COMMENT)) { \
+                return IN_COMMENT; \
+            } \
+            CSV_SKIP_SPACE(ch, DELIMITER, TRIM) \
+            break; /* starts a field */ \
+        } \
+        case END_CSV: { \
+            return END_CSV; \
+        } \
+        default: { /* FAILURE, will return failure */ \
+            return FAILURE; \
+        } \
+    } \
+    /* first character of a field */ \
+    if ((QUOTE) && ch == (QUOTE)) { \
+        return IN_QUOTES; \
+    } else if (ch == (DELIMITER)) { \
+        return END_FIELD; \
+    } else if (ch == EOF) { \
+        return END_CSV; \
+    } else if ((ESCAPE) && ch == (ESCAPE)) { \
+        return csv_scan_getc(in) == EOF ? CSV_SCAN_ERROR(CSV_ERROR_DANGLING_ESCAPE) : IN_FIELD; \
+    } \
+    return IN_FIELD; /* any other character should indicate a new field */ \
+}
+
+define_csv_state_machine(comma, ',', '"', '\0', '\0', false)
+define_csv_state_machine(tab, '\t', '"', '\0', '\0', false)
+define_csv_state_machine(pipe, '|', '"', '\0', '\0', false)
+define_csv_state_machine(semicolon, ';', '"', '\0', '\0', false)
+define_csv_state_machine(dialect, csv->dialect.delimiter, csv->dialect.quote, csv->dialect.escape, csv->dialect.comment, csv->dialect.trim)
+
+typedef enum reader_states (*csv_state_machine)(CSVFile * csv, CSVScanBuffer * in, int state);
+
+// selects the dedicated scanner of a common dialect, falling back on the general one
+static csv_state_machine csv_select_state_machine(CSVDialect * dialect) {
+    if (dialect->quote != '"' || dialect->escape || dialect->comment || dialect->trim) {
+        return csv_next_state_dialect;
+    }
+    switch (dialect->delimiter) {
+        case ',': return csv_next_state_comma;
+        case '\t': return csv_next_state_tab;
+        case '|': return csv_next_state_pipe;
+        case ';': return csv_next_state_semicolon;
+    }
+    return csv_next_state_dialect;
+}
+
+static bool csv_is_space(CSVDialect * dialect, char ch) {
+    return ch == ' ' || (ch == '\t' && dialect->delimiter != '\t');
+}
+
+// removes the quotes, escapes and (if trimming) surrounding spaces of the raw field in place. returns 
+// the new size
+static size_t csv_unquote(CSVDialect * dialect, char * field, size_t size) {
+    size_t i = 0;
+    if (dialect->trim) {
+        while (i < size && csv_is_space(dialect, field[i])) {
+            i++;
+        }
+        while (size > i && csv_is_space(dialect, field[size-1])) {
+            size--;
+        }
+    }
+    bool quoted = dialect->quote && i < size && field[i] == dialect->quote;
+    if (quoted) {
+        i++;
+        if (size > i && field[size-1] == dialect->quote) {
+            size--;
+        }
+    } else if (!dialect->escape) { // nothing to unescape
+        memmove(field, field + i, size - i);
+        return size - i;
+    }
+    size_t j = 0;
+    while (i < size) {
+        // quoted fields double the quote or use the escape, unquoted fields only use the escape
+        if (i + 1 < size && ((dialect->escape && field[i] == dialect->escape) || (quoted && field[i] == dialect->quote))) {
+            i++;
+        }
+        field[j++] = field[i++];
+    }
+    return j;
+}
+
+static CSVFilter * csv_add_filter(CSVFile * csv, size_t column, enum csv_filter_kind kind) {
+    if (!csv || csv->mode != CSV_READER || csv->n_records) {
+        return NULL;
+    }
+    bool res = true;
+    RESIZE_REALLOC(res, CSVFilter, csv->filters, csv->n_filters + 1)
+    if (!res) {
+        return NULL;
+    }
+    CSVFilter * filter = csv->filters + csv->n_filters++;
+    memset(filter, 0, sizeof(CSVFilter));
+    filter->column = column;
+    filter->kind = kind;
+    return filter;
+}
+
+enum csv_status CSVFile_filter_equals(CSVFile * csv, size_t column, char * value) {
+    CSVFilter * filter = value ? csv_add_filter(csv, column, CSV_FILTER_EQUALS) : NULL;
+    if (!filter) {
+        return CSV_FAILURE;
+    }
+    filter->value = value;
+    filter->value_size = strlen(value);
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_filter_prefix(CSVFile * csv, size_t column, char * prefix) {
+    CSVFilter * filter = prefix ? csv_add_filter(csv, column, CSV_FILTER_PREFIX) : NULL;
+    if (!filter) {
+        return CSV_FAILURE;
+    }
+    filter->value = prefix;
+    filter->value_size = strlen(prefix);
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_filter_range(CSVFile * csv, size_t column, double low, double high) {
+    CSVFilter * filter = csv_add_filter(csv, column, CSV_FILTER_RANGE);
+    if (!filter) {
+        return CSV_FAILURE;
+    }
+    filter->low = low;
+    filter->high = high;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_filter_in_set(CSVFile * csv, size_t column, char ** values, size_t n_values) {
+    CSVFilter * filter = values ? csv_add_filter(csv, column, CSV_FILTER_IN_SET) : NULL;
+    if (!filter) {
+        return CSV_FAILURE;
+    }
+    filter->set = values;
+    filter->n_set = n_values;
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_filter_callback(CSVFile * csv, size_t column, csv_filter_callback callback, void * data) {
+    CSVFilter * filter = callback ? csv_add_filter(csv, column, CSV_FILTER_CALLBACK) : NULL;
+    if (!filter) {
+        return CSV_FAILURE;
+    }
+    filter->callback = callback;
+    filter->data = data;
+    return CSV_SUCCESS;
+}
+
+static bool csv_filter_match(CSVFilter * filter, char * field, size_t size) {
+    switch (filter->kind) {
+        case CSV_FILTER_EQUALS: {
+            return size == filter->value_size && !memcmp(field, filter->value, size);
+        }
+        case CSV_FILTER_PREFIX: {
+            return size >= filter->value_size && !memcmp(field, filter->value, filter->value_size);
+        }
+        case CSV_FILTER_RANGE: {
+            char * end = NULL;
+            double value = strtod(field, &end);
+            return end != field && *end == '\0' && value >= filter->low && value <= filter->high;
+        }
+        case CSV_FILTER_IN_SET: {
+            for (size_t i = 0; i < filter->n_set; i++) {
+                if (!strncmp(filter->set[i], field, size) && filter->set[i][size] == '\0') {
+                    return true;
+                }
+            }
+            return false;
+        }
+        case CSV_FILTER_CALLBACK: {
+            return filter->callback(field, size, filter->data);
+        }
+    }
+    return false;
+}
+
+// whether the fields of the record are stored as is, so reading them needs no decoding
+static bool csv_record_plain(CSVFile * csv, CSVRecord * csvr) {
+    return !csvr->quoted && !csv->dialect.escape && !csv->dialect.trim;
+}
+
+// loads the raw field at [start, end - 1) into filter_buffer, unquotes it and tests it against filter
+static enum csv_status csv_apply_filter(CSVFile * csv, CSVFilter * filter, bool * match) {
+    if (!filter->span_end) {
+        *match = false;
+        return CSV_SUCCESS;
+    }
+    size_t size = filter->span_end - filter->span_start - 1;
+    if (size + 1 > csv->filter_buffer_size) {
+        bool res = true;
+        RESIZE_REALLOC(res, char, csv->filter_buffer, size + 1)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        csv->filter_buffer_size = size + 1;
+    }
+    char * field = csv->filter_buffer;
+    long loc = ftell(csv->handle);
+    fseek(csv->handle, filter->span_start, SEEK_SET);
+    size = fread(field, sizeof(char), size, csv->handle);
+    fseek(csv->handle, loc, SEEK_SET);
+    if (!csv_record_plain(csv, csv->records[csv->n_records-1])) {
+        size = csv_unquote(&csv->dialect, field, size);
+    }
+    field[size] = '\0';
+    *match = csv_filter_match(filter, field, size);
+    return CSV_SUCCESS;
+}
+
+// byte range of the raw (still quoted) contents of a field
+static enum csv_status csv_field_span(CSVFile * csv, size_t record, size_t field, size_t * start, size_t * size) {
+    if (record >= csv->n_records || field >= csv->records[record]->n_fields) {
+        return CSV_INDEX_ERROR;
+    }
+    size_t * field_pos = csv->records[record]->field_pos;
+    if (csv->projection_map) {
+        // (start, end) pairs follow the record start. An end of 0 is a column missing from a ragged record
+        field_pos += 2*field + 1;
+        if (!field_pos[1]) {
+            return CSV_INDEX_ERROR;
+        }
+    } else {
+        field_pos += field;
+    }
+    *start = field_pos[0];
+    *size = field_pos[1] - field_pos[0] - 1;
+    return CSV_SUCCESS;
+}
+
+// reads the field of record at [start, start + size) into buffer removing the quotes. buffer must hold 
+// size + 1 chars
+static void csv_read_field(CSVFile * csv, size_t record, size_t start, size_t size, char * buffer) {
+    fseek(csv->handle, start, SEEK_SET);
+    size = fread(buffer, sizeof(char), size, csv->handle);
+    if (!csv_record_plain(csv, csv->records[record])) {
+        size = csv_unquote(&csv->dialect, buffer, size);
+    }
+    buffer[size] = '\0';
+}
+
+static CSVCacheRow ** csv_cache_bucket(CSVRowCache * cache, size_t record) {
+    return cache->buckets + (record & (cache->n_buckets - 1));
+}
+
+static void csv_cache_unlink(CSVRowCache * cache, CSVCacheRow * row) {
+    if (row->newer) {
+        row->newer->older = row->older;
+    } else {
+        cache->newest = row->older;
+    }
+    if (row->older) {
+        row->older->newer = row->newer;
+    } else {
+        cache->oldest = row->newer;
+    }
+}
+
+static void csv_cache_push(CSVRowCache * cache, CSVCacheRow * row) {
+    row->newer = NULL;
+    row->older = cache->newest;
+    if (cache->newest) {
+        cache->newest->newer = row;
+    } else {
+        cache->oldest = row;
+    }
+    cache->newest = row;
+}
+
+static void csv_cache_evict(CSVRowCache * cache, CSVCacheRow * row) {
+    CSVCacheRow ** link = csv_cache_bucket(cache, row->record);
+    while (*link != row) {
+        link = &(*link)->next_bucket;
+    }
+    *link = row->next_bucket;
+    csv_cache_unlink(cache, row);
+    cache->size -= row->size;
+    cache->n_rows--;
+    IO_FREE(row);
+}
+
+// drops the cached copy of record, if any
+static void csv_cache_remove(CSVFile * csv, size_t record) {
+    if (!csv->cache) {
+        return;
+    }
+    CSVCacheRow * row = *csv_cache_bucket(csv->cache, record);
+    while (row && row->record != record) {
+        row = row->next_bucket;
+    }
+    if (row) {
+        csv_cache_evict(csv->cache, row);
+    }
+}
+
+// drops all cached rows, keeping the counters
+static void csv_cache_clear(CSVFile * csv) {
+    while (csv->cache && csv->cache->oldest) {
+        csv_cache_evict(csv->cache, csv->cache->oldest);
+    }
+}
+
+static CSVCacheRow ** csv_cache_new_buckets(size_t n_buckets) {
+    CSVCacheRow ** buckets = (CSVCacheRow **) IO_MALLOC(sizeof(CSVCacheRow *) * n_buckets);
+    for (size_t i = 0; buckets && i < n_buckets; i++) {
+        buckets[i] = NULL;
+    }
+    return buckets;
+}
+
+// doubles the buckets once there are more rows than buckets
+static void csv_cache_rehash(CSVRowCache * cache) {
+    size_t n_buckets = 2 * cache->n_buckets;
+    CSVCacheRow ** buckets = csv_cache_new_buckets(n_buckets);
+    if (!buckets) { // keep the longer chains
+        return;
+    }
+    for (size_t i = 0; i < cache->n_buckets; i++) {
+        CSVCacheRow * row = cache->buckets[i];
+        while (row) {
+            CSVCacheRow * next = row->next_bucket;
+            row->next_bucket = buckets[row->record & (n_buckets - 1)];
+            buckets[row->record & (n_buckets - 1)] = row;
+            row = next;
+        }
+    }
+    IO_FREE(cache->buckets);
+    cache->buckets = buckets;
+    cache->n_buckets = n_buckets;
+}
+
+// reads and decodes all fields of record into a single allocation
+static enum csv_status csv_cache_load(CSVFile * csv, size_t record, CSVCacheRow ** out) {
+    CSVRecord * csvr = csv->records[record];
+    size_t n_fields = csvr->n_fields, n_chars = 0, start, size;
+    for (size_t i = 0; i < n_fields; i++) {
+        if (!csv_field_span(csv, record, i, &start, &size)) {
+            n_chars += size + 1;
+        }
+    }
+    size_t row_size = sizeof(CSVCacheRow) + sizeof(size_t) * n_fields + n_chars;
+    CSVCacheRow * row = (CSVCacheRow *) IO_MALLOC(row_size);
+    if (!row) {
+        return CSV_MEMORY_ERROR;
+    }
+    row->record = record;
+    row->n_fields = n_fields;
+    row->size = row_size;
+    char * chars = (char *) (row->offsets + n_fields);
+    size_t cursor = 0;
+    if (!csv->projection_map && n_fields) {
+        // the fields and their delimiters fit in the allocation, so read them at once and decode in place
+        fseek(csv->handle, csvr->field_pos[0], SEEK_SET);
+        fread(chars, sizeof(char), n_chars - 1, csv->handle);
+        if (csv_record_plain(csv, csvr)) { // the fields are already in place, only terminate them
+            for (size_t i = 0; i < n_fields; i++) {
+                row->offsets[i] = csvr->field_pos[i] - csvr->field_pos[0];
+                chars[csvr->field_pos[i+1] - csvr->field_pos[0] - 1] = '\0';
+            }
+        }
+        for (size_t i = 0; i < n_fields && !csv_record_plain(csv, csvr); i++) {
+            char * raw = chars + (csvr->field_pos[i] - csvr->field_pos[0]);
+            size = csv_unquote(&csv->dialect, raw, csvr->field_pos[i+1] - csvr->field_pos[i] - 1);
+            memmove(chars + cursor, raw, size);
+            chars[cursor + size] = '\0';
+            row->offsets[i] = cursor;
+            cursor += size + 1;
+        }
+    } else { // projected fields may be out of order
+        for (size_t i = 0; i < n_fields; i++) {
+            if (csv_field_span(csv, record, i, &start, &size)) {
+                row->offsets[i] = CSV_NOT_PROJECTED;
+                continue;
+            }
+            csv_read_field(csv, record, start, size, chars + cursor);
+            row->offsets[i] = cursor;
+            cursor += strlen(chars + cursor) + 1;
+        }
+    }
+    *out = row;
+    return CSV_SUCCESS;
+}
+
+// finds the decoded field in the cache, loading its record on a miss. *field is NULL if the record 
+// does not fit in the cache
+static enum csv_status csv_cache_get(CSVFile * csv, size_t record, size_t field, char ** value) {
+    CSVRowCache * cache = csv->cache;
+    CSVCacheRow * row = *csv_cache_bucket(cache, record);
+    while (row && row->record != record) {
+        row = row->next_bucket;
+    }
+    *value = NULL;
+    if (row) {
+        cache->hits++;
+        csv_cache_unlink(cache, row);
+    } else {
+        cache->misses++;
+        enum csv_status res = csv_cache_load(csv, record, &row);
+        if (res) {
+            return res;
+        }
+        if (row->size > cache->capacity) {
+            IO_FREE(row);
+            return CSV_SUCCESS;
+        }
+        while (cache->size + row->size > cache->capacity) {
+            csv_cache_evict(cache, cache->oldest);
+        }
+        if (cache->n_rows == cache->n_buckets) {
+            csv_cache_rehash(cache);
+        }
+        CSVCacheRow ** bucket = csv_cache_bucket(cache, record);
+        row->next_bucket = *bucket;
+        *bucket = row;
+        cache->size += row->size;
+        cache->n_rows++;
+    }
+    csv_cache_push(cache, row);
+    if (row->offsets[field] == CSV_NOT_PROJECTED) {
+        return CSV_INDEX_ERROR;
+    }
+    *value = (char *) (row->offsets + row->n_fields) + row->offsets[field];
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_set_cache(CSVFile * csv, size_t capacity) {
+    if (!csv || csv->mode == CSV_WRITER) {
+        return CSV_FAILURE;
+    }
+    if (csv->cache) {
+        csv->cache->capacity = capacity;
+        while (csv->cache->size > capacity) {
+            csv_cache_evict(csv->cache, csv->cache->oldest);
+        }
+        if (capacity) {
+            return CSV_SUCCESS;
+        }
+        IO_FREE(csv->cache->buckets);
+        IO_FREE(csv->cache);
+        csv->cache = NULL;
+        return CSV_SUCCESS;
+    } else if (!capacity) {
+        return CSV_SUCCESS;
+    }
+    CSVRowCache * cache = (CSVRowCache *) IO_MALLOC(sizeof(CSVRowCache));
+    CSVCacheRow ** buckets = csv_cache_new_buckets(CSV_CACHE_BUCKETS);
+    if (!cache || !buckets) {
+        IO_FREE(cache);
+        IO_FREE(buckets);
+        return CSV_MEMORY_ERROR;
+    }
+    *cache = (CSVRowCache) {.buckets = buckets, .n_buckets = CSV_CACHE_BUCKETS, .capacity = capacity};
+    csv->cache = cache;
+    return CSV_SUCCESS;
+}
+
+// looks up projection_names in the header record (record 0) and projects the header
+static enum csv_status csv_resolve_projection_names(CSVFile * csv) {
+    CSVRecord * header = csv->records[0];
+    csv->projection = (size_t *) IO_MALLOC(sizeof(size_t) * csv->n_projection);
+    size_t * field_pos = (size_t *) io_alloc(csv->allocator, sizeof(size_t) * (2*csv->n_projection + 1));
+    if (!csv->projection || !field_pos) {
+        if (field_pos) {
+            io_free(csv->allocator, field_pos);
+        }
+        return CSV_MEMORY_ERROR;
+    }
+
+    long loc = ftell(csv->handle);
+    enum csv_status res = CSV_SUCCESS;
+    for (size_t i = 0; i < csv->n_projection && !res; i++) {
+        size_t ifie = 0;
+        for (; ifie < header->n_fields; ifie++) {
+            size_t start, size;
+            if (csv_field_span(csv, 0, ifie, &start, &size) || size >= CSV_CELL_BUFFER_SIZE) {
+                continue;
+            }
+            csv_read_field(csv, 0, start, size, cell_buffer);
+            if (!strcmp(cell_buffer, csv->projection_names[i])) {
+                break;
+            }
+        }
+        if (ifie == header->n_fields) {
+            res = CSV_INDEX_ERROR;
+        }
+        csv->projection[i] = ifie;
+    }
+    fseek(csv->handle, loc, SEEK_SET);
+
+    if (!res) {
+        res = csv_build_projection_map(csv);
+    }
+    if (res) {
+        io_free(csv->allocator, field_pos);
+        return res;
+    }
+
+    field_pos[0] = header->field_pos[0];
+    for (size_t i = 0; i < csv->n_projection; i++) {
+        field_pos[2*i+1] = header->field_pos[csv->projection[i]];
+        field_pos[2*i+2] = header->field_pos[csv->projection[i]+1];
+    }
+    io_free(csv->allocator, header->field_pos);
+    header->field_pos = field_pos;
+    header->n_fields = csv->n_projection;
+    header->n_fields_alloc = 2*csv->n_projection;
+    return CSV_SUCCESS;
+}
+
+// records the end of the field in source column *column that started at *field_start
+static enum csv_status csv_end_field(CSVFile * csv, size_t * field_start, size_t * column, size_t pos) {
+    CSVRecord * csvr = csv->records[csv->n_records-1];
+    enum csv_status res = CSV_SUCCESS;
+    if (!csv->projection_map) {
+        res = csv_record_append_field_pos(csv->allocator, csvr, pos);
+    } else if (*column < csv->projection_map_size && csv->projection_map[*column] != CSV_NOT_PROJECTED) {
+        size_t slot = csv->projection_map[*column];
+        csvr->field_pos[2*slot+1] = *field_start;
+        csvr->field_pos[2*slot+2] = pos;
+    }
+    for (size_t i = 0; i < csv->n_filters; i++) {
+        if (csv->filters[i].column == *column) {
+            csv->filters[i].span_start = *field_start;
+            csv->filters[i].span_end = pos;
+        }
+    }
+    *field_start = pos;
+    (*column)++;
+    return res;
+}
+
+// updates the field count statistics with a record of n_fields source columns
+static enum csv_status csv_count_fields(CSVFile * csv, size_t n_fields) {
+    if (n_fields > csv->max_n_fields || !csv->n_fields_histogram) {
+        size_t old_size = csv->n_fields_histogram ? csv->max_n_fields + 1 : 0;
+        bool res = true;
+        RESIZE_REALLOC(res, size_t, csv->n_fields_histogram, n_fields + 1)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        for (size_t i = old_size; i <= n_fields; i++) {
+            csv->n_fields_histogram[i] = 0;
+        }
+        if (!old_size) {
+            csv->min_n_fields = n_fields;
+        }
+        csv->max_n_fields = n_fields;
+    }
+    if (n_fields < csv->min_n_fields) {
+        csv->min_n_fields = n_fields;
+    }
+    csv->n_fields_histogram[n_fields]++;
+    csv->rectangular = csv->min_n_fields == csv->max_n_fields;
+    return CSV_SUCCESS;
+}
+
+// finalizes the record currently being scanned with n_fields source columns. keep is false if the 
+// record fails the filters
+static enum csv_status csv_end_record(CSVFile * csv, size_t n_fields, bool * keep) {
+    enum csv_status res = CSV_SUCCESS;
+    *keep = true;
+    if (csv->n_filters && !(csv->has_header && csv->n_records == 1)) {
+        for (size_t i = 0; i < csv->n_filters && *keep && !res; i++) {
+            res = csv_apply_filter(csv, csv->filters + i, keep);
+        }
+        for (size_t i = 0; i < csv->n_filters; i++) {
+            csv->filters[i].span_end = 0;
+        }
+        if (res || !*keep) {
+            csv->n_filtered += !res;
+            return res;
+        }
+    }
+    if ((res = csv_count_fields(csv, n_fields))) {
+        return res;
+    }
+    if (csv->projection_map) {
+        csv->records[csv->n_records-1]->n_fields = csv->n_projection;
+    } else if (csv->projection_names) { // header just completed
+        return csv_resolve_projection_names(csv);
+    }
+    return CSV_SUCCESS;
+}
+
+// moves in past the first line ending at or after start, or to the end of the file
+static void csv_skip_line(CSVFile * csv, CSVScanBuffer * in, size_t start) {
+    csv_scan_seek(in, start);
+    int ch = '\0';
+    bool matched = false;
+    while (!matched && (ch = csv_scan_getc(in)) != EOF) {
+        if (ch == csv->line_ending[0]) {
+            CSV_MATCH_LINE_ENDING(ch, matched);
+        }
+    }
+}
+
+// counts a malformed record spanning [start, end) and keeps it if there is room in the sample
+static enum csv_status csv_add_error(CSVFile * csv, size_t start, size_t end) {
+    csv->n_errors++;
+    if (csv->n_error_samples == csv->max_error_samples) {
+        return CSV_SUCCESS;
+    }
+    bool res = true;
+    RESIZE_REALLOC(res, CSVError, csv->errors, csv->n_error_samples + 1)
+    if (!res) {
+        return CSV_MEMORY_ERROR;
+    }
+    csv->errors[csv->n_error_samples++] = (CSVError) {.start = start, .end = end, .kind = csv->scan_error};
+    return CSV_SUCCESS;
+}
+
+// reuses the last record for the record starting at start instead of allocating a new one
+static void csv_reset_record(CSVFile * csv, size_t start) {
+    CSVRecord * csvr = csv->records[csv->n_records-1];
+    if (csv->projection_map) {
+        for (size_t i = 1; i <= 2*csv->n_projection; i++) {
+            csvr->field_pos[i] = 0;
+        }
+    }
+    csvr->field_pos[0] = start;
+    csvr->n_fields = 0;
+    csvr->quoted = false;
+}
+
+// indexes from the next byte of in, which is the start of the last record. state is the reader state 
+// preceding that position
+static enum csv_status csv_scan_records(CSVFile * csv, CSVScanBuffer * in, enum reader_states state) {
+    size_t first_record = csv->n_records - 1; // records before this one were indexed by a previous scan
+    int res = CSV_SUCCESS;
+    size_t field_start = csv->records[first_record]->field_pos[0]; // start of the field currently being scanned
+    size_t column = 0; // source column of the field currently being scanned
+    bool keep = true; // whether the last completed record passed the filters
+    csv_state_machine next_state = csv_select_state_machine(&csv->dialect);
+    enum reader_states prev = state;
+    while (state != END_CSV) {
+        prev = state;
+        if (field_start >= csv->range_end && (state == END_RECORD || state == END_COMMENT)) {
+            state = END_CSV; // the record starts in the next range
+        } else {
+            state = next_state(csv, in, state);
+        }
+        switch (state) {
+            case IN_QUOTES: {
+                csv->records[csv->n_records-1]->quoted = true;
+                break;
+            }
+            case END_FIELD: {
+                // record a new field position
+                // use for CSV_READER only. TODO: make case for CSV_APPENDER
+                //printf("\ncompleted field at %zu", csv_scan_tell(in));
+                if ((res = csv_end_field(csv, &field_start, &column, csv_scan_tell(in)))) {
+                    return res;
+                }
+                break;
+            }
+            case END_RECORD: {
+                // end the last field and record a new record
+                //printf("\ncompleted record at %zu", csv_scan_tell(in));
+                size_t field_end = csv_scan_tell(in) - csv->line_ending_size + 1;
+                // use for CSV_READER only. TODO: make case for CSV_APPENDER
+                if ((res = csv_end_field(csv, &field_start, &column, field_end)) || (res = csv_end_record(csv, column, &keep))) {
+                    return res;
+                }
+                field_start = field_end + csv->line_ending_size - 1;
+                column = 0;
+                if (!keep) {
+                    csv_reset_record(csv, field_start);
+                } else if ((res = CSVFile_append_record(csv, field_start))) {
+                    return res;
+                }
+                break;
+            }
+            case END_COMMENT: {
+                // the record starts after the comment line
+                field_start = csv_scan_tell(in);
+                csv->records[csv->n_records-1]->field_pos[0] = field_start;
+                break;
+            }
+            case END_CSV: {
+                // cleanup records
+                //printf("\ncompleted file at %zu", csv_scan_tell(in));
+                size_t loc = csv_scan_tell(in);
+                if (prev == IN_COMMENT) { // a final comment line without a line ending is not a record
+                    loc = csv->records[csv->n_records-1]->field_pos[0];
+                }
+                //if (csv->records[csv->n_records-1]->n_fields) { // if csv has single column/field count, this misses last entry if no line-ending
+                // the next CSVFile_refresh resumes at the start of the final record
+                csv->scan_resume = csv->records[csv->n_records-1]->field_pos[0];
+                csv->scan_partial = loc > csv->scan_resume;
+                if (csv->scan_partial) { // add a field if the current cursor is not at the beginning of a record
+                    // final record ended without a line ending. TODO: need to check that this actually includes the last character or if it cuts off the last one
+                    if ((res = csv_end_field(csv, &field_start, &column, loc + 1)) || (res = csv_end_record(csv, column, &keep))) {
+                        return res;
+                    }
+                    // until more data is appended, it is unknown whether the record is complete
+                    csv->scan_partial_kept = keep;
+                    csv->scan_partial_columns = column;
+                }
+                if (!keep || loc <= csv->records[csv->n_records-1]->field_pos[0]) {
+                    // if last record has zero fields, pop it and destroy. This will happend if final real record ending with a line ending
+                    csv_record_del(csv->allocator, CSVFile_pop_record(csv));
+                    csv->records[csv->n_records] = NULL;
+
+                    // if mode is reader, try to free extraneous memory
+                }
+                if (csv->mode == CSV_READER && csv->n_records) {
+                    RESIZE_REALLOC(res, CSVRecord *, csv->records, csv->n_records)
+                    if (res) {
+                        csv->n_records_alloc = csv->n_records;
+                    }
+                    
+                    // projected records are allocated at their exact size, allocator memory is released in bulk
+                    for (size_t i = first_record; i < csv->n_records && !csv->projection_map && !csv->allocator; i++) {
+                        // probably should have a function to hide the ->field_pos member
+                        //printf("\nallocation before %zu, number of positions %zu", csv->records[i]->n_fields_alloc+1, csv->records[i]->n_fields+1);
+                        RESIZE_REALLOC(res, size_t, csv->records[i]->field_pos, csv->records[i]->n_fields+1)
+                        if (res) {
+                            csv->records[i]->n_fields_alloc = csv->records[i]->n_fields;
+                            //printf("\nallocation after %zu, number of positions %zu", csv->records[i]->n_fields_alloc+1, csv->records[i]->n_fields+1);
+                        }
+                    }
+                    
+                }
+                break;
+            }
+            case FAILURE: {
+                // the malformed record ends at the first line ending after its start, where recovery resumes
+                size_t start = csv->records[csv->n_records-1]->field_pos[0];
+                csv_skip_line(csv, in, start);
+                field_start = csv_scan_tell(in);
+                if ((res = csv_add_error(csv, start, field_start)) || !csv->recover) {
+                    return res ? res : CSV_READ_ERROR;
+                }
+                for (size_t i = 0; i < csv->n_filters; i++) {
+                    csv->filters[i].span_end = 0;
+                }
+                csv_reset_record(csv, field_start);
+                column = 0;
+                state = END_RECORD;
+                break;
+            }
+            default: {
+                // do nothing
+            }
+        }
+    }
+    /*
+    printf("csv summary:\n");
+    for (size_t irec = 0; irec < csv->n_records; irec++) {
+        printf("record %zu: %zu fields found:\n", irec, csv->records[irec]->n_fields);
+        for (size_t ifie = 0; ifie < csv->records[irec]->n_fields + 1; ifie++) {
+            printf("%zu ", csv->records[irec]->field_pos[ifie]);
+        }
+        printf("\n");
+    }
+    */
+    return CSV_SUCCESS;
+}
+
+// indexes from the current position of the handle, see csv_scan_records. The handle is left after the 
+// last byte read
+static enum csv_status csv_scan(CSVFile * csv, enum reader_states state) {
+    CSVScanBuffer in;
+    enum csv_status res = csv_scan_buffer_init(&in, csv->handle);
+    if (res) {
+        return res;
+    }
+    res = csv_scan_records(csv, &in, state);
+    csv_scan_buffer_release(&in);
+    return res;
+}
+
+// finds the first record starting at or after range_start by running the reader from the start of the 
+// file. *start is SIZE_MAX if there is none
+static enum csv_status csv_range_exact(CSVFile * csv, size_t * start) {
+    csv_state_machine next_state = csv_select_state_machine(&csv->dialect);
+    enum reader_states state = UNINITIALIZED;
+    *start = SIZE_MAX;
+    fseek(csv->handle, 0, SEEK_SET);
+    CSVScanBuffer in;
+    enum csv_status res = csv_scan_buffer_init(&in, csv->handle);
+    while (!res && state != END_CSV) {
+        state = next_state(csv, &in, state);
+        if (state == FAILURE) {
+            res = CSV_READ_ERROR;
+        } else if ((state == END_RECORD || state == END_COMMENT) && csv_scan_tell(&in) >= csv->range_start) {
+            *start = csv_scan_tell(&in);
+            break;
+        }
+    }
+    if (in.data) {
+        csv_scan_buffer_release(&in);
+    }
+    return res;
+}
+
+// quoting context of a byte when resynchronizing a range
+enum csv_range_context {
+    CSV_RANGE_OUTSIDE, // outside of quotes
+    CSV_RANGE_INSIDE, // inside quotes
+    CSV_RANGE_AFTER_QUOTE, // after a quote inside quotes, which closes them or is doubled
+};
+
+// follows the quoting of buffer[1:size) assuming buffer[1] is in context. buffer[0] is the byte before. 
+// Returns false if the quoting is invalid under the assumption. *boundary is set to the offset after 
+// the first line ending outside of quotes, 0 if there is none
+static bool csv_range_follow(CSVFile * csv, char * buffer, size_t size, enum csv_range_context context, size_t * boundary) {
+    CSVDialect * dialect = &csv->dialect;
+    *boundary = 0;
+    if (context == CSV_RANGE_AFTER_QUOTE && buffer[0] != dialect->quote) {
+        return false;
+    }
+    // quotes never closed in the window would need a field longer than the window
+    if (context == CSV_RANGE_INSIDE && (size <= 1 || !memchr(buffer + 1, dialect->quote, size - 1))) {
+        return false;
+    }
+    for (size_t i = 1; i < size; i++) {
+        char ch = buffer[i];
+        if (dialect->escape && ch == dialect->escape && context != CSV_RANGE_AFTER_QUOTE) {
+            i++;
+            continue;
+        }
+        switch (context) {
+            case CSV_RANGE_INSIDE: {
+                context = ch == dialect->quote ? CSV_RANGE_AFTER_QUOTE : CSV_RANGE_INSIDE;
+                continue;
+            }
+            case CSV_RANGE_AFTER_QUOTE: {
+                if (ch == dialect->quote) { // doubled
+                    context = CSV_RANGE_INSIDE;
+                    continue;
+                } else if (ch != dialect->delimiter && ch != csv->line_ending[0]) {
+                    return false;
+                }
+                context = CSV_RANGE_OUTSIDE;
+                break; // the closing quote is followed by a delimiter or line ending
+            }
+            case CSV_RANGE_OUTSIDE: {
+                if (ch == dialect->quote) { // only valid at the start of a field
+                    if (buffer[i-1] != dialect->delimiter && !memchr(csv->line_ending, buffer[i-1], csv->line_ending_size)) {
+                        return false;
+                    }
+                    context = CSV_RANGE_INSIDE;
+                    continue;
+                }
+                break;
+            }
+        }
+        if (!*boundary && ch == csv->line_ending[0] && i + csv->line_ending_size <= size && !memcmp(buffer + i, csv->line_ending, csv->line_ending_size)) {
+            *boundary = i + csv->line_ending_size;
+            i += csv->line_ending_size - 1;
+        }
+    }
+    return true;
+}
+
+// finds the first record starting at or after range_start. The quoting context of range_start is 
+// guessed from a window of the following bytes, where wrong guesses usually produce invalid quoting. 
+// If the plausible guesses disagree on the first record, the file is read from the start
+static enum csv_status csv_range_first_record(CSVFile * csv, size_t * start) {
+    if (!csv->range_start) {
+        *start = 0;
+        return CSV_SUCCESS;
+    }
+    // spaces and comments can hide the context of a quote
+    if (csv->dialect.trim || csv->dialect.comment || csv->range_start <= csv->line_ending_size) {
+        return csv_range_exact(csv, start);
+    }
+    // a record starting at range_start follows a line ending just before it
+    size_t from = csv->range_start - csv->line_ending_size - 1;
+    char * buffer = (char *) IO_MALLOC(sizeof(char) * (CSV_RANGE_WINDOW + 1));
+    if (!buffer) {
+        return CSV_MEMORY_ERROR;
+    }
+    fseek(csv->handle, from, SEEK_SET);
+    size_t size = fread(buffer, sizeof(char), CSV_RANGE_WINDOW + 1, csv->handle);
+    size_t boundary = 0, n_plausible = 0;
+    bool agree = true;
+    enum csv_range_context n_contexts = csv->dialect.quote ? CSV_RANGE_AFTER_QUOTE + 1 : CSV_RANGE_INSIDE;
+    for (enum csv_range_context context = CSV_RANGE_OUTSIDE; context < n_contexts; context++) {
+        size_t candidate = 0;
+        if (csv_range_follow(csv, buffer, size, context, &candidate)) {
+            agree = agree && (!n_plausible++ || candidate == boundary);
+            boundary = candidate;
+        }
+    }
+    IO_FREE(buffer);
+    if (!n_plausible || !agree) {
+        return csv_range_exact(csv, start);
+    } else if (boundary) {
+        *start = from + boundary;
+    } else if (size <= CSV_RANGE_WINDOW) { // the rest of the file is a single record
+        *start = SIZE_MAX;
+    } else {
+        return csv_range_exact(csv, start);
+    }
+    return CSV_SUCCESS;
+}
+
+enum csv_status CSVFile_read(CSVFile * csv) {
+    //printf("\nreading file %s", csv->filename);
+    if (csv->n_records || csv->parent) { // already indexed
+        return CSV_FAILURE;
+    }
+    size_t start = 0;
+    int res = csv_range_first_record(csv, &start);
+    if (res || start >= csv->range_end) { // empty range
+        return res;
+    }
+    if (start) { // the header is only in the range starting at the first record
+        csv->has_header = false;
+        fseek(csv->handle, start, SEEK_SET);
+    }
+    if ((res = CSVFile_append_record(csv, start))) {
+        return res;
+    }
+    return csv_scan(csv, start ? END_RECORD : UNINITIALIZED);
+}
+
+CSVFile * CSVFile_open_range(char * filename, bool has_header, char * line_ending, size_t byte_start, size_t byte_end) {
+    if (byte_start > byte_end) {
+        return NULL;
+    }
+    CSVFile * csv = CSVFile_open(filename, CSV_READER, has_header, line_ending, NULL);
+    if (csv) {
+        csv->range_start = byte_start;
+        csv->range_end = byte_end;
+    }
+    return csv;
+}
+
+CSVFile * CSVFile_open_rows(CSVFile * csv, size_t first, size_t count) {
+    if (!csv || csv->mode == CSV_WRITER || first > csv->n_records || count > csv->n_records - first) {
+        return NULL;
+    }
+    CSVFile * view = (CSVFile *) IO_MALLOC(sizeof(CSVFile));
+    if (!view) {
+        return NULL;
+    }
+    // shares the index, dialect and projection of csv but nothing it would have to free
+    *view = *csv;
+    view->parent = csv;
+    view->mode = CSV_READER;
+    view->has_header = csv->has_header && !first;
+    view->handle_file_out = NULL;
+    view->file_out = NULL;
+    view->records = csv->records + first;
+    view->n_records = count;
+    view->n_records_alloc = count;
+    view->filters = NULL;
+    view->n_filters = 0;
+    view->filter_buffer = NULL;
+    view->filter_buffer_size = 0;
+    view->n_fields_histogram = NULL;
+    view->edits = NULL;
+    view->n_edits = 0;
+    view->n_edits_alloc = 0;
+    view->cache = NULL;
+    view->errors = NULL;
+    view->n_errors = 0;
+    view->n_error_samples = 0;
+    return view;
+}
+
+// removes a record with n_fields source columns from the field count statistics
+static void csv_uncount_fields(CSVFile * csv, size_t n_fields) {
+    csv->n_fields_histogram[n_fields]--;
+    while (csv->max_n_fields && !csv->n_fields_histogram[csv->max_n_fields]) {
+        csv->max_n_fields--;
+    }
+    if (!csv->max_n_fields && !csv->n_fields_histogram[0]) { // no records left
+        IO_FREE(csv->n_fields_histogram);
+        csv->n_fields_histogram = NULL;
+        csv->min_n_fields = 0;
+    }
+    while (csv->min_n_fields < csv->max_n_fields && !csv->n_fields_histogram[csv->min_n_fields]) {
+        csv->min_n_fields++;
+    }
+    csv->rectangular = csv->min_n_fields == csv->max_n_fields;
+}
+
+enum csv_status CSVFile_refresh(CSVFile * csv) {
+    if (!csv || csv->mode == CSV_WRITER || !csv->handle || csv->parent) {
+        return CSV_FAILURE;
+    }
+    if (!csv->n_records && !csv->scan_resume && !csv->scan_partial) { // never indexed
+        return CSVFile_read(csv);
+    }
+    if (csv->scan_partial) { // final record may continue in the appended bytes
+        if (csv->scan_partial_kept) {
+            csv_uncount_fields(csv, csv->scan_partial_columns);
+            csv_record_del(csv->allocator, CSVFile_pop_record(csv));
+            csv_cache_remove(csv, csv->n_records);
+        } else {
+            csv->n_filtered--;
+        }
+        csv->scan_partial = false;
+    }
+    if (fseek(csv->handle, csv->scan_resume, SEEK_SET)) {
+        return CSV_READ_ERROR;
+    }
+    int res = CSVFile_append_record(csv, csv->scan_resume);
+    if (res) {
+        return res;
+    }
+    return csv_scan(csv, csv->scan_resume ? END_RECORD : UNINITIALIZED);
+}
+
+CSVWriter * CSVWriter_new(FILE * handle, char * line_ending, size_t flush_threshold) {
+    if (!handle) {
+        return NULL;
+    }
+    CSVWriter * writer = (CSVWriter *) IO_MALLOC(sizeof(CSVWriter));
+    if (!writer) {
+        return NULL;
+    }
+
+    if (!flush_threshold) {
+        flush_threshold = CSV_WRITE_BUFFER_SIZE;
+    }
+
+    char * buffer = (char *) IO_MALLOC(sizeof(char) * flush_threshold);
+    if (!buffer) {
+        IO_FREE(writer);
+        return NULL;
+    }
+
+    CSVWriter_init(writer, handle, line_ending, buffer, flush_threshold);
+    writer->buffer_reclaim = true;
+
+    return writer;
+}
+
+void CSVWriter_init(CSVWriter * writer, FILE * handle, char * line_ending, char * buffer, size_t flush_threshold) {
+    if (!writer) {
+        return;
+    }
+    writer->handle = handle;
+    writer->status = CSV_SUCCESS;
+    if (!buffer || !flush_threshold) { // a caller buffer of size 0 cannot hold anything, use a default one
+        if (!flush_threshold) {
+            flush_threshold = CSV_WRITE_BUFFER_SIZE;
+        }
+        buffer = (char *) IO_MALLOC(sizeof(char) * flush_threshold);
+        if (!buffer) {
+            writer->status = CSV_MEMORY_ERROR;
+            flush_threshold = 0;
+        }
+        writer->buffer_reclaim = true;
+    } else {
+        writer->buffer_reclaim = false;
+    }
+    if (!line_ending) {
+        line_ending = DEFAULT_LINE_ENDING;
+    }
+    writer->buffer = buffer;
+    writer->buffer_size = flush_threshold;
+    writer->size = 0;
+    writer->line_ending = line_ending;
+    writer->line_ending_size = strlen(line_ending);
+    writer->n_fields = 0;
+    writer->n_records = 0;
+    writer->empty = true;
+}
+
+// flushes the buffer and frees the writer. The file handle is NOT closed
+enum csv_status CSVWriter_del(CSVWriter * writer) {
+    if (!writer) {
+        return CSV_FAILURE;
+    }
+    enum csv_status res = CSVWriter_flush(writer);
+    if (writer->buffer_reclaim) {
+        IO_FREE(writer->buffer);
+        writer->buffer = NULL;
+        writer->buffer_reclaim = false;
+    }
+    IO_FREE(writer);
+    return res;
+}
+
+enum csv_status CSVWriter_flush(CSVWriter * writer) {
+    if (writer->size && fwrite(writer->buffer, sizeof(char), writer->size, writer->handle) != writer->size) {
+        writer->status = CSV_FAILURE;
+    }
+    writer->size = 0;
+    return writer->status;
+}
+
+static void csv_writer_put(CSVWriter * writer, const char * data, size_t size) {
+    if (writer->status != CSV_SUCCESS || !writer->buffer_size) {
+        return;
+    }
+    if (writer->size + size > writer->buffer_size) {
+        CSVWriter_flush(writer);
+        if (size > writer->buffer_size) { // bypass the buffer entirely
+            if (fwrite(data, sizeof(char), size, writer->handle) != size) {
+                writer->status = CSV_FAILURE;
+            }
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->size, data, size);
+    writer->size += size;
+}
+
+static void csv_writer_putc(CSVWriter * writer, char ch) {
+    if (writer->status != CSV_SUCCESS || !writer->buffer_size) {
+        return;
+    }
+    if (writer->size == writer->buffer_size) {
+        CSVWriter_flush(writer);
+    }
+    writer->buffer[writer->size++] = ch;
+}
+
+// whether field contains a delimiter, quote or line ending character. Tests 8 bytes at a time
+static bool csv_needs_quotes(const char * field, size_t size) {
+    const uint64_t delimiters = CSV_ONES * ',', quotes = CSV_ONES * '"', crs = CSV_ONES * '\r', lfs = CSV_ONES * '\n';
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, field + i, sizeof(uint64_t));
+        if (CSV_HAS_ZERO_BYTE(word ^ delimiters) | CSV_HAS_ZERO_BYTE(word ^ quotes) | CSV_HAS_ZERO_BYTE(word ^ crs) | CSV_HAS_ZERO_BYTE(word ^ lfs)) {
+            return true;
+        }
+    }
+    for (; i < size; i++) {
+        if (field[i] == ',' || field[i] == '"' || field[i] == '\r' || field[i] == '\n') {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CSVWriter_begin_record(CSVWriter * writer) {
+    writer->n_fields = 0;
+    writer->empty = true;
+}
+
+// starts a new field, writing the delimiter if needed
+static void csv_writer_next_field(CSVWriter * writer, size_t size) {
+    if (writer->n_fields++) {
+        csv_writer_putc(writer, ',');
+    }
+    writer->empty = writer->empty && !size;
+}
+
+// writes the field contents, enclosing them in quotes and doubling their quotes only if necessary
+static void csv_writer_put_field(CSVWriter * writer, const char * field, size_t size) {
+    if (!csv_needs_quotes(field, size)) {
+        csv_writer_put(writer, field, size);
+        return;
+    }
+    csv_writer_putc(writer, '"');
+    const char * quote = NULL;
+    while ((quote = memchr(field, '"', size))) {
+        size_t n = quote - field + 1;
+        csv_writer_put(writer, field, n);
+        csv_writer_putc(writer, '"');
+        field += n;
+        size -= n;
+    }
+    csv_writer_put(writer, field, size);
+    csv_writer_putc(writer, '"');
+}
+
+// size of the field once written by csv_writer_put_field
+static size_t csv_written_size(const char * field, size_t size) {
+    if (!csv_needs_quotes(field, size)) {
+        return size;
+    }
+    size_t written = size + 2;
+    for (size_t i = 0; i < size; i++) {
+        written += (field[i] == '"');
+    }
+    return written;
+}
+
+enum csv_status CSVWriter_write_field(CSVWriter * writer, const char * field, size_t size) {
+    csv_writer_next_field(writer, size);
+    csv_writer_put_field(writer, field, size);
+    return writer->status;
+}
+
+static const char csv_digit_pairs[201] = 
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// writes the decimal digits of value into the end of buffer, returns the first digit
+static char * csv_format_uint64(uint64_t value, char * end) {
+    while (value >= 100) {
+        end -= 2;
+        memcpy(end, csv_digit_pairs + 2*(value % 100), 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        end -= 2;
+        memcpy(end, csv_digit_pairs + 2*value, 2);
+    } else {
+        *--end = (char) ('0' + value);
+    }
+    return end;
+}
+
+enum csv_status CSVWriter_write_field_int64(CSVWriter * writer, int64_t value) {
+    char buffer[24];
+    char * end = buffer + sizeof(buffer);
+    // negate in unsigned arithmetic so INT64_MIN does not overflow
+    char * start = csv_format_uint64(value < 0 ? (uint64_t) 0 - (uint64_t) value : (uint64_t) value, end);
+    if (value < 0) {
+        *--start = '-';
+    }
+    csv_writer_next_field(writer, end - start);
+    csv_writer_put(writer, start, end - start);
+    return writer->status;
+}
+
+// up to 15 significant digits, trailing zeros removed. Fixed notation for magnitudes in 
+// [1e-5, 1e15), scientific notation otherwise
+enum csv_status CSVWriter_write_field_double(CSVWriter * writer, double value) {
+    char buffer[40];
+    char * out = buffer;
+    if (value != value) {
+        csv_writer_next_field(writer, 3);
+        csv_writer_put(writer, "nan", 3);
+        return writer->status;
+    }
+    if (value < 0) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value > DBL_MAX) {
+        memcpy(out, "inf", 3);
+        out += 3;
+    } else if (value == 0.0 || (value >= 1e-5 && value < 1e15)) {
+        uint64_t integral = (uint64_t) value;
+        char digits[24];
+        char * end = digits + sizeof(digits);
+        char * start = csv_format_uint64(integral, end);
+        // remaining significant digits go to the fraction
+        int n_frac = 15 - (integral ? (int) (end - start) : 0);
+        uint64_t scale = 1;
+        for (int i = 0; i < n_frac; i++) {
+            scale *= 10;
+        }
+        uint64_t frac = (uint64_t) ((value - (double) integral) * (double) scale + 0.5);
+        if (frac >= scale) { // rounding carried into the integral part
+            frac -= scale;
+            start = csv_format_uint64(++integral, end);
+        }
+        memcpy(out, start, end - start);
+        out += end - start;
+        if (frac) {
+            *out++ = '.';
+            char * frac_start = csv_format_uint64(frac + scale, end) + 1; // leading 1 keeps the zeros after the point
+            while (end[-1] == '0') {
+                end--;
+            }
+            memcpy(out, frac_start, end - frac_start);
+            out += end - frac_start;
+        }
+    } else {
+        int exponent = (int) floor(log10(value));
+        // 10^-exponent overflows for subnormals, so scale those in two steps
+        double scaled = (exponent < -300) ? value * 1e300 * pow(10, -exponent - 300) : value / pow(10, exponent);
+        uint64_t mantissa = (uint64_t) (scaled * 1e14 + 0.5);
+        if (mantissa >= 1000000000000000ULL) {
+            mantissa = (mantissa + 5) / 10;
+            exponent++;
+        } else if (mantissa < 100000000000000ULL) {
+            mantissa *= 10;
+            exponent--;
+        }
+        char digits[24];
+        char * end = digits + sizeof(digits);
+        char * start = csv_format_uint64(mantissa, end);
+        while (end[-1] == '0') {
+            end--;
+        }
+        *out++ = *start++;
+        if (start < end) {
+            *out++ = '.';
+            memcpy(out, start, end - start);
+            out += end - start;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        exponent = exponent < 0 ? -exponent : exponent;
+        end = digits + sizeof(digits);
+        start = csv_format_uint64((uint64_t) exponent, end);
+        if (end - start < 2) {
+            *out++ = '0';
+        }
+        memcpy(out, start, end - start);
+        out += end - start;
+    }
+    csv_writer_next_field(writer, out - buffer);
+    csv_writer_put(writer, buffer, out - buffer);
+    return writer->status;
+}
+
+enum csv_status CSVWriter_end_record(CSVWriter * writer) {
+    if (writer->empty && writer->n_fields <= 1) { // otherwise the record is an empty line and is lost
+        csv_writer_put(writer, "\"\"", 2);
+    }
+    csv_writer_put(writer, writer->line_ending, writer->line_ending_size);
+    writer->n_records++;
+    writer->n_fields = 0;
+    writer->empty = true;
+    return writer->status;
+}
+
+// binary search of the edit at (record, field). If not found, index is where it would be inserted
+static bool csv_find_edit(CSVFile * csv, size_t record, size_t field, size_t * index) {
+    size_t lo = 0, hi = csv->n_edits;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        CSVEdit * edit = csv->edits + mid;
+        if (edit->record < record || (edit->record == record && edit->field < field)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *index = lo;
+    return lo < csv->n_edits && csv->edits[lo].record == record && csv->edits[lo].field == field;
+}
+
+// takes ownership of value and records it in the edit overlay, replacing a previous edit of the cell
+static enum csv_status csv_add_edit(CSVFile * csv, size_t record, size_t field, char * value, size_t size) {
+    size_t index;
+    if (csv_find_edit(csv, record, field, &index)) {
+        IO_FREE(csv->edits[index].value);
+    } else {
+        if (csv->n_edits == csv->n_edits_alloc) {
+            size_t new_alloc = csv->n_edits_alloc ? csv->n_edits_alloc * RESIZE_SCALE : DEFAULT_N_RECORDS;
+            bool res = true;
+            RESIZE_REALLOC(res, CSVEdit, csv->edits, new_alloc)
+            if (!res) {
+                return CSV_MEMORY_ERROR;
+            }
+            csv->n_edits_alloc = new_alloc;
+        }
+        memmove(csv->edits + index + 1, csv->edits + index, sizeof(CSVEdit) * (csv->n_edits - index));
+        csv->n_edits++;
+        csv->edits[index].record = record;
+        csv->edits[index].field = field;
+    }
+    csv->edits[index].value = value;
+    csv->edits[index].size = size;
+    return CSV_SUCCESS;
+}
+
+static void csv_clear_edits(CSVFile * csv) {
+    for (size_t i = 0; i < csv->n_edits; i++) {
+        IO_FREE(csv->edits[i].value);
+    }
+    csv->n_edits = 0;
+}
+
+// drops the index so the file can be read again
+static void csv_clear_index(CSVFile * csv) {
+    // the records of a reader own nothing outside an allocator that releases memory all at once
+    bool frees = cl_frees(csv->allocator) || csv->mode != CSV_READER;
+    for (size_t i = 0; i < csv->n_records; i++) {
+        if (frees) {
+            csv_record_del(csv->allocator, csv->records[i]);
+        }
+        csv->records[i] = NULL;
+    }
+    csv->n_records = 0;
+    IO_FREE(csv->n_fields_histogram);
+    csv->n_fields_histogram = NULL;
+    csv->max_n_fields = 0;
+    csv->min_n_fields = 0;
+    csv->rectangular = true;
+    csv->scan_resume = 0;
+    csv->scan_partial = false;
+    csv->n_errors = 0;
+    csv->n_error_samples = 0;
+    csv_cache_clear(csv);
+}
+
+// copies the bytes [start, end) of the source file to the writer, reading directly into its buffer. 
+// end of SIZE_MAX copies to the end of the file
+static void csv_copy_range(CSVFile * csv, CSVWriter * writer, size_t start, size_t end) {
+    CSVWriter_flush(writer);
+    if (fseek(csv->handle, start, SEEK_SET)) {
+        writer->status = CSV_READ_ERROR;
+        return;
+    }
+    size_t remaining = end - start;
+    while (remaining && !writer->status) {
+        size_t n = (remaining < writer->buffer_size) ? remaining : writer->buffer_size;
+        writer->size = fread(writer->buffer, sizeof(char), n, csv->handle);
+        remaining -= writer->size;
+        if (writer->size < n) {
+            if (end != SIZE_MAX) {
+                writer->status = CSV_READ_ERROR;
+            }
+            remaining = 0;
+        }
+        CSVWriter_flush(writer);
+    }
+}
+
+// applies the edit overlay. Edits that keep the byte width of their cell are patched in place, 
+// otherwise the file is rewritten by copying the unedited byte ranges around the edits. file_out is 
+// rewritten from the start on every call and the edits are kept, since the source file is unchanged
+static enum csv_status csv_amend(CSVFile * csv) {
+    if (!csv->n_edits && !csv->file_out) {
+        return CSV_SUCCESS;
+    }
+    bool in_place = !csv->file_out;
+    size_t max_written = 1;
+    for (size_t i = 0; i < csv->n_edits && in_place; i++) {
+        size_t start, size;
+        csv_field_span(csv, csv->edits[i].record, csv->edits[i].field, &start, &size);
+        in_place = csv_written_size(csv->edits[i].value, csv->edits[i].size) == size;
+        max_written = size > max_written ? size : max_written;
+    }
+
+    CSVWriter writer;
+    char * temp_name = NULL;
+    if (in_place) { // each edit is flushed before seeking to the next, so the buffer holds one edit
+        CSVWriter_init(&writer, csv->handle, csv->line_ending, NULL, max_written);
+        for (size_t i = 0; i < csv->n_edits && !writer.status; i++) {
+            size_t start, size;
+            csv_field_span(csv, csv->edits[i].record, csv->edits[i].field, &start, &size);
+            CSVWriter_flush(&writer);
+            if (fseek(csv->handle, start, SEEK_SET)) {
+                writer.status = CSV_FAILURE;
+            }
+            csv_writer_put_field(&writer, csv->edits[i].value, csv->edits[i].size);
+            csv->records[csv->edits[i].record]->quoted = true; // the written field may be quoted
+        }
+    } else {
+        FILE * out = csv->handle_file_out;
+        if (csv->file_out) { // truncate what a previous write left
+            if (!out || !(out = csv->handle_file_out = freopen(csv->file_out, "wb", out))) {
+                return CSV_FAILURE;
+            }
+        } else { // rewrite to a temporary file that replaces the original
+            size_t name_size = strlen(csv->filename);
+            // the temporary name followed by the name the original is moved to while it is replaced
+            temp_name = (char *) IO_MALLOC(sizeof(char) * 2 * (name_size + 7));
+            if (!temp_name) {
+                return CSV_MEMORY_ERROR;
+            }
+            memcpy(temp_name, csv->filename, name_size);
+            memcpy(temp_name + name_size, ".amend", 7);
+            if (!(out = fopen(temp_name, "wb"))) {
+                IO_FREE(temp_name);
+                return CSV_FAILURE;
+            }
+        }
+        CSVWriter_init(&writer, out, csv->line_ending, NULL, CSV_WRITE_BUFFER_SIZE);
+        size_t cursor = 0;
+        for (size_t i = 0; i < csv->n_edits && !writer.status; i++) {
+            size_t start, size;
+            csv_field_span(csv, csv->edits[i].record, csv->edits[i].field, &start, &size);
+            csv_copy_range(csv, &writer, cursor, start);
+            csv_writer_put_field(&writer, csv->edits[i].value, csv->edits[i].size);
+            cursor = start + size;
+        }
+        csv_copy_range(csv, &writer, cursor, SIZE_MAX);
+    }
+
+    enum csv_status res = CSVWriter_flush(&writer);
+    if (writer.buffer_reclaim) {
+        IO_FREE(writer.buffer);
+    }
+    if (fflush(writer.handle)) {
+        res = CSV_FAILURE;
+    }
+    if (temp_name) {
+        fclose(writer.handle);
+        if (!res) {
+            fclose(csv->handle);
+            bool replaced = !rename(temp_name, csv->filename);
+            if (!replaced) { // some platforms do not rename over an existing file, so move the original aside first
+                size_t name_size = strlen(csv->filename);
+                char * backup_name = temp_name + name_size + 7;
+                memcpy(backup_name, csv->filename, name_size);
+                memcpy(backup_name + name_size, ".orig", 6);
+                if (!rename(csv->filename, backup_name)) {
+                    replaced = !rename(temp_name, csv->filename);
+                    if (replaced) {
+                        remove(backup_name);
+                    } else {
+                        rename(backup_name, csv->filename);
+                    }
+                }
+            }
+            if (replaced) { // offsets changed, so the file must be indexed again
+                csv_clear_index(csv);
+                csv->handle = fopen(csv->filename, "rb+");
+                if (!csv->handle || (res = CSVFile_read(csv))) {
+                    res = res ? res : CSV_READ_ERROR;
+                }
+            } else { // both files are kept and the index still describes the original
+                res = CSV_FAILURE;
+                csv->handle = fopen(csv->filename, "rb+");
+            }
+        } else {
+            remove(temp_name);
+        }
+        IO_FREE(temp_name);
+    }
+    if (!res && !csv->file_out) {
+        csv_clear_edits(csv);
+        csv_cache_clear(csv);
+    }
+    return res;
+}
+
+// writes all records. Records are padded with empty fields to max_n_fields so the output is not ragged
+enum csv_status CSVFile_write(CSVFile * csv) {
+    if (csv && csv->mode == CSV_AMENDER) {
+        return csv_amend(csv);
+    } else if (!csv || csv->mode != CSV_WRITER) {
+        return CSV_FAILURE;
+    }
+    CSVWriter writer;
+    CSVWriter_init(&writer, csv->handle, csv->line_ending, NULL, CSV_WRITE_BUFFER_SIZE);
+    for (size_t irec = 0; irec < csv->n_records && !writer.status; irec++) {
+        CSVRecord * csvr = csv->records[irec];
+        CSVWriter_begin_record(&writer);
+        for (size_t ifie = 0; ifie < csv->max_n_fields; ifie++) {
+            char * field = (ifie < csvr->n_fields) ? csvr->fields[ifie] : NULL;
+            CSVWriter_write_field(&writer, field ? field : "", field ? strlen(field) : 0);
+        }
+        CSVWriter_end_record(&writer);
+    }
+    enum csv_status res = CSVWriter_flush(&writer);
+    if (writer.buffer_reclaim) {
+        IO_FREE(writer.buffer);
+    }
+    if (fflush(csv->handle)) {
+        return CSV_FAILURE;
+    }
+    return res;
+}
+
+// for builders
+/*
+int CSVFile_append_record(CSVFile * csv, char ** record, size_t n_fields) {
+    // TODO;
+    return CSV_SUCCESS;
+}
+
+// for builders
+int CSVFile_append_field(CSVFile * csv, size_t record, char * format, ...) {
+    // TODO;
+    return CSV_SUCCESS;
+}
+*/
+
+enum csv_status CSVFile_set_cell(CSVFile * csv, size_t record, size_t field, char * format, ...) {
+    if (!csv || !format || csv->mode == CSV_READER) {
+        return CSV_FAILURE;
+    }
+    size_t start, size_old;
+    if (csv->mode == CSV_AMENDER && csv_field_span(csv, record, field, &start, &size_old)) {
+        return CSV_INDEX_ERROR;
+    }
+    // sprintf into the cell, realloc'ing memory as needed to ensure (record, field) exist
+    va_list args, args_copy;
+    va_start(args, format);
+    va_copy(args_copy, args);
+    int size = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    char * value = (size >= 0) ? (char *) IO_MALLOC(sizeof(char) * (size + 1)) : NULL;
+    if (value) {
+        vsnprintf(value, size + 1, format, args_copy);
+    }
+    va_end(args_copy);
+    if (!value) {
+        return (size < 0) ? CSV_FAILURE : CSV_MEMORY_ERROR;
+    }
+
+    enum csv_status res = CSV_SUCCESS;
+    if (csv->mode == CSV_AMENDER) {
+        if ((res = csv_add_edit(csv, record, field, value, size))) {
+            IO_FREE(value);
+        }
+        return res;
+    }
+    while (csv->n_records <= record && !res) {
+        res = CSVFile_append_record(csv, 0);
+    }
+    if (res || (res = csv_record_set_field(csv->records[record], field, value))) {
+        IO_FREE(value);
+        return res;
+    }
+    if (field >= csv->max_n_fields) {
+        csv->max_n_fields = field + 1;
+    }
+    return CSV_SUCCESS;
+}
+
+// record in a sorted run. key holds, for each sort key, a double or a size_t length and the bytes
+typedef struct CSVSortEntry {
+    size_t start; // raw record, without its line ending
+    size_t size;
+    size_t key_size;
+    char key[];
+} CSVSortEntry;
+
+// sorted run spilled to a temporary file during CSVFile_sort_to
+typedef struct CSVSortRun {
+    FILE * handle;
+    CSVSortEntry * entry; // current entry of the run
+    size_t entry_alloc;
+} CSVSortRun;
+
+static int csv_sort_compare(CSVSortKey * keys, size_t n_keys, CSVSortEntry * a, CSVSortEntry * b) {
+    char * key_a = a->key, * key_b = b->key;
+    for (size_t i = 0; i < n_keys; i++) {
+        int cmp = 0;
+        if (keys[i].type == CSV_KEY_NUMBER) {
+            double x, y;
+            memcpy(&x, key_a, sizeof(double));
+            memcpy(&y, key_b, sizeof(double));
+            key_a += sizeof(double);
+            key_b += sizeof(double);
+            // fields that are not numbers sort after numbers in either order
+            if (isnan(x) || isnan(y)) {
+                cmp = (isnan(x) != 0) - (isnan(y) != 0);
+                if (cmp) {
+                    return cmp;
+                }
+                continue;
+            }
+            cmp = (x > y) - (x < y);
+        } else {
+            size_t size_a, size_b;
+            memcpy(&size_a, key_a, sizeof(size_t));
+            memcpy(&size_b, key_b, sizeof(size_t));
+            key_a += sizeof(size_t);
+            key_b += sizeof(size_t);
+            cmp = memcmp(key_a, key_b, size_a < size_b ? size_a : size_b);
+            if (!cmp) {
+                cmp = (size_a > size_b) - (size_a < size_b);
+            }
+            key_a += size_a;
+            key_b += size_b;
+        }
+        if (cmp) {
+            return keys[i].descending ? -cmp : cmp;
+        }
+    }
+    return (a->start > b->start) - (a->start < b->start); // keeps the sort stable
+}
+
+// merge sort of entries using tmp, which holds n entries
+static void csv_sort_entries(CSVSortKey * keys, size_t n_keys, CSVSortEntry ** entries, CSVSortEntry ** tmp, size_t n) {
+    if (n < 2) {
+        return;
+    }
+    size_t half = n / 2;
+    csv_sort_entries(keys, n_keys, entries, tmp, half);
+    csv_sort_entries(keys, n_keys, entries + half, tmp, n - half);
+    size_t i = 0, j = half, k = 0;
+    while (i < half && j < n) {
+        tmp[k++] = csv_sort_compare(keys, n_keys, entries[j], entries[i]) < 0 ? entries[j++] : entries[i++];
+    }
+    while (i < half) {
+        tmp[k++] = entries[i++];
+    }
+    while (j < n) {
+        tmp[k++] = entries[j++];
+    }
+    memcpy(entries, tmp, sizeof(CSVSortEntry *) * n);
+}
+
+// encodes the sort keys of record into *buffer, growing it as needed
+static enum csv_status csv_sort_key(CSVFile * csv, size_t record, CSVSortKey * keys, size_t n_keys, char ** buffer, size_t * buffer_size, char ** field, size_t * field_size, size_t * key_size) {
+    *key_size = 0;
+    for (size_t i = 0; i < n_keys; i++) {
+        size_t start = 0, size = 0;
+        bool missing = csv_field_span(csv, record, keys[i].column, &start, &size) != CSV_SUCCESS;
+        if (missing) { // ragged record, treated as empty
+            size = 0;
+        }
+        bool res = true;
+        if (size + 1 > *field_size) {
+            RESIZE_REALLOC(res, char, *field, size + 1)
+            if (!res) {
+                return CSV_MEMORY_ERROR;
+            }
+            *field_size = size + 1;
+        }
+        if (missing) {
+            (*field)[0] = '\0';
+        } else {
+            csv_read_field(csv, record, start, size, *field);
+        }
+        size = strlen(*field);
+        size_t needed = *key_size + (keys[i].type == CSV_KEY_NUMBER ? sizeof(double) : sizeof(size_t) + size);
+        if (needed > *buffer_size) {
+            size_t new_size = needed > 2 * *buffer_size ? needed : 2 * *buffer_size;
+            RESIZE_REALLOC(res, char, *buffer, new_size)
+            if (!res) {
+                return CSV_MEMORY_ERROR;
+            }
+            *buffer_size = new_size;
+        }
+        if (keys[i].type == CSV_KEY_NUMBER) {
+            char * end = NULL;
+            double value = strtod(*field, &end);
+            if (!size || *end != '\0') {
+                value = NAN;
+            }
+            memcpy(*buffer + *key_size, &value, sizeof(double));
+        } else {
+            memcpy(*buffer + *key_size, &size, sizeof(size_t));
+            memcpy(*buffer + *key_size + sizeof(size_t), *field, size);
+        }
+        *key_size = needed;
+    }
+    return CSV_SUCCESS;
+}
+
+// appends the raw record and a line ending to the output
+static void csv_sort_copy_record(CSVFile * csv, CSVWriter * writer, size_t start, size_t size) {
+    if (writer->size + size <= writer->buffer_size) { // read straight into the free space of the buffer
+        fseek(csv->handle, start, SEEK_SET);
+        if (fread(writer->buffer + writer->size, sizeof(char), size, csv->handle) != size) {
+            writer->status = CSV_READ_ERROR;
+        }
+        writer->size += size;
+    } else {
+        csv_copy_range(csv, writer, start, start + size);
+    }
+    csv_writer_put(writer, csv->line_ending, csv->line_ending_size);
+}
+
+static bool csv_sort_write_entry(FILE * handle, CSVSortEntry * entry) {
+    return fwrite(entry, sizeof(CSVSortEntry), 1, handle) == 1 && fwrite(entry->key, sizeof(char), entry->key_size, handle) == entry->key_size;
+}
+
+// loads the next entry of run. *loaded is false at the end of the run
+static enum csv_status csv_sort_read_entry(CSVSortRun * run, bool * loaded) {
+    CSVSortEntry header;
+    *loaded = false;
+    if (fread(&header, sizeof(CSVSortEntry), 1, run->handle) != 1) {
+        return ferror(run->handle) ? CSV_READ_ERROR : CSV_SUCCESS;
+    }
+    if (sizeof(CSVSortEntry) + header.key_size > run->entry_alloc) {
+        size_t new_alloc = sizeof(CSVSortEntry) + header.key_size;
+        CSVSortEntry * entry = (CSVSortEntry *) IO_REALLOC(run->entry, new_alloc);
+        if (!entry) {
+            return CSV_MEMORY_ERROR;
+        }
+        run->entry = entry;
+        run->entry_alloc = new_alloc;
+    }
+    *run->entry = header;
+    if (fread(run->entry->key, sizeof(char), header.key_size, run->handle) != header.key_size) {
+        return CSV_READ_ERROR;
+    }
+    *loaded = true;
+    return CSV_SUCCESS;
+}
+
+// restores the min-heap of runs below index i
+static void csv_sort_sift_down(CSVSortKey * keys, size_t n_keys, CSVSortRun ** heap, size_t n, size_t i) {
+    while (2*i + 1 < n) {
+        size_t child = 2*i + 1;
+        if (child + 1 < n && csv_sort_compare(keys, n_keys, heap[child+1]->entry, heap[child]->entry) < 0) {
+            child++;
+        }
+        if (csv_sort_compare(keys, n_keys, heap[i]->entry, heap[child]->entry) <= 0) {
+            break;
+        }
+        CSVSortRun * swap = heap[i];
+        heap[i] = heap[child];
+        heap[child] = swap;
+        i = child;
+    }
+}
+
+// k-way merge of the spilled runs into writer
+static enum csv_status csv_sort_merge(CSVFile * csv, CSVWriter * writer, CSVSortKey * keys, size_t n_keys, CSVSortRun * runs, size_t n_runs) {
+    CSVSortRun ** heap = (CSVSortRun **) IO_MALLOC(sizeof(CSVSortRun *) * n_runs);
+    if (!heap) {
+        return CSV_MEMORY_ERROR;
+    }
+    size_t n = 0;
+    enum csv_status res = CSV_SUCCESS;
+    bool loaded = false;
+    for (size_t i = 0; i < n_runs && !res; i++) {
+        rewind(runs[i].handle);
+        if (!(res = csv_sort_read_entry(runs + i, &loaded)) && loaded) {
+            heap[n++] = runs + i;
+        }
+    }
+    for (size_t i = n / 2; i-- > 0;) {
+        csv_sort_sift_down(keys, n_keys, heap, n, i);
+    }
+    while (n && !res && !writer->status) {
+        csv_sort_copy_record(csv, writer, heap[0]->entry->start, heap[0]->entry->size);
+        if (!(res = csv_sort_read_entry(heap[0], &loaded)) && !loaded) {
+            heap[0] = heap[--n];
+        }
+        csv_sort_sift_down(keys, n_keys, heap, n, 0);
+    }
+    IO_FREE(heap);
+    return res ? res : writer->status;
+}
+
+enum csv_status CSVFile_sort_to(CSVFile * csv, char * out_path, CSVSortKey * keys, size_t n_keys, size_t memory_budget) {
+    if (!csv || !out_path || !keys || !n_keys || csv->mode == CSV_WRITER || csv->projection_map) {
+        return CSV_FAILURE;
+    }
+    FILE * out = fopen(out_path, "wb");
+    if (!out) {
+        return CSV_FAILURE;
+    }
+    CSVWriter writer;
+    CSVWriter_init(&writer, out, csv->line_ending, NULL, CSV_WRITE_BUFFER_SIZE);
+    size_t first = csv->has_header && csv->n_records;
+    if (first) {
+        CSVRecord * header = csv->records[0];
+        csv_sort_copy_record(csv, &writer, header->field_pos[0], header->field_pos[header->n_fields] - header->field_pos[0] - 1);
+    }
+
+    // entries are packed into arena, their pointers count against the budget too
+    char * arena = (char *) IO_MALLOC(sizeof(char) * memory_budget);
+    CSVSortEntry ** entries = NULL, ** tmp = NULL;
+    CSVSortRun * runs = NULL;
+    char * key = NULL, * field = NULL;
+    size_t key_alloc = 0, field_alloc = 0, entries_alloc = 0, n_entries = 0, used = 0, n_runs = 0;
+    enum csv_status res = arena ? CSV_SUCCESS : CSV_MEMORY_ERROR;
+    for (size_t irec = first; irec <= csv->n_records && !res; irec++) {
+        size_t key_size = 0, entry_size = 0;
+        if (irec < csv->n_records) {
+            if ((res = csv_sort_key(csv, irec, keys, n_keys, &key, &key_alloc, &field, &field_alloc, &key_size))) {
+                break;
+            }
+            // keep entries aligned for their size_t members
+            entry_size = (sizeof(CSVSortEntry) + key_size + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+        }
+        bool full = used + entry_size + 2 * sizeof(CSVSortEntry *) * (n_entries + 1) > memory_budget;
+        if ((irec == csv->n_records || full) && n_entries) { // sort and spill the run
+            csv_sort_entries(keys, n_keys, entries, tmp, n_entries);
+            if (irec == csv->n_records && !n_runs) { // everything fit in memory
+                for (size_t i = 0; i < n_entries && !writer.status; i++) {
+                    csv_sort_copy_record(csv, &writer, entries[i]->start, entries[i]->size);
+                }
+                break;
+            }
+            bool alloc = true;
+            RESIZE_REALLOC(alloc, CSVSortRun, runs, n_runs + 1)
+            if (!alloc || !(runs[n_runs].handle = tmpfile())) {
+                res = alloc ? CSV_FAILURE : CSV_MEMORY_ERROR;
+                break;
+            }
+            runs[n_runs].entry = NULL;
+            runs[n_runs++].entry_alloc = 0;
+            for (size_t i = 0; i < n_entries && !res; i++) {
+                res = csv_sort_write_entry(runs[n_runs-1].handle, entries[i]) ? CSV_SUCCESS : CSV_FAILURE;
+            }
+            n_entries = 0;
+            used = 0;
+        }
+        if (irec == csv->n_records) {
+            break;
+        } else if (used + entry_size + 2 * sizeof(CSVSortEntry *) * (n_entries + 1) > memory_budget) {
+            res = CSV_MEMORY_ERROR; // a single record does not fit in the budget
+            break;
+        }
+        if (n_entries == entries_alloc) {
+            size_t new_alloc = entries_alloc ? 2 * entries_alloc : DEFAULT_N_RECORDS;
+            bool alloc = true;
+            RESIZE_REALLOC(alloc, CSVSortEntry *, entries, new_alloc)
+            if (alloc) {
+                RESIZE_REALLOC(alloc, CSVSortEntry *, tmp, new_alloc)
+            }
+            if (!alloc) {
+                res = CSV_MEMORY_ERROR;
+                break;
+            }
+            entries_alloc = new_alloc;
+        }
+        CSVRecord * csvr = csv->records[irec];
+        CSVSortEntry * entry = (CSVSortEntry *) (arena + used);
+        entry->start = csvr->field_pos[0];
+        entry->size = csvr->field_pos[csvr->n_fields] - csvr->field_pos[0] - 1;
+        entry->key_size = key_size;
+        memcpy(entry->key, key, key_size);
+        entries[n_entries++] = entry;
+        used += entry_size;
+    }
+    IO_FREE(arena);
+    IO_FREE(entries);
+    IO_FREE(tmp);
+    IO_FREE(key);
+    IO_FREE(field);
+    if (!res && n_runs) {
+        res = csv_sort_merge(csv, &writer, keys, n_keys, runs, n_runs);
+    }
+    for (size_t i = 0; i < n_runs; i++) {
+        fclose(runs[i].handle);
+        IO_FREE(runs[i].entry);
+    }
+    IO_FREE(runs);
+    enum csv_status flushed = CSVWriter_flush(&writer);
+    if (writer.buffer_reclaim) {
+        IO_FREE(writer.buffer);
+    }
+    if (fclose(out) && !res) {
+        res = CSV_FAILURE;
+    }
+    return res ? res : flushed;
+}
+
+#define CSV_GROUP_SLOTS 64
+
+// FNV-1a
+static uint64_t csv_hash(const char * data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (unsigned char) data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// reads the fields of an unprojected record into *buffer, decoding them in place if needed. Field i 
+// starts at offsets[i] and is nul-terminated
+static enum csv_status csv_load_fields(CSVFile * csv, size_t record, char ** buffer, size_t * buffer_size, size_t ** offsets, size_t * n_offsets) {
+    CSVRecord * csvr = csv->records[record];
+    size_t size = csvr->field_pos[csvr->n_fields] - csvr->field_pos[0];
+    bool res = true;
+    if (size + 1 > *buffer_size) {
+        RESIZE_REALLOC(res, char, *buffer, size + 1)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        *buffer_size = size + 1;
+    }
+    if (csvr->n_fields > *n_offsets) {
+        RESIZE_REALLOC(res, size_t, *offsets, csvr->n_fields)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        *n_offsets = csvr->n_fields;
+    }
+    fseek(csv->handle, csvr->field_pos[0], SEEK_SET);
+    if (size && fread(*buffer, sizeof(char), size - 1, csv->handle) != size - 1) {
+        return CSV_READ_ERROR;
+    }
+    bool plain = csv_record_plain(csv, csvr);
+    for (size_t i = 0; i < csvr->n_fields; i++) {
+        (*offsets)[i] = csvr->field_pos[i] - csvr->field_pos[0];
+        size_t field_size = csvr->field_pos[i+1] - csvr->field_pos[i] - 1;
+        if (!plain) {
+            field_size = csv_unquote(&csv->dialect, *buffer + (*offsets)[i], field_size);
+        }
+        (*buffer)[(*offsets)[i] + field_size] = '\0';
+    }
+    return CSV_SUCCESS;
+}
+
+CSVGroupBy * CSVGroupBy_new(size_t * key_columns, size_t n_keys, CSVAggregate * aggregates, size_t n_aggregates) {
+    if (!key_columns || !n_keys || (n_aggregates && !aggregates)) {
+        return NULL;
+    }
+    CSVGroupBy * groups = (CSVGroupBy *) IO_MALLOC(sizeof(CSVGroupBy));
+    if (!groups) {
+        return NULL;
+    }
+    *groups = (CSVGroupBy) {.n_keys = n_keys, .n_aggregates = n_aggregates, .n_slots = CSV_GROUP_SLOTS};
+    groups->key_columns = (size_t *) IO_MALLOC(sizeof(size_t) * n_keys);
+    groups->aggregates = (CSVAggregate *) IO_MALLOC(sizeof(CSVAggregate) * (n_aggregates + 1));
+    groups->slots = (size_t *) IO_MALLOC(sizeof(size_t) * CSV_GROUP_SLOTS);
+    groups->key_offsets = (size_t *) IO_MALLOC(sizeof(size_t));
+    if (!groups->key_columns || !groups->aggregates || !groups->slots || !groups->key_offsets) {
+        CSVGroupBy_del(groups);
+        return NULL;
+    }
+    memcpy(groups->key_columns, key_columns, sizeof(size_t) * n_keys);
+    if (n_aggregates) {
+        memcpy(groups->aggregates, aggregates, sizeof(CSVAggregate) * n_aggregates);
+    }
+    for (size_t i = 0; i < CSV_GROUP_SLOTS; i++) {
+        groups->slots[i] = 0;
+    }
+    groups->key_offsets[0] = 0;
+    return groups;
+}
+
+void CSVGroupBy_del(CSVGroupBy * groups) {
+    if (!groups) {
+        return;
+    }
+    IO_FREE(groups->key_columns);
+    IO_FREE(groups->aggregates);
+    IO_FREE(groups->slots);
+    IO_FREE(groups->hashes);
+    IO_FREE(groups->keys);
+    IO_FREE(groups->key_offsets);
+    IO_FREE(groups->accumulators);
+    IO_FREE(groups->record);
+    IO_FREE(groups->field_offsets);
+    IO_FREE(groups);
+}
 
-    if (mode == CSV_READER || mode == CSV_AMENDER) {
-        CSVFile_read(csv);
+// makes room for size more bytes of encoded keys
+static enum csv_status csv_group_reserve_key(CSVGroupBy * groups, size_t size) {
+    if (groups->keys_size + size <= groups->keys_alloc) {
+        return CSV_SUCCESS;
+    }
+    size_t new_alloc = 2 * groups->keys_alloc > groups->keys_size + size ? 2 * groups->keys_alloc : groups->keys_size + size;
+    bool res = true;
+    RESIZE_REALLOC(res, char, groups->keys, new_alloc)
+    if (!res) {
+        return CSV_MEMORY_ERROR;
     }
+    groups->keys_alloc = new_alloc;
+    return CSV_SUCCESS;
 }
 
-enum csv_status CSVFile_append_record(CSVFile * csv, size_t pos) {
-    if (csv->n_records == csv->n_records_alloc) {
-        int res = true;
-        RESIZE_REALLOC(res, CSVRecord *, csv->records, csv->n_records_alloc * RESIZE_SCALE)
+// doubles the slots once they are half full
+static enum csv_status csv_group_rehash(CSVGroupBy * groups) {
+    size_t n_slots = 2 * groups->n_slots;
+    size_t * slots = (size_t *) IO_MALLOC(sizeof(size_t) * n_slots);
+    if (!slots) {
+        return CSV_MEMORY_ERROR;
+    }
+    for (size_t i = 0; i < n_slots; i++) {
+        slots[i] = 0;
+    }
+    for (size_t group = 0; group < groups->n_groups; group++) {
+        size_t i = groups->hashes[group] & (n_slots - 1);
+        while (slots[i]) {
+            i = (i + 1) & (n_slots - 1);
+        }
+        slots[i] = group + 1;
+    }
+    IO_FREE(groups->slots);
+    groups->slots = slots;
+    groups->n_slots = n_slots;
+    return CSV_SUCCESS;
+}
+
+// finds the group of the key encoded in the size bytes after keys_size, adding the group if it is new
+static enum csv_status csv_group_find(CSVGroupBy * groups, size_t size, size_t * group) {
+    char * key = groups->keys + groups->keys_size;
+    uint64_t hash = csv_hash(key, size);
+    size_t i = hash & (groups->n_slots - 1);
+    for (; groups->slots[i]; i = (i + 1) & (groups->n_slots - 1)) {
+        size_t candidate = groups->slots[i] - 1;
+        size_t offset = groups->key_offsets[candidate];
+        if (groups->hashes[candidate] == hash && groups->key_offsets[candidate+1] - offset == size && !memcmp(groups->keys + offset, key, size)) {
+            *group = candidate;
+            return CSV_SUCCESS;
+        }
+    }
+    if (groups->n_groups == groups->n_groups_alloc) {
+        size_t new_alloc = groups->n_groups_alloc ? 2 * groups->n_groups_alloc : CSV_GROUP_SLOTS;
+        bool res = true;
+        RESIZE_REALLOC(res, uint64_t, groups->hashes, new_alloc)
+        if (res) {
+            RESIZE_REALLOC(res, size_t, groups->key_offsets, new_alloc + 1)
+        }
+        if (res) {
+            RESIZE_REALLOC(res, double, groups->accumulators, 2 * groups->n_aggregates * new_alloc + 1)
+        }
         if (!res) {
             return CSV_MEMORY_ERROR;
         }
-        csv->n_records_alloc *= RESIZE_SCALE;
+        groups->n_groups_alloc = new_alloc;
     }
-    csv->records[csv->n_records] = CSVRecord_new(csv->mode, pos, 0);
-    if (!csv->records[csv->n_records]) {
-        return CSV_MEMORY_ERROR;
+    *group = groups->n_groups++;
+    groups->slots[i] = *group + 1;
+    groups->hashes[*group] = hash;
+    groups->keys_size += size;
+    groups->key_offsets[*group + 1] = groups->keys_size;
+    double * accumulators = groups->accumulators + 2 * groups->n_aggregates * *group;
+    for (size_t j = 0; j < 2 * groups->n_aggregates; j++) {
+        accumulators[j] = 0.0;
+    }
+    if (2 * groups->n_groups > groups->n_slots) {
+        return csv_group_rehash(groups);
     }
-    
-    csv->n_records++;
     return CSV_SUCCESS;
 }
 
-CSVRecord * CSVFile_pop_record(CSVFile * csv) {
-    if (!csv->n_records) {
-        return NULL;
+// folds a value with n numeric fields into the accumulator pair of aggregate
+static void csv_group_accumulate(CSVAggregate * aggregate, double * accumulator, double value, double n) {
+    switch (aggregate->kind) {
+        case CSV_AGGREGATE_MIN: {
+            accumulator[0] = (!accumulator[1] || value < accumulator[0]) ? value : accumulator[0];
+            break;
+        }
+        case CSV_AGGREGATE_MAX: {
+            accumulator[0] = (!accumulator[1] || value > accumulator[0]) ? value : accumulator[0];
+            break;
+        }
+        default: { // COUNT, SUM, MEAN
+            accumulator[0] += value;
+        }
     }
-    CSVRecord * out = csv->records[csv->n_records-1];
-    csv->records[--csv->n_records] = NULL;
-    return out;
+    accumulator[1] += n;
 }
 
-static enum reader_states sm_get_next_state(CSVFile * csv, int state) {
-    int ch = fgetc(csv->handle);
-    switch (state) {
-        case IN_FIELD: {
-            if (ch == ',') {
-                return END_FIELD;
-            } else if (ch == csv->line_ending[0]) {
-                size_t ct = 1;
-                // need to test that the fgetc is not executed when ct == csv->line_ending_size
-                while (ct < csv->line_ending_size && (ch = fgetc(csv->handle)) == csv->line_ending[ct]) {
-                    ct++;
-                }
-                if (ct != csv->line_ending_size) { // failed to find line_ending
-                    fseek(csv->handle, -1, SEEK_CUR); // move back one since we fgetc'd a character that was not a line_ending
-                    return IN_FIELD;
-                }
-                return END_RECORD;
-            } else if (ch == EOF) {
-                return END_CSV;
-            } else if (ch == '"') { // malformed csv
-                #ifndef NDEBUG
-                printf("\nmalformed csv file, double quotes in unquoted string cell at %ld", ftell(csv->handle));
-                #endif
-                return FAILURE;
-            }
-            return IN_FIELD;
-        }
-        case END_FIELD: {
-            if (ch == '"') {
-                return IN_QUOTES;
-            } else if (ch == ',') {
-                return END_FIELD;
-            } else if (ch == csv->line_ending[0]) {
-                size_t ct = 1;
-                // need to test that the fgetc is not executed when ct == csv->line_ending_size
-                while (ct < csv->line_ending_size && (ch = fgetc(csv->handle)) == csv->line_ending[ct]) {
-                    ct++;
-                }
-                if (ct != csv->line_ending_size) { // failed to find line_ending
-                    if (ch == '"') {
-                        return IN_QUOTES;
-                    } else if (ch == ',') {
-                        return END_FIELD;
-                    }
-                    return IN_FIELD;
-                }
-                return END_RECORD;
-            } else if (ch == EOF) {
-                return END_CSV;
-            }
-            return IN_FIELD;
-        }
-        case IN_QUOTES: {
-            if (ch == '"') {
-                return ESCAPING_QUOTES;
-            } else if (ch == EOF) { // malformed csv EOF within field
-                #ifndef NDEBUG
-                printf("\nmalformed csv file, tried to end file within quotes at %ld", ftell(csv->handle));
-                #endif
-                return FAILURE;
-            }
-            return IN_QUOTES;
-        }
-        case ESCAPING_QUOTES: {
-            if (ch == ',') {
-                return END_FIELD;
-            } else if (ch == '"') {
-                return IN_QUOTES;
-            } else if (ch == csv->line_ending[0]) {
-                size_t ct = 1;
-                // need to test that the fgetc is not executed when ct == csv->line_ending_size
-                while (ct < csv->line_ending_size && (ch = fgetc(csv->handle)) == csv->line_ending[ct]) {
-                    ct++;
-                }
-                if (ct != csv->line_ending_size) { // failed to find line_ending, this cannot actually happen in a well-formed csv file
-                    #ifndef NDEBUG
-                    printf("\nmalformed csv file, invalid character outside of field (partial line-ending) at %ld", ftell(csv->handle));
-                    #endif
-                    return FAILURE;
-                }
-                return END_RECORD;
-            } else if (ch == EOF) {
-                return END_CSV;
-            }
-            #ifndef NDEBUG
-            printf("\nmalformed csv file, invalid character after double quotes at %ld", ftell(csv->handle));
-            #endif
-            return FAILURE; // any other condition than the 4 above is a malformed csv
+enum csv_status CSVGroupBy_add(CSVGroupBy * groups, CSVFile * csv) {
+    if (!groups || !csv || csv->mode == CSV_WRITER || csv->projection_map) {
+        return CSV_FAILURE;
+    }
+    enum csv_status res = CSV_SUCCESS;
+    for (size_t irec = csv->has_header; irec < csv->n_records && !res; irec++) {
+        if ((res = csv_load_fields(csv, irec, &groups->record, &groups->record_size, &groups->field_offsets, &groups->n_field_offsets))) {
+            break;
         }
-        case END_RECORD: {
-            if (ch == '"') {
-                return IN_QUOTES;
-            } else if (ch == ',') {
-                return END_FIELD;
-            } else if (ch == EOF) {
-                return END_CSV;
+        size_t n_fields = csv->records[irec]->n_fields;
+        // encode the key after the keys of the existing groups
+        size_t key_size = 0;
+        for (size_t k = 0; k < groups->n_keys && !res; k++) {
+            size_t column = groups->key_columns[k];
+            char * field = column < n_fields ? groups->record + groups->field_offsets[column] : "";
+            size_t size = strlen(field);
+            if (!(res = csv_group_reserve_key(groups, key_size + sizeof(size_t) + size))) {
+                memcpy(groups->keys + groups->keys_size + key_size, &size, sizeof(size_t));
+                memcpy(groups->keys + groups->keys_size + key_size + sizeof(size_t), field, size);
+                key_size += sizeof(size_t) + size;
             }
-            return IN_FIELD; // any other character after these should indicate a new field
         }
-        case END_CSV: {
-            return END_CSV;
+        size_t group = 0;
+        if (res || (res = csv_group_find(groups, key_size, &group))) {
+            break;
         }
-        case UNINITIALIZED: {
-            if (ch == '"') {
-                return IN_QUOTES;
+        double * accumulators = groups->accumulators + 2 * groups->n_aggregates * group;
+        for (size_t a = 0; a < groups->n_aggregates; a++) {
+            size_t column = groups->aggregates[a].column;
+            char * field = column < n_fields ? groups->record + groups->field_offsets[column] : "";
+            if (!*field) {
+                continue;
             }
-            return IN_FIELD;
+            if (groups->aggregates[a].kind == CSV_AGGREGATE_COUNT) {
+                csv_group_accumulate(groups->aggregates + a, accumulators + 2*a, 1.0, 1.0);
+                continue;
+            }
+            char * end = NULL;
+            double value = strtod(field, &end);
+            if (*end == '\0') { // fields that are not numbers are skipped
+                csv_group_accumulate(groups->aggregates + a, accumulators + 2*a, value, 1.0);
+            }
+        }
+    }
+    return res;
+}
+
+enum csv_status CSVGroupBy_merge(CSVGroupBy * groups, CSVGroupBy * other) {
+    if (!groups || !other || groups->n_keys != other->n_keys || groups->n_aggregates != other->n_aggregates) {
+        return CSV_FAILURE;
+    }
+    for (size_t i = 0; i < other->n_groups; i++) {
+        size_t size = other->key_offsets[i+1] - other->key_offsets[i], group = 0;
+        enum csv_status res = csv_group_reserve_key(groups, size);
+        if (res) {
+            return res;
         }
-        case FAILURE: {
-            // fall through
+        memcpy(groups->keys + groups->keys_size, other->keys + other->key_offsets[i], size);
+        if ((res = csv_group_find(groups, size, &group))) {
+            return res;
         }
-        default: {
-            // do nothing, will return failure
+        double * accumulators = groups->accumulators + 2 * groups->n_aggregates * group;
+        double * partial = other->accumulators + 2 * other->n_aggregates * i;
+        for (size_t a = 0; a < groups->n_aggregates; a++) {
+            if (partial[2*a + 1]) {
+                csv_group_accumulate(groups->aggregates + a, accumulators + 2*a, partial[2*a], partial[2*a + 1]);
+            }
         }
     }
-
-    return FAILURE;
+    return CSV_SUCCESS;
 }
 
-enum csv_status CSVFile_read(CSVFile * csv) {
-    //printf("\nreading file %s", csv->filename);
-    enum reader_states state = UNINITIALIZED;
-    int res = CSVFile_append_record(csv, 0);
-    if (res) {
-        return res;
+char * CSVGroupBy_key(CSVGroupBy * groups, size_t group, size_t key, size_t * size) {
+    if (!groups || group >= groups->n_groups || key >= groups->n_keys) {
+        return NULL;
     }
-    while (state != END_CSV) {
-        state = sm_get_next_state(csv, state);
-        switch (state) {
-            case END_FIELD: {
-                // record a new field position
-                // use for CSV_READER only. TODO: make case for CSV_APPENDER
-                //printf("\ncompleted field at %zu", ftell(csv->handle));
-                if ((res = CSVRecord_append_field_pos(csv->records[csv->n_records-1], ftell(csv->handle)))) {
-                    return res;
-                }
-                break;
-            }
-            case END_RECORD: {
-                // end the last field and record a new record
-                //printf("\ncompleted record at %zu", ftell(csv->handle));
-                size_t field_end = ftell(csv->handle) - csv->line_ending_size + 1;
-                // use for CSV_READER only. TODO: make case for CSV_APPENDER
-                if ((res = CSVRecord_append_field_pos(csv->records[csv->n_records-1], field_end))) {
-                    return res;
-                }
-                if ((res = CSVFile_append_record(csv, field_end + csv->line_ending_size - 1))) {
-                    return res;
-                }
-                break;
-            }
-            case END_CSV: {
-                // cleanup records
-                //printf("\ncompleted file at %zu", ftell(csv->handle));
-                size_t loc = ftell(csv->handle);
-                //if (csv->records[csv->n_records-1]->n_fields) { // if csv has single column/field count, this misses last entry if no line-ending
-                if (loc > csv->records[csv->n_records-1]->field_pos[0]) { // add a field if the current cursor is not at the beginning of a record
-                    // final record ended without a line ending. TODO: need to check that this actually includes the last character or if it cuts off the last one
-                    if ((res = CSVRecord_append_field_pos(csv->records[csv->n_records-1], loc + 1))) {
-                        return res;
-                    }
-                } else {
-                    // if last record has zero fields, pop it and destroy. This will happend if final real record ending with a line ending
-                    CSVRecord_del(CSVFile_pop_record(csv));
-                    csv->records[csv->n_records] = NULL;
+    char * encoded = groups->keys + groups->key_offsets[group];
+    for (size_t k = 0; ; k++) {
+        memcpy(size, encoded, sizeof(size_t));
+        if (k == key) {
+            return encoded + sizeof(size_t);
+        }
+        encoded += sizeof(size_t) + *size;
+    }
+}
 
-                    // if mode is reader, try to free extraneous memory
-                }
-                if (csv->mode == CSV_READER) {
-                    RESIZE_REALLOC(res, CSVRecord *, csv->records, csv->n_records)
-                    if (res) {
-                        csv->n_records_alloc = csv->n_records;
-                    }
-                    
-                    for (size_t i = 0; i < csv->n_records; i++) {
-                        // probably should have a function to hide the ->field_pos member
-                        //printf("\nallocation before %zu, number of positions %zu", csv->records[i]->n_fields_alloc+1, csv->records[i]->n_fields+1);
-                        RESIZE_REALLOC(res, size_t, csv->records[i]->field_pos, csv->records[i]->n_fields+1)
-                        if (res) {
-                            csv->records[i]->n_fields_alloc = csv->records[i]->n_fields;
-                            //printf("\nallocation after %zu, number of positions %zu", csv->records[i]->n_fields_alloc+1, csv->records[i]->n_fields+1);
-                        }
-                    }
-                    
-                }
-                break;
-            }
-            case FAILURE: {
-                return CSV_READ_ERROR;
-            }
-            default: {
-                // do nothing
-            }
+double CSVGroupBy_value(CSVGroupBy * groups, size_t group, size_t aggregate) {
+    if (!groups || group >= groups->n_groups || aggregate >= groups->n_aggregates) {
+        return NAN;
+    }
+    double * accumulator = groups->accumulators + 2 * (groups->n_aggregates * group + aggregate);
+    switch (groups->aggregates[aggregate].kind) {
+        case CSV_AGGREGATE_COUNT: // fall through
+        case CSV_AGGREGATE_SUM: {
+            return accumulator[0];
+        }
+        case CSV_AGGREGATE_MEAN: {
+            return accumulator[1] ? accumulator[0] / accumulator[1] : NAN;
+        }
+        default: { // MIN, MAX
+            return accumulator[1] ? accumulator[0] : NAN;
         }
     }
-    /*
-    printf("csv summary:\n");
-    for (size_t irec = 0; irec < csv->n_records; irec++) {
-        printf("record %zu: %zu fields found:\n", irec, csv->records[irec]->n_fields);
-        for (size_t ifie = 0; ifie < csv->records[irec]->n_fields + 1; ifie++) {
-            printf("%zu ", csv->records[irec]->field_pos[ifie]);
+}
+
+#define CSV_JOIN_PARTITIONS 64
+
+// build side record of a join, its key is in the keys of the table
+typedef struct CSVJoinEntry {
+    uint64_t hash;
+    size_t record;
+    size_t key_offset;
+    size_t key_size;
+} CSVJoinEntry;
+
+typedef struct CSVJoin {
+    CSVFile * left;
+    CSVFile * right;
+    CSVJoinCallback callback;
+    void * data;
+    CSVJoinEntry * entries;
+    char * keys;
+    size_t * slots; // open addressing table of entry + 1, 0 if empty
+    char * left_record; // fields of the left and right records being joined
+    char * right_record;
+    size_t * left_offsets;
+    size_t * right_offsets;
+    char ** fields; // row passed to callback
+    size_t * sizes;
+    char * key; // key read for partitioning
+    size_t left_column;
+    size_t right_column;
+    size_t right_width; // fields of the right side of rows without a match
+    size_t n_entries;
+    size_t entries_alloc;
+    size_t keys_size;
+    size_t keys_alloc;
+    size_t n_slots;
+    size_t left_record_size;
+    size_t right_record_size;
+    size_t n_left_offsets;
+    size_t n_right_offsets;
+    size_t n_fields_alloc;
+    size_t key_alloc;
+    enum csv_join_kind kind;
+} CSVJoin;
+
+// reads the decoded field column of record into join->key, empty if the record is short
+static enum csv_status csv_join_key(CSVJoin * join, CSVFile * csv, size_t record, size_t column, size_t * size) {
+    CSVRecord * csvr = csv->records[record];
+    *size = column < csvr->n_fields ? csvr->field_pos[column+1] - csvr->field_pos[column] - 1 : 0;
+    if (*size + 1 > join->key_alloc) {
+        bool res = true;
+        RESIZE_REALLOC(res, char, join->key, *size + 1)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
         }
-        printf("\n");
+        join->key_alloc = *size + 1;
+    }
+    join->key[0] = '\0';
+    if (*size) {
+        csv_read_field(csv, record, csvr->field_pos[column], *size, join->key);
+        *size = strlen(join->key);
     }
-    */
     return CSV_SUCCESS;
 }
 
-int CSVFile_write(CSVFile * csv) {
-    // TODO;
+static enum csv_status csv_join_add(CSVJoin * join, size_t record, const char * key, size_t size) {
+    bool res = true;
+    if (join->n_entries == join->entries_alloc) {
+        size_t new_alloc = join->entries_alloc ? 2 * join->entries_alloc : CSV_JOIN_PARTITIONS;
+        RESIZE_REALLOC(res, CSVJoinEntry, join->entries, new_alloc)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        join->entries_alloc = new_alloc;
+    }
+    if (join->keys_size + size > join->keys_alloc) {
+        size_t new_alloc = 2 * join->keys_alloc > join->keys_size + size ? 2 * join->keys_alloc : join->keys_size + size;
+        RESIZE_REALLOC(res, char, join->keys, new_alloc)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        join->keys_alloc = new_alloc;
+    }
+    memcpy(join->keys + join->keys_size, key, size);
+    join->entries[join->n_entries++] = (CSVJoinEntry) {.hash = csv_hash(key, size), .record = record, .key_offset = join->keys_size, .key_size = size};
+    join->keys_size += size;
     return CSV_SUCCESS;
 }
 
-// for builders
-/*
-int CSVFile_append_record(CSVFile * csv, char ** record, size_t n_fields) {
-    // TODO;
+// builds the hash table of the entries added, equal keys keep their order along the probe sequence
+static enum csv_status csv_join_index(CSVJoin * join) {
+    size_t n_slots = CSV_JOIN_PARTITIONS;
+    while (n_slots < 2 * join->n_entries) {
+        n_slots *= 2;
+    }
+    if (n_slots > join->n_slots) {
+        bool res = true;
+        RESIZE_REALLOC(res, size_t, join->slots, n_slots)
+        if (!res) {
+            return CSV_MEMORY_ERROR;
+        }
+        join->n_slots = n_slots;
+    }
+    for (size_t i = 0; i < join->n_slots; i++) {
+        join->slots[i] = 0;
+    }
+    for (size_t e = 0; e < join->n_entries; e++) {
+        size_t i = join->entries[e].hash & (join->n_slots - 1);
+        while (join->slots[i]) {
+            i = (i + 1) & (join->n_slots - 1);
+        }
+        join->slots[i] = e + 1;
+    }
     return CSV_SUCCESS;
 }
 
-// for builders
-int CSVFile_append_field(CSVFile * csv, size_t record, char * format, ...) {
-    // TODO;
-    return CSV_SUCCESS;
+// passes the loaded left record and the right record (none if right_record is SIZE_MAX) to the callback
+static enum csv_status csv_join_emit(CSVJoin * join, size_t left_record, size_t right_record) {
+    size_t n_left = join->left->records[left_record]->n_fields;
+    size_t n_right = join->right_width;
+    enum csv_status res = CSV_SUCCESS;
+    if (right_record != SIZE_MAX) {
+        n_right = join->right->records[right_record]->n_fields;
+        if ((res = csv_load_fields(join->right, right_record, &join->right_record, &join->right_record_size, &join->right_offsets, &join->n_right_offsets))) {
+            return res;
+        }
+    }
+    if (n_left + n_right > join->n_fields_alloc) {
+        bool ok = true;
+        RESIZE_REALLOC(ok, char *, join->fields, n_left + n_right)
+        if (ok) {
+            RESIZE_REALLOC(ok, size_t, join->sizes, n_left + n_right)
+        }
+        if (!ok) {
+            return CSV_MEMORY_ERROR;
+        }
+        join->n_fields_alloc = n_left + n_right;
+    }
+    for (size_t i = 0; i < n_left; i++) {
+        join->fields[i] = join->left_record + join->left_offsets[i];
+        join->sizes[i] = strlen(join->fields[i]);
+    }
+    for (size_t i = 0; i < n_right; i++) {
+        join->fields[n_left + i] = right_record != SIZE_MAX ? join->right_record + join->right_offsets[i] : "";
+        join->sizes[n_left + i] = strlen(join->fields[n_left + i]);
+    }
+    return join->callback(join->data, join->fields, join->sizes, n_left + n_right);
 }
-*/
 
-enum csv_status CSVFile_set_cell(CSVFile * csv, size_t record, size_t field, char * format, ...) {
-    // TODO;
-    // sprintf into the cell, realloc'ing memory as needed to ensure (record, field) exist or reallocing the existing field
-    return CSV_SUCCESS;
+// joins left record to every entry with an equal key
+static enum csv_status csv_join_probe(CSVJoin * join, size_t record) {
+    enum csv_status res = csv_load_fields(join->left, record, &join->left_record, &join->left_record_size, &join->left_offsets, &join->n_left_offsets);
+    if (res) {
+        return res;
+    }
+    char * key = join->left_column < join->left->records[record]->n_fields ? join->left_record + join->left_offsets[join->left_column] : "";
+    size_t size = strlen(key);
+    uint64_t hash = csv_hash(key, size);
+    bool matched = false;
+    for (size_t i = hash & (join->n_slots - 1); join->slots[i] && !res; i = (i + 1) & (join->n_slots - 1)) {
+        CSVJoinEntry * entry = join->entries + join->slots[i] - 1;
+        if (entry->hash == hash && entry->key_size == size && !memcmp(join->keys + entry->key_offset, key, size)) {
+            matched = true;
+            res = csv_join_emit(join, record, entry->record);
+        }
+    }
+    if (!matched && !res && join->kind == CSV_JOIN_LEFT) {
+        res = csv_join_emit(join, record, SIZE_MAX);
+    }
+    return res;
 }
 
-// returns '\0' for bypass, otherwise returns cand
-// state must be initialized to a negative number
-static char strip_quotes(int * state, char cand) {
-    /*
-    state < 0 // init
-    state = 1 // encountered odd number of double quotes
-    state = 0 // encountered even number of double quotes
-
-    state transition rules:
-    if first character is not a double quote:
-        return the string
-    else:
-        subtract 1
-    when encountering all subsequent double quotes:
-        if state == 0, record the double quote
-        flip the bit on state/set to 1
-    */
-    
-    if (cand == '"') {
-        if (!*state) {
-            *state = 1;
-            return cand;
-        } else {
-            if (*state < 0) {
-                *state = 1;
-            } else {
-                *state ^= 1;
+// joins partition p spilled to build[p] and probe[p]
+static enum csv_status csv_join_partition(CSVJoin * join, FILE * build, FILE * probe) {
+    enum csv_status res = CSV_SUCCESS;
+    size_t header[2]; // record and key size
+    join->n_entries = 0;
+    join->keys_size = 0;
+    rewind(build);
+    while (!res && fread(header, sizeof(size_t), 2, build) == 2) {
+        if (header[1] + 1 > join->key_alloc) {
+            bool ok = true;
+            RESIZE_REALLOC(ok, char, join->key, header[1] + 1)
+            if (!ok) {
+                return CSV_MEMORY_ERROR;
+            }
+            join->key_alloc = header[1] + 1;
+        }
+        if (fread(join->key, sizeof(char), header[1], build) != header[1]) {
+            return CSV_READ_ERROR;
+        }
+        res = csv_join_add(join, header[0], join->key, header[1]);
+    }
+    if (res || (res = csv_join_index(join))) {
+        return res;
+    }
+    rewind(probe);
+    while (!res && fread(header, sizeof(size_t), 1, probe) == 1) {
+        res = csv_join_probe(join, header[0]);
+    }
+    return res;
+}
+
+enum csv_status CSVFile_join(CSVFile * left, size_t left_column, CSVFile * right, size_t right_column, enum csv_join_kind kind, size_t memory_budget, CSVJoinCallback callback, void * data) {
+    if (!left || !right || !callback || left->mode == CSV_WRITER || right->mode == CSV_WRITER || left->projection_map || right->projection_map) {
+        return CSV_FAILURE;
+    }
+    CSVJoin join = {.left = left, .right = right, .callback = callback, .data = data, .left_column = left_column, .right_column = right_column, .kind = kind};
+    join.right_width = right->n_records ? right->records[0]->n_fields : 0;
+    size_t left_first = left->has_header && left->n_records, right_first = right->has_header && right->n_records;
+    enum csv_status res = CSV_SUCCESS;
+    if (left_first) {
+        // a header row joins left's header with right's or with empty fields
+        if (!(res = csv_load_fields(left, 0, &join.left_record, &join.left_record_size, &join.left_offsets, &join.n_left_offsets))) {
+            res = csv_join_emit(&join, 0, right_first ? 0 : SIZE_MAX);
+        }
+    }
+
+    // estimate the table from the raw key sizes, which bound the decoded ones
+    size_t estimate = 0;
+    for (size_t irec = right_first; irec < right->n_records; irec++) {
+        CSVRecord * csvr = right->records[irec];
+        size_t size = right_column < csvr->n_fields ? csvr->field_pos[right_column+1] - csvr->field_pos[right_column] - 1 : 0;
+        estimate += size + sizeof(CSVJoinEntry) + 2 * sizeof(size_t);
+    }
+    size_t n_partitions = 1;
+    if (memory_budget && estimate > memory_budget) {
+        n_partitions = estimate / memory_budget + 1;
+        // partitions above the budget, e.g. from skewed keys, are still joined in memory
+        n_partitions = n_partitions < CSV_JOIN_PARTITIONS ? n_partitions : CSV_JOIN_PARTITIONS;
+    }
+
+    FILE * build[CSV_JOIN_PARTITIONS] = {NULL}, * probe[CSV_JOIN_PARTITIONS] = {NULL};
+    if (n_partitions == 1) {
+        for (size_t irec = right_first; irec < right->n_records && !res; irec++) {
+            size_t size = 0;
+            if (!(res = csv_join_key(&join, right, irec, right_column, &size))) {
+                res = csv_join_add(&join, irec, join.key, size);
+            }
+        }
+        if (!res) {
+            res = csv_join_index(&join);
+        }
+        for (size_t irec = left_first; irec < left->n_records && !res; irec++) {
+            res = csv_join_probe(&join, irec);
+        }
+    } else {
+        for (size_t p = 0; p < n_partitions && !res; p++) {
+            if (!(build[p] = tmpfile()) || !(probe[p] = tmpfile())) {
+                res = CSV_FAILURE;
+            }
+        }
+        for (size_t irec = right_first; irec < right->n_records && !res; irec++) {
+            size_t header[2] = {irec, 0};
+            if ((res = csv_join_key(&join, right, irec, right_column, header + 1))) {
+                break;
+            }
+            FILE * handle = build[(csv_hash(join.key, header[1]) >> 32) % n_partitions];
+            if (fwrite(header, sizeof(size_t), 2, handle) != 2 || fwrite(join.key, sizeof(char), header[1], handle) != header[1]) {
+                res = CSV_FAILURE;
+            }
+        }
+        for (size_t irec = left_first; irec < left->n_records && !res; irec++) {
+            size_t size = 0;
+            if ((res = csv_join_key(&join, left, irec, left_column, &size))) {
+                break;
+            }
+            if (fwrite(&irec, sizeof(size_t), 1, probe[(csv_hash(join.key, size) >> 32) % n_partitions]) != 1) {
+                res = CSV_FAILURE;
             }
-            return '\0';
         }
+        for (size_t p = 0; p < n_partitions && !res; p++) {
+            res = csv_join_partition(&join, build[p], probe[p]);
+        }
+    }
+
+    for (size_t p = 0; p < n_partitions; p++) {
+        if (build[p]) {
+            fclose(build[p]);
+        }
+        if (probe[p]) {
+            fclose(probe[p]);
+        }
+    }
+    IO_FREE(join.entries);
+    IO_FREE(join.keys);
+    IO_FREE(join.slots);
+    IO_FREE(join.left_record);
+    IO_FREE(join.right_record);
+    IO_FREE(join.left_offsets);
+    IO_FREE(join.right_offsets);
+    IO_FREE(join.fields);
+    IO_FREE(join.sizes);
+    IO_FREE(join.key);
+    return res;
+}
+
+enum csv_status CSVWriter_join_callback(void * data, char ** fields, size_t * sizes, size_t n_fields) {
+    CSVWriter * writer = (CSVWriter *) data;
+    CSVWriter_begin_record(writer);
+    for (size_t i = 0; i < n_fields; i++) {
+        CSVWriter_write_field(writer, fields[i], sizes[i]);
     }
-    return cand;
+    return CSVWriter_end_record(writer);
 }
 
 // use sscanf after some minor pre-formatting
@@ -514,28 +3443,29 @@ enum csv_status CSVFile_get_cell(CSVFile * csv, size_t record, size_t field, cha
     // get field at (record, field) by fseek and reading in fgetc until next delimiter in to cell_buffer
     // process by removing extraneous quotes
     // pass to sscanf with format and output values    
-    if (record >= csv->n_records || field >= csv->records[record]->n_fields) {
+    size_t start, size, index;
+    if (csv_field_span(csv, record, field, &start, &size)) {
         return CSV_INDEX_ERROR;
     }
-    size_t start = csv->records[record]->field_pos[field];// + ((field) ? 1 : 0);
-    size_t size = csv->records[record]->field_pos[field+1] - start - 1;
-    
-    fseek(csv->handle, start, SEEK_SET);
-    size_t j = 0;
-    char cand = '\0';
-    int quote_state = -1;
-    for (size_t i = 0; i < size; i++) {
-        cand = strip_quotes(&quote_state, fgetc(csv->handle));
-        if (cand != '\0') {
-            cell_buffer[j++] = cand;
-        }
+    char * value = NULL;
+    enum csv_status status = CSV_SUCCESS;
+    if (csv->n_edits && csv_find_edit(csv, record, field, &index)) { // pending amendment
+        size = csv->edits[index].size < CSV_CELL_BUFFER_SIZE ? csv->edits[index].size : CSV_CELL_BUFFER_SIZE - 1;
+        memcpy(cell_buffer, csv->edits[index].value, size);
+        cell_buffer[size] = '\0';
+        value = cell_buffer;
+    } else if (csv->cache && (status = csv_cache_get(csv, record, field, &value))) {
+        return status;
     }
-    //cell_buffer[size] = '\0';
-    cell_buffer[j] = '\0';
-    //printf("start: %zu, size: %zu: %s\n", start, size, cell_buffer);
+    if (!value) { // not cached, longer cells are truncated as pending edits are
+        size = size < CSV_CELL_BUFFER_SIZE ? size : CSV_CELL_BUFFER_SIZE - 1;
+        csv_read_field(csv, record, start, size, cell_buffer);
+        value = cell_buffer;
+    }
+    //printf("start: %zu, size: %zu: %s\n", start, size, value);
     va_list arg;
     va_start(arg, format);
-    int res = vsscanf(cell_buffer, format, arg);
+    int res = vsscanf(value, format, arg);
     va_end(arg);
     if (res == EOF) {
         return CSV_READ_ERROR;
@@ -544,23 +3474,19 @@ enum csv_status CSVFile_get_cell(CSVFile * csv, size_t record, size_t field, cha
 }
 
 CSVFileIterator * CSVFileIterator_new(CSVFile * csv, size_t index, enum csv_axis axis, size_t buffer_size) {
+    return CSVFileIterator_new_with(NULL, csv, index, axis, buffer_size);
+}
+
+// same as CSVFileIterator_new with the CSVFileIterator and its buffer from allocator
+CSVFileIterator * CSVFileIterator_new_with(Allocator * allocator, CSVFile * csv, size_t index, enum csv_axis axis, size_t buffer_size) {
     if (!csv) {
         return NULL;
     } else if (axis == CSV_ROW && index >= csv->n_records) {
         return NULL;
-    } else if (axis == CSV_COLUMN) {
-        // when I can track the maximum number of fields, simplify this case
-        size_t max_n_fields = 0;
-        for (size_t irec = 0; irec < csv->n_records; irec++) {
-            if (csv->records[irec]->n_fields > max_n_fields) {
-                max_n_fields = csv->records[irec]->n_fields;
-            }
-        }
-        if (index >= max_n_fields) {
-            return NULL;
-        }
+    } else if (axis == CSV_COLUMN && index >= (csv->projection_map ? csv->n_projection : csv->max_n_fields)) {
+        return NULL;
     }
-    CSVFileIterator * csv_iter = (CSVFileIterator *) IO_MALLOC(sizeof(CSVFileIterator));
+    CSVFileIterator * csv_iter = (CSVFileIterator *) io_alloc(allocator, sizeof(CSVFileIterator));
     if (!csv_iter) {
         return NULL;
     }
@@ -569,14 +3495,15 @@ CSVFileIterator * CSVFileIterator_new(CSVFile * csv, size_t index, enum csv_axis
         buffer_size = FIELD_BUFFER_SIZE;
     }
 
-    char * buffer = (char *) IO_MALLOC(sizeof(char)*buffer_size);
+    char * buffer = (char *) io_alloc(allocator, sizeof(char)*buffer_size);
     if (!buffer) {
-        IO_FREE(csv_iter);
+        io_free(allocator, csv_iter);
         return NULL;
     }
 
     CSVFileIterator_init(csv_iter, csv, index, axis, buffer, buffer_size);
     csv_iter->buffer_reclaim = true;
+    csv_iter->allocator = allocator;
 
     return csv_iter;
 }
@@ -593,6 +3520,7 @@ void CSVFileIterator_init(CSVFileIterator * csv_iter, CSVFile * csv, size_t inde
     csv_iter->stop = ITERATOR_GO;
     csv_iter->buffer_size = buffer_size;
     csv_iter->next = NULL;
+    csv_iter->allocator = NULL;
     if (!buffer) {
         if (!buffer_size) {
             buffer_size = FIELD_BUFFER_SIZE;
@@ -607,9 +3535,7 @@ void CSVFileIterator_init(CSVFileIterator * csv_iter, CSVFile * csv, size_t inde
         csv_iter->buffer_reclaim = false;
     }
     csv_iter->next = buffer;
-    for (size_t i = 0; i < csv_iter->buffer_size; i++) {
-        csv_iter->next[i] = '\0';
-    }
+    csv_iter->next[0] = '\0'; // csv_read_field terminates every field
 
     if (axis == CSV_COLUMN) {
         if (csv->has_header) {
@@ -630,9 +3556,9 @@ void CSVFileIterator_init(CSVFileIterator * csv_iter, CSVFile * csv, size_t inde
 }
 
 void CSVFileIterator_del(CSVFileIterator * csv_iter) {
-    IO_FREE(csv_iter->next);
+    io_free(csv_iter->allocator, csv_iter->next);
     csv_iter->next = NULL;
-    IO_FREE(csv_iter);
+    io_free(csv_iter->allocator, csv_iter);
 }
 
 // NULL means failure or stop condition and NOT an empty field
@@ -655,34 +3581,46 @@ char * CSVFileIterator_next(CSVFileIterator * csv_iter) {
         field = csv_iter->axis_index;
     }
     csv_iter->axis_index += csv_iter->step;
-    size_t size = csv_iter->csv->records[record]->field_pos[field+1] - csv_iter->csv->records[record]->field_pos[field] - 1;
+    size_t start, size;
+    if (csv_iter->axis == CSV_COLUMN && csv_iter->csv->rectangular && !csv_iter->csv->projection_map) {
+        // every record has the column, which was validated against max_n_fields on construction
+        size_t * field_pos = csv_iter->csv->records[record]->field_pos + field;
+        start = field_pos[0];
+        size = field_pos[1] - start - 1;
+    } else if (csv_field_span(csv_iter->csv, record, field, &start, &size)) {
+        return NULL;
+    }
 
     // realloc if csv_iter->next is too small to receive the field
-    int res = false;
     if (size + 1 >= csv_iter->buffer_size) {
         size_t new_size = (size + 1 > 2*csv_iter->buffer_size) ? size + 1 : 2*csv_iter->buffer_size;
-        RESIZE_REALLOC(res, char, csv_iter->next, new_size);
-        if (!res) {
+        char * new_buf = (char *) io_realloc(csv_iter->allocator, csv_iter->next, sizeof(char) * new_size);
+        if (!new_buf) {
             return NULL;
         }
+        csv_iter->next = new_buf;
         csv_iter->buffer_size = new_size;
     }
 
     // retrieve the cell
-    res = CSVFile_get_cell(csv_iter->csv, record, field, "%s", csv_iter->next);
-    if (res) {
-        return NULL;
-    }
+    csv_read_field(csv_iter->csv, record, start, size, csv_iter->next);
 
     return csv_iter->next;
 }
 
+size_t CSVFileIterator_length(CSVFileIterator * csv_iter) {
+    if (!csv_iter || csv_iter->stop == ITERATOR_STOP || csv_iter->axis_index >= csv_iter->end) {
+        return 0;
+    }
+    return (csv_iter->end - csv_iter->axis_index + csv_iter->step - 1) / csv_iter->step;
+}
+
 enum iterator_status CSVFileIterator_stop(CSVFileIterator * csv_iter) {
     if (!csv_iter) {
         return ITERATOR_STOP;
     }
     if (csv_iter->stop == ITERATOR_STOP && csv_iter->buffer_reclaim) {
-        IO_FREE(csv_iter->next);
+        io_free(csv_iter->allocator, csv_iter->next);
         csv_iter->next = NULL;
         csv_iter->buffer_reclaim = false;
     }
@@ -696,7 +3634,7 @@ enum iterator_status CSVFileIterator_stop(CSVFileIterator * csv_iter) {
 }
 
 CSVFileIterator * CSVFile_get_column(CSVFile * csv, size_t icolumn) {
-    return CSVFileIterator_new(csv, icolumn, CSV_COLUMN, 0);
+    return CSVFileIterator_new_with(csv->iterator_allocator, csv, icolumn, CSV_COLUMN, 0);
 }
 
 CSVFileIterator * CSVFile_get_column_slice(CSVFile * csv, size_t icolumn, size_t start, size_t stop, size_t step) {
@@ -709,7 +3647,7 @@ CSVFileIterator * CSVFile_get_column_slice(CSVFile * csv, size_t icolumn, size_t
 }
 
 CSVFileIterator *  CSVFile_get_row(CSVFile * csv, size_t irow) {
-    return CSVFileIterator_new(csv, irow, CSV_ROW, 0);
+    return CSVFileIterator_new_with(csv->iterator_allocator, csv, irow, CSV_ROW, 0);
 }
 
 CSVFileIterator * CSVFile_get_row_slice(CSVFile * csv, size_t irow, size_t start, size_t stop, size_t step) {
@@ -732,14 +3670,36 @@ enum iterator_status CSVFileIteratorIterator_stop(CSVFileIteratorIterator * csv_
     return CSVFileIterator_stop(csv_iter);
 }
 
+size_t CSVFileIteratorIterator_length(CSVFileIteratorIterator * csv_iter) {
+    return CSVFileIterator_length(csv_iter);
+}
+
 void CSVFile_del(CSVFile * csv) {
-    fclose(csv->handle);
-    if (csv->file_out) {
+    if (csv->parent) { // row views own only their cache
+        CSVFile_set_cache(csv, 0);
+        IO_FREE(csv);
+        return;
+    }
+    if (csv->handle) { // a failed amend may leave no handle
+        fclose(csv->handle);
+    }
+    if (csv->handle_file_out) { // a failed truncation leaves no handle
         fclose(csv->handle_file_out);
     }
-    for (size_t i = 0; i < csv->n_records; i++) {
-        CSVRecord_del(csv->records[i]);
+    if (cl_frees(csv->allocator) || csv->mode != CSV_READER) { // see csv_clear_index
+        for (size_t i = 0; i < csv->n_records; i++) {
+            csv_record_del(csv->allocator, csv->records[i]);
+        }
     }
     IO_FREE(csv->records);
+    IO_FREE(csv->projection);
+    IO_FREE(csv->projection_map);
+    IO_FREE(csv->filters);
+    IO_FREE(csv->filter_buffer);
+    IO_FREE(csv->n_fields_histogram);
+    csv_clear_edits(csv);
+    IO_FREE(csv->edits);
+    IO_FREE(csv->errors);
+    CSVFile_set_cache(csv, 0);
     IO_FREE(csv);
 }
\ No newline at end of file
@@ -1,5 +1,13 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200809L // nanosleep
+#endif
 #include <stdio.h>
 #include <string.h>
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
 #include "io_ext.h"
 
 // TODO: need to refactor so that TokenIterator->loc points to the start of the next token or 
@@ -171,10 +179,15 @@ enum iterator_status FileLineIterator_stop(FileLineIterator * file_iter) {
 
 // fully qualified LineIterator constructor from file stream and a buffer size
 LineIterator * LineIterator_new(FILE * handle, size_t buffer_size) {
+    return LineIterator_new_with(NULL, handle, buffer_size);
+}
+
+// same as LineIterator_new with the LineIterator and its buffer from allocator
+LineIterator * LineIterator_new_with(Allocator * allocator, FILE * handle, size_t buffer_size) {
     if (!handle) {
         return NULL;
     }
-    LineIterator * lines = (LineIterator *) IO_MALLOC(sizeof(LineIterator));
+    LineIterator * lines = (LineIterator *) io_alloc(allocator, sizeof(LineIterator));
     if (!lines) {
         return NULL;
     }
@@ -183,14 +196,15 @@ LineIterator * LineIterator_new(FILE * handle, size_t buffer_size) {
         buffer_size = LINE_BUFFER_SIZE;
     }
 
-    char * buffer = (char *) IO_MALLOC(sizeof(char) * buffer_size);
+    char * buffer = (char *) io_alloc(allocator, sizeof(char) * buffer_size);
     if (!buffer) {
-        IO_FREE(lines);
+        io_free(allocator, lines);
         return NULL;
     }
 
     LineIterator_init(lines, handle, buffer, buffer_size);
     lines->buffer_reclaim = true;
+    lines->allocator = allocator;
 
     return lines;
 }
@@ -207,6 +221,7 @@ void LineIterator_init(LineIterator * lines, FILE * handle, char * buffer, size_
     if (!lines) {
         return;
     }
+    lines->allocator = NULL;
     if (!handle) {
         lines->handle = NULL;
         lines->stop = ITERATOR_STOP;
@@ -228,10 +243,30 @@ void LineIterator_init(LineIterator * lines, FILE * handle, char * buffer, size_
     lines->handle = handle;
     lines->stop = ITERATOR_GO;
     lines->next = buffer;
-    for (size_t i = 0; i < buffer_size; i++) {
-        lines->next[i] = '\0';
-    }
+    lines->next[0] = '\0'; // fgets terminates every line, so the rest of the buffer is never read
     lines->buffer_size = buffer_size;
+    lines->follow_ms = 0;
+    lines->follow_timeout_ms = 0;
+}
+
+// makes LineIterator_next wait for more lines at the end of the file, polling every poll_ms 
+// milliseconds and stopping after timeout_ms milliseconds without a new line (0 waits forever). 
+// a poll_ms of 0 restores the default behavior of stopping at the end of the file
+void LineIterator_follow(LineIterator * lines, size_t poll_ms, size_t timeout_ms) {
+    if (!lines) {
+        return;
+    }
+    lines->follow_ms = poll_ms;
+    lines->follow_timeout_ms = timeout_ms;
+}
+
+static void line_sleep_ms(size_t ms) {
+#if defined(_WIN32)
+    Sleep((DWORD) ms);
+#else
+    struct timespec req = {.tv_sec = (time_t) (ms / 1000), .tv_nsec = (long) (ms % 1000) * 1000000L};
+    while (nanosleep(&req, &req)) {} // resume if interrupted by a signal
+#endif
 }
 
 // destroys the LineIterator object
@@ -240,11 +275,11 @@ void LineIterator_del(LineIterator * lines) {
         return;
     }
     if (lines->buffer_reclaim) {
-        IO_FREE(lines->next);
+        io_free(lines->allocator, lines->next);
         lines->next = NULL;
         lines->buffer_reclaim = false;
     }
-    IO_FREE(lines);
+    io_free(lines->allocator, lines);
 }
 
 // return pointer to the next line of characters, nul terminated
@@ -265,7 +300,20 @@ char * LineIterator_next(LineIterator * lines) {
 */
     // this is the non-posix version. For posix, use getline() in stdio.h to update LineIterator
     //printf("\nbuffer at %p, status = %s", (void*)lines->next, (lines->stop == ITERATOR_STOP) ? "stopped" : "running");
-    char * test = fgets(lines->next, lines->buffer_size, lines->handle);
+    char * test;
+    for (size_t waited = 0; ; waited += lines->follow_ms) {
+        long pos = ftell(lines->handle);
+        test = fgets(lines->next, lines->buffer_size, lines->handle);
+        if (!lines->follow_ms || !feof(lines->handle) || (lines->follow_timeout_ms && waited >= lines->follow_timeout_ms)) {
+            break;
+        }
+        // following and the line is incomplete: rewind and wait for the writer to finish it
+        clearerr(lines->handle);
+        if (pos < 0 || fseek(lines->handle, pos, SEEK_SET)) {
+            break;
+        }
+        line_sleep_ms(lines->follow_ms);
+    }
     if (!test) { // fgets failed or EOF is encountered immediately
         if (feof(lines->handle)) {
             lines->stop = ITERATOR_STOP;
@@ -295,7 +343,7 @@ char * LineIterator_next(LineIterator * lines) {
         }
 
         // allocate a new buffer
-        char * new_buf = (char *) IO_REALLOC(lines->next, sizeof(char) * new_buf_size);
+        char * new_buf = (char *) io_realloc(lines->allocator, lines->next, sizeof(char) * new_buf_size);
         if (!new_buf) {
             return NULL; // TODO: CONSIDER: how to handle failures to realloc while failing to capture full line...maybe just proceed as normal?
         }
@@ -330,7 +378,7 @@ enum iterator_status LineIterator_stop(LineIterator * lines) {
     }
     if (lines->stop == ITERATOR_STOP && lines->buffer_reclaim) {
         //printf("\nLineIterator stopping...reclaiming buffer");
-        IO_FREE(lines->next);
+        io_free(lines->allocator, lines->next);
         lines->next = NULL;
         lines->buffer_reclaim = false;
     }
@@ -340,10 +388,15 @@ enum iterator_status LineIterator_stop(LineIterator * lines) {
 // fully qualified constructor for TokenIterator object
 // if delimiters is an empty string (strlen(delimiters) == 0) or NULL, uses WHITESPACE delimiters and group is set to true (contiguous whitespace is treated as 1 delimiter)
 TokenIterator * TokenIterator_new(char * string, char * delimiters, size_t buffer_size) {
+    return TokenIterator_new_with(NULL, string, delimiters, buffer_size);
+}
+
+// same as TokenIterator_new with the TokenIterator and its buffer from allocator
+TokenIterator * TokenIterator_new_with(Allocator * allocator, char * string, char * delimiters, size_t buffer_size) {
     if (!string) {
         return NULL;
     }
-    TokenIterator * tokens = (TokenIterator *) IO_MALLOC(sizeof(TokenIterator));
+    TokenIterator * tokens = (TokenIterator *) io_alloc(allocator, sizeof(TokenIterator));
     if (!tokens) {
         return NULL;
     }
@@ -352,14 +405,15 @@ TokenIterator * TokenIterator_new(char * string, char * delimiters, size_t buffe
         buffer_size = TOKEN_BUFFER_SIZE;
     }
 
-    char * buffer = (char *) IO_MALLOC(sizeof(char) * buffer_size);
+    char * buffer = (char *) io_alloc(allocator, sizeof(char) * buffer_size);
     if (!buffer) {
-        IO_FREE(tokens);
+        io_free(allocator, tokens);
         return NULL;
     }
 
     TokenIterator_init(tokens, string, delimiters, buffer, buffer_size);
     tokens->buffer_reclaim = true;
+    tokens->allocator = allocator;
 
     return tokens;
 }
@@ -383,6 +437,7 @@ void TokenIterator_init(TokenIterator * tokens, char * string, char * delimiters
     }
     tokens->string = string;
     tokens->next = NULL;
+    tokens->allocator = NULL;
     if (!buffer) {
         if (!buffer_size) {
             buffer_size = LINE_BUFFER_SIZE;
@@ -404,9 +459,7 @@ void TokenIterator_init(TokenIterator * tokens, char * string, char * delimiters
         tokens->group = true;
         tokens->delimiters = WHITESPACE;
     }
-    for (size_t i = 0; i < buffer_size; i++) {
-        tokens->next[i] = '\0';
-    }
+    tokens->next[0] = '\0'; // TokenIterator_next terminates every token
     tokens->buffer_size = buffer_size;
     tokens->loc = -1;
 
@@ -419,11 +472,11 @@ void TokenIterator_del(TokenIterator * tokens) {
         return;
     }
     if (tokens->buffer_reclaim) {
-        IO_FREE(tokens->next);
+        io_free(tokens->allocator, tokens->next);
         tokens->next = NULL;
         tokens->buffer_reclaim = false;
     }
-    IO_FREE(tokens);
+    io_free(tokens->allocator, tokens);
 }
 
 // return pointer to the next line of characters, nul terminated
@@ -515,7 +568,7 @@ char * TokenIterator_next(TokenIterator * tokens) {
             tokens->stop = ITERATOR_STOP;
             return NULL;
         }
-        char * new_buf = (char *) IO_REALLOC(tokens->next, sizeof(char) * (next_size + 1)); // probably should re-alloc more intelligently to reduce number of allocations
+        char * new_buf = (char *) io_realloc(tokens->allocator, tokens->next, sizeof(char) * (next_size + 1)); // probably should re-alloc more intelligently to reduce number of allocations
         if (!new_buf) {
             return NULL;// TODO: CONSIDER: how to handle failures to realloc while failing to capture full line...maybe just proceed as normal?
         }
@@ -541,7 +594,7 @@ enum iterator_status TokenIterator_stop(TokenIterator * tokens) {
     }
     if (tokens->stop == ITERATOR_STOP && tokens->buffer_reclaim) {
         //printf("\nTokenIterator stopping...reclaiming buffer");
-        IO_FREE(tokens->next);
+        io_free(tokens->allocator, tokens->next);
         tokens->next = NULL;
         tokens->buffer_reclaim = false;
     }
@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <time.h>
+#include "cl_core.h"
+
+// compares for_each over out-of-line and inline array iterators with a raw for loop
+// build with make -f make_bench_array_iterators.mak and run ./bench_array_iterators
+
+#ifndef BENCH_SIZE
+#define BENCH_SIZE 1000000
+#endif // BENCH_SIZE
+
+#ifndef BENCH_REPEATS
+#define BENCH_REPEATS 200
+#endif // BENCH_REPEATS
+
+define_array_iterator_inline(double)
+
+static double elapsed_ns(clock_t start) {
+    return 1e9 * (double) (clock() - start) / CLOCKS_PER_SEC / ((double) BENCH_SIZE * BENCH_REPEATS);
+}
+
+int main() {
+    double * arr = (double *) malloc(sizeof(double) * BENCH_SIZE);
+    if (!arr) {
+        return 1;
+    }
+    for (size_t i = 0; i < BENCH_SIZE; i++) {
+        arr[i] = (double) (i % 1000);
+    }
+    // volatile sums keep the loops from being removed
+    volatile double sums[4] = {0.0};
+    double times[4] = {0.0};
+
+    clock_t start = clock();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) {
+        double sum = 0.0;
+        for (size_t i = 0; i < BENCH_SIZE; i++) {
+            sum += arr[i];
+        }
+        sums[0] += sum;
+    }
+    times[0] = elapsed_ns(start);
+
+    start = clock();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) {
+        double sum = 0.0;
+        for_each(double, v, double, arr, BENCH_SIZE) {
+            sum += *v;
+        }
+        sums[1] += sum;
+    }
+    times[1] = elapsed_ns(start);
+
+    start = clock();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) {
+        double sum = 0.0;
+        for_each(double, v, doubleInline, arr, BENCH_SIZE) {
+            sum += *v;
+        }
+        sums[2] += sum;
+    }
+    times[2] = elapsed_ns(start);
+
+    start = clock();
+    for (size_t r = 0; r < BENCH_REPEATS; r++) {
+        double sum = 0.0;
+        for_each_block(double, block, count, doubleInline, arr, BENCH_SIZE) {
+            for (size_t i = 0; i < count; i++) {
+                sum += block[i];
+            }
+        }
+        sums[3] += sum;
+    }
+    times[3] = elapsed_ns(start);
+
+    char * names[4] = {"raw for loop", "for_each doubleIterator", "for_each doubleInlineIterator", "for_each_block doubleInlineIterator"};
+    int res = 0;
+    for (size_t i = 0; i < 4; i++) {
+        printf("%-40s %8.3f ns/element\n", names[i], times[i]);
+        if (sums[i] != sums[0]) {
+            printf("sum mismatch: %f != %f\n", sums[i], sums[0]);
+            res = 1;
+        }
+    }
+    free(arr);
+    return res;
+}
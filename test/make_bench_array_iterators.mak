@@ -0,0 +1,18 @@
+CC = gcc
+
+EXT = 
+LFLAGS = 
+CFLAGS = -std=c99 -O2 -Wall -pedantic
+IFLAGS = -I../include
+
+ifeq ($(OS),Windows_NT)
+	CFLAGS += -D__USE_MINGW_ANSI_STDIO
+	EXT = .exe
+endif
+
+CFLAGS += -o bench_array_iterators$(EXT)
+
+all: build
+
+build:
+	$(CC) $(CFLAGS) $(IFLAGS) bench_array_iterators.c ../src/cl_iterators.c ../src/cl_utils.c $(LFLAGS)
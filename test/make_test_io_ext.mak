@@ -28,7 +28,7 @@ else
     CFLAGS += -g
     ifeq ($(UNAME_S),Linux)
 		# needed because linux must link to the math
-		LFLAGS += -lm
+		LFLAGS += -lm -lpthread
         #CCFLAGS += -D LINUX
     endif
     #ifeq ($(UNAME_S),Darwin)
@@ -51,4 +51,4 @@ CFLAGS += -o test_io_ext$(EXT)
 all: build
 
 build:
-	$(CC) $(CFLAGS) $(IFLAGS) test_io_ext.c ../src/io_ext.c ../src/csv.c ../src/cl_iterators.c ../src/cl_utils.c $(LFLAGS)
+	$(CC) $(CFLAGS) $(IFLAGS) test_io_ext.c ../src/io_ext.c ../src/csv.c ../src/cl_iterators.c ../src/cl_utils.c ../src/cl_parallel.c ../src/cl_algorithms.c $(LFLAGS)
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 #include "io_ext.h"
 #include "csv.h"
+#include "cl_parallel.h"
+#include "cl_algorithms.h"
 
 /*
 TODO list:
@@ -530,6 +534,609 @@ int test_array_iterators(void) {
     return TEST_SUCCESS;
 }
 
+int test_array_iterator_blocks(void) {
+    printf("test_array_iterator_blocks...");
+    double arr[200];
+    for (size_t i = 0; i < 200; i++) {
+        arr[i] = (double) i;
+    }
+
+    // a step of 1 is a single contiguous block
+    double sum = 0.0;
+    size_t n_blocks = 0;
+    {
+    for_each_block(double, block, count, double, arr, 200) {
+        ASSERT(block == arr && count == 200, "\nfailed to return contiguous block in test_array_iterator_blocks, found %zu elements", count);
+        for (size_t i = 0; i < count; i++) {
+            sum += block[i];
+        }
+        n_blocks++;
+    }
+    }
+    ASSERT(n_blocks == 1 && sum == 199.0 * 200.0 / 2, "\nfailed to sum blocks in test_array_iterator_blocks, found %f in %zu blocks", sum, n_blocks);
+
+    // strided slices are gathered, and match element-wise iteration even after calls to next
+    size_t starts[4] = {0, 199, 3, 150}, ends[4] = {199, 0, 190, 1};
+    long long int steps[4] = {3, -1, 1, -7};
+    for (size_t t = 0; t < 4; t++) {
+        double expected[200], found[200];
+        size_t n_expected = 0, n_found = 0;
+        doubleIterator * elems = double_slice(arr, 200, starts[t], ends[t], steps[t]);
+        for_each(double, v, doubleIterator, elems) {
+            expected[n_expected++] = *v;
+        }
+        doubleIterator_del(elems);
+
+        doubleIterator * blocks = double_slice(arr, 200, starts[t], ends[t], steps[t]);
+        found[n_found++] = *doubleIterator_next(blocks);
+        for_each_block(double, block, count, doubleIterator, blocks) {
+            ASSERT(count && (steps[t] == 1 || count <= ITERATOR_BLOCK_SIZE), "\nfailed to bound block in test_array_iterator_blocks, found %zu elements", count);
+            for (size_t i = 0; i < count; i++) {
+                found[n_found++] = block[i];
+            }
+        }
+        doubleIterator_del(blocks);
+        ASSERT(n_found == n_expected, "\nfailed slice %zu in test_array_iterator_blocks, expected %zu elements, found %zu", t, n_expected, n_found);
+        for (size_t i = 0; i < n_found; i++) {
+            ASSERT(found[i] == expected[i], "\nfailed slice %zu in test_array_iterator_blocks at %zu, expected %f, found %f", t, i, expected[i], found[i]);
+        }
+    }
+
+    // next stops at index 0 like length and next_block when stepping down to the start
+    int ints[20];
+    for (int i = 0; i < 20; i++) {
+        ints[i] = i;
+    }
+    intIterator * down = int_slice(ints, 20, 19, SIZE_MAX, -2);
+    size_t n_down = intIterator_length(down);
+    size_t n_next = 0, n_block = 0;
+    for (int * v = intIterator_next(down); !intIterator_stop(down); v = intIterator_next(down)) {
+        ASSERT(*v == 19 - 2 * (int) n_next, "\nfailed to step down in test_array_iterator_blocks, found %d", *v);
+        n_next++;
+    }
+    intIterator_del(down);
+    down = int_slice(ints, 20, 19, SIZE_MAX, -2);
+    for_each_block(int, block, count, intIterator, down) {
+        for (size_t i = 0; i < count; i++, n_block++) {
+            ASSERT(block[i] == 19 - 2 * (int) n_block, "\nfailed to step down blocks in test_array_iterator_blocks, found %d", block[i]);
+        }
+    }
+    intIterator_del(down);
+    ASSERT(n_down == 10 && n_next == n_down && n_block == n_down, "\nfailed to bound slice in test_array_iterator_blocks, length %zu, next %zu, blocks %zu", n_down, n_next, n_block);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+define_array_iterator_inline(int)
+
+int test_array_iterator_inline(void) {
+    printf("test_array_iterator_inline...");
+    int arr[7] = {-1, 0, 1, 2, 3, 4, 5};
+    int expected[4] = {5, 3, 1, -1};
+    size_t num_found = 0;
+    for_each(int, v, intInline, arr, 7) {
+        ASSERT(*v == arr[num_found], "\nfailed to iterate inline iterator in test_array_iterator_inline, expected %d, found %d", arr[num_found], *v);
+        num_found++;
+    }
+    ASSERT(num_found == 7, "\nfailed to iterate all elements in test_array_iterator_inline, found %zu", num_found);
+
+    num_found = 0;
+    intInlineIterator * ints = intInline_slice(arr, 7, 6, 0, -2);
+    for_each(int, v, intInlineIterator, ints) {
+        ASSERT(*v == expected[num_found], "\nfailed to slice inline iterator in test_array_iterator_inline, expected %d, found %d", expected[num_found], *v);
+        num_found++;
+    }
+    intInlineIterator_del(ints);
+    ASSERT(num_found == 4, "\nfailed to slice all elements in test_array_iterator_inline, found %zu", num_found);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+static void double_in_place(double * elem, void * data) {
+    *elem *= 2;
+}
+
+static bool above_threshold(double * elem, void * data) {
+    return *elem > *(double *) data;
+}
+
+// chunks that wait until each of the n_threads threads of the call holds one, counting the threads that 
+// exit after running one through the destructor of key
+typedef struct PoolProbe {
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;
+    pthread_key_t key;
+    size_t n_threads;
+    size_t n_arrived;
+    size_t n_exited;
+    size_t nested;
+} PoolProbe;
+
+static PoolProbe pool_probe = {.lock = PTHREAD_MUTEX_INITIALIZER, .arrived = PTHREAD_COND_INITIALIZER};
+
+static void pool_probe_exit(void * data) {
+    PoolProbe * probe = (PoolProbe *) data;
+    pthread_mutex_lock(&probe->lock);
+    probe->n_exited++;
+    pthread_mutex_unlock(&probe->lock);
+}
+
+static void pool_probe_count(void * data, size_t chunk, size_t first, size_t count) {
+    *(size_t *) data += count;
+}
+
+static void pool_probe_chunk(void * data, size_t chunk, size_t first, size_t count) {
+    PoolProbe * probe = (PoolProbe *) data;
+    size_t nested = 0;
+    cl_parallel_for(100, 4, 4, pool_probe_count, &nested); // the pool is busy, so this runs here alone
+    pthread_setspecific(probe->key, probe);
+    pthread_mutex_lock(&probe->lock);
+    probe->nested += nested;
+    if (++probe->n_arrived == probe->n_threads) {
+        pthread_cond_broadcast(&probe->arrived);
+    }
+    while (probe->n_arrived < probe->n_threads) {
+        pthread_cond_wait(&probe->arrived, &probe->lock);
+    }
+    pthread_mutex_unlock(&probe->lock);
+}
+
+int test_parallel_for_each(void) {
+    printf("test_parallel_for_each...");
+    size_t num = 10007;
+    double * arr = (double *) malloc(sizeof(double) * num);
+    for (size_t i = 0; i < num; i++) {
+        arr[i] = (double) ((i * 7919) % num);
+    }
+
+    parallel_for_each(double, 4, double_in_place, NULL, arr, num)
+    for (size_t i = 0; i < num; i++) {
+        ASSERT(arr[i] == 2.0 * ((i * 7919) % num), "\nfailed to transform element %zu in test_parallel_for_each, found %f", i, arr[i]);
+    }
+
+    // reductions of a reversed strided slice match a sequential loop for any number of threads
+    double threshold = 5000.0;
+    size_t nthreads[3] = {0, 1, 7};
+    for (size_t t = 0; t < 3; t++) {
+        double expected[4] = {0.0, NAN, NAN, 0.0}, found[4] = {0.0};
+        enum cl_reduction reductions[4] = {CL_REDUCE_SUM, CL_REDUCE_MIN, CL_REDUCE_MAX, CL_REDUCE_COUNT};
+        for (long long int i = num - 2; i >= 0; i -= 3) {
+            if (arr[i] > threshold) {
+                expected[0] += arr[i];
+                expected[1] = isnan(expected[1]) || arr[i] < expected[1] ? arr[i] : expected[1];
+                expected[2] = isnan(expected[2]) || arr[i] > expected[2] ? arr[i] : expected[2];
+                expected[3] += 1.0;
+            }
+        }
+        for (size_t r = 0; r < 4; r++) {
+            doubleIterator * slice = double_slice(arr, num, num - 2, SIZE_MAX, -3);
+            ASSERT(doubleIterator_parallel_reduce(slice, nthreads[t], reductions[r], above_threshold, &threshold, found + r) == ITERATOR_STOP, "\nfailed reduction %zu with %zu threads in test_parallel_for_each", r, nthreads[t]);
+            ASSERT(doubleIterator_stop(slice) == ITERATOR_STOP, "\nfailed to stop iterator in test_parallel_for_each");
+            doubleIterator_del(slice);
+            ASSERT(found[r] == expected[r], "\nfailed reduction %zu with %zu threads in test_parallel_for_each, expected %f, found %f", r, nthreads[t], expected[r], found[r]);
+        }
+    }
+
+    double sum = 0.0;
+    parallel_reduce(double, 3, CL_REDUCE_SUM, sum, arr, 0)
+    ASSERT(sum == 0.0, "\nfailed empty reduction in test_parallel_for_each, found %f", sum);
+    free(arr);
+
+    // the workers outlive each call and exit only when the pool is stopped
+    cl_parallel_stop();
+    pthread_key_create(&pool_probe.key, pool_probe_exit);
+    pool_probe.n_threads = 4;
+    for (size_t call = 0; call < 3; call++) {
+        pool_probe.n_arrived = 0;
+        pool_probe.nested = 0;
+        cl_parallel_for(4, 4, 4, pool_probe_chunk, &pool_probe);
+        ASSERT(pool_probe.n_arrived == 4 && pool_probe.nested == 400, "\nfailed pool call %zu in test_parallel_for_each, found %zu chunks", call, pool_probe.n_arrived);
+    }
+    pthread_setspecific(pool_probe.key, NULL); // the calling thread ran a chunk too
+    ASSERT(!pool_probe.n_exited, "\nfailed to reuse pool workers in test_parallel_for_each, %zu exited", pool_probe.n_exited);
+    cl_parallel_stop();
+    ASSERT(pool_probe.n_exited == 3, "\nfailed to stop pool workers in test_parallel_for_each, %zu exited", pool_probe.n_exited);
+    pthread_key_delete(pool_probe.key);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+static bool is_long_token(void * elem, void * data) {
+    return strlen((char *) elem) > *(size_t *) data;
+}
+
+static void * token_length(void * elem, void * data) {
+    *(size_t *) data = strlen((char *) elem);
+    return data;
+}
+
+int test_iterator_combinators(void) {
+    printf("test_iterator_combinators...");
+    char line[] = "a lazy dog is at the door of my house";
+    size_t min_size = 2, size = 0;
+
+    // tokens -> filter -> map -> take, one token at a time
+    size_t expected[3] = {4, 3, 3}, num_found = 0;
+    char buffer[TOKEN_BUFFER_SIZE];
+    TokenIterator tokens;
+    TokenIterator_init(&tokens, line, NULL, buffer, TOKEN_BUFFER_SIZE);
+    FilterIterator long_tokens;
+    FilterIterator_init(&long_tokens, ITERABLE(Token, &tokens), is_long_token, &min_size);
+    MapIterator lengths;
+    MapIterator_init(&lengths, ITERABLE(Filter, &long_tokens), token_length, &size);
+    for_each(size_t, len, Take, ITERABLE(Map, &lengths), 3) {
+        ASSERT(num_found < 3 && *len == expected[num_found], "\nfailed pipeline element %zu in test_iterator_combinators, found %zu", num_found, *len);
+        num_found++;
+    }
+    ASSERT(num_found == 3, "\nfailed to take 3 elements in test_iterator_combinators, found %zu", num_found);
+    // take did not pull past its last element
+    ASSERT(!strcmp(TokenIterator_next(&tokens), "door"), "\nfailed to leave source after take in test_iterator_combinators");
+
+    // fused form of the same pipeline
+    size_t taken = 0;
+    num_found = 0;
+    for_each(char, tok, Token, line, NULL, buffer, TOKEN_BUFFER_SIZE) then_filter(strlen(tok) > min_size) then_take(taken, 3) then_map(size_t, len, strlen(tok)) {
+        ASSERT(len == expected[num_found], "\nfailed fused element %zu in test_iterator_combinators, found %zu", num_found, len);
+        num_found++;
+    }
+    ASSERT(num_found == 3, "\nfailed to take 3 fused elements in test_iterator_combinators, found %zu", num_found);
+
+    // chain and zip of array iterators
+    int left[3] = {1, 2, 3}, right[2] = {4, 5}, pairs[2] = {10, 20};
+    intIterator left_iter, right_iter, pair_iter;
+    intIterator_init(&left_iter, left, 3);
+    intIterator_init(&right_iter, right, 2);
+    intIterator_init(&pair_iter, pairs, 2);
+    ChainIterator chain;
+    ChainIterator_init(&chain, ITERABLE(int, &left_iter), ITERABLE(int, &right_iter));
+    num_found = 0;
+    for_each(void *, elems, Zip, ITERABLE(Chain, &chain), ITERABLE(int, &pair_iter)) {
+        int first = *(int *) elems[0], second = *(int *) elems[1];
+        ASSERT(first == (int) num_found + 1 && second == pairs[num_found], "\nfailed zip element %zu in test_iterator_combinators, found (%d, %d)", num_found, first, second);
+        num_found++;
+    }
+    ASSERT(num_found == 2, "\nfailed to stop zip at the shorter source in test_iterator_combinators, found %zu", num_found);
+    // zip consumed 3 from the chain before pairs stopped
+    num_found = 0;
+    for_each(int, v, Chain, ITERABLE(int, &left_iter), ITERABLE(int, &right_iter)) {
+        ASSERT(*v == right[num_found], "\nfailed to resume chain in test_iterator_combinators, found %d", *v);
+        num_found++;
+    }
+    ASSERT(num_found == 2, "\nfailed to resume chain in test_iterator_combinators, found %zu elements", num_found);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_array_comprehension(void) {
+    printf("test_array_comprehension...");
+    int arr[5] = {1, -2, 3, -4, 5};
+    array_comprehension(double, squares, (double) *v * *v, int, v, int, arr, 5)
+    ASSERT(squares && squares_size == 5, "\nfailed to collect squares in test_array_comprehension, found %zu", squares_size);
+    for (size_t i = 0; i < squares_size; i++) {
+        ASSERT(squares[i] == arr[i] * arr[i], "\nfailed square %zu in test_array_comprehension, found %f", i, squares[i]);
+    }
+    free(squares);
+
+    intIterator * odds = int_slice(arr, 5, 4, SIZE_MAX, -2);
+    array_comprehension_sized(int, reversed, *v, int, v, intIterator, odds)
+    intIterator_del(odds);
+    ASSERT(reversed && reversed_size == 3 && reversed[0] == 5 && reversed[1] == 3 && reversed[2] == 1, "\nfailed sized comprehension in test_array_comprehension, found %zu elements", reversed_size);
+    free(reversed);
+
+    array_comprehension(int, none, *v, int, v, int, arr, 0)
+    ASSERT(!none && !none_size, "\nfailed empty comprehension in test_array_comprehension");
+
+    // 100 tokens through geometric growth, the strings copied into the block of the pointers
+    char line[400] = {'\0'};
+    for (size_t i = 0; i < 100; i++) {
+        sprintf(line + strlen(line), "%zu ", i);
+    }
+    char buffer[TOKEN_BUFFER_SIZE];
+    TokenIterator tokens;
+    TokenIterator_init(&tokens, line, NULL, buffer, TOKEN_BUFFER_SIZE);
+    size_t num = 0;
+    char ** strings = Iterable_collect_strings(ITERABLE(Token, &tokens), &num);
+    ASSERT(strings && num == 100, "\nfailed to collect strings in test_array_comprehension, found %zu", num);
+    for (size_t i = 0; i < num; i++) {
+        char expected[24];
+        sprintf(expected, "%zu", i);
+        ASSERT(!strcmp(strings[i], expected), "\nfailed string %zu in test_array_comprehension, found %s", i, strings[i]);
+    }
+    free(strings);
+
+    // csv columns report their length
+    char * path = "./data/csvs/test_comprehension.csv";
+    FILE * out = fopen(path, "wb");
+    fputs("id,name\n3,a\n1,b\n2,c\n", out);
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    array_comprehension_sized(int, ids, atoi(cell), char, cell, CSVFile, csv, 0, CSV_COLUMN, NULL, 0)
+    ASSERT(ids && ids_size == 3 && ids[0] == 3 && ids[1] == 1 && ids[2] == 2, "\nfailed to collect column in test_array_comprehension, found %zu", ids_size);
+    free(ids);
+    CSVFileIterator cells;
+    CSVFileIterator_init(&cells, csv, 1, CSV_COLUMN, NULL, 0);
+    strings = Iterable_collect_strings(SIZED_ITERABLE(CSVFile, &cells), &num);
+    ASSERT(strings && num == 3 && !strcmp(strings[2], "c"), "\nfailed to collect column strings in test_array_comprehension, found %zu", num);
+    free(strings);
+    CSVFile_del(csv);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_allocators(void) {
+    printf("test_allocators...");
+    Arena arena;
+    Arena_init(&arena, 256);
+    Allocator * allocator = Arena_allocator(&arena);
+    char * a = (char *) cl_alloc(allocator, 10);
+    strcpy(a, "arena");
+    char * b = (char *) cl_realloc(allocator, a, 100); // latest allocation grows in place
+    ASSERT(b == a && !strcmp(b, "arena"), "\nfailed to grow the latest arena allocation in test_allocators");
+    char * big = (char *) cl_alloc(allocator, 1000); // larger than a block
+    ASSERT(big && !((size_t) big % CL_ALLOC_ALIGNMENT), "\nfailed to allocate past the block size in test_allocators");
+    memset(big, 'x', 1000);
+    ASSERT(!cl_frees(allocator) && !strcmp(b, "arena"), "\nfailed arena in test_allocators");
+    Arena_reset(&arena);
+
+    // iterators made from a pool are recycled
+    int arr[4] = {1, 2, 3, 4};
+    Pool pool;
+    Pool_init(&pool, sizeof(intIterator), 4);
+    intIterator * first = intIterator_new_with(Pool_allocator(&pool), arr, 4);
+    int sum = 0;
+    for_each(int, v, intIterator, first) {
+        sum += *v;
+    }
+    intIterator_del(first);
+    intIterator * second = intIterator_new_with(Pool_allocator(&pool), arr, 4);
+    ASSERT(sum == 10 && second == first, "\nfailed to recycle a pooled iterator in test_allocators, found sum %d", sum);
+    intIterator_del(second);
+    ASSERT(!cl_alloc(Pool_allocator(&pool), sizeof(intIterator) + 1), "\nfailed to reject an oversized pool allocation in test_allocators");
+    Pool_del(&pool);
+
+    // line buffers grow within the arena
+    char * path = "./data/csvs/test_allocators.csv";
+    FILE * out = fopen(path, "wb");
+    fputs("id,name\n", out);
+    for (size_t i = 0; i < 500; i++) {
+        fprintf(out, "%zu,name%zu\n", i, i);
+    }
+    fclose(out);
+    FILE * handle = fopen(path, "rb");
+    LineIterator * lines = LineIterator_new_with(allocator, handle, 4);
+    size_t n_lines = 0;
+    LineIterator_next(lines);
+    while (LineIterator_stop(lines) != ITERATOR_STOP) {
+        n_lines++;
+        LineIterator_next(lines);
+    }
+    LineIterator_del(lines);
+    fclose(handle);
+    ASSERT(n_lines == 501, "\nfailed to read lines from an arena in test_allocators, found %zu", n_lines);
+
+    // the index is released with the arena instead of record by record
+    CSVFile * csv = CSVFile_new_with(allocator, path, CSV_READER, true, "\n", NULL);
+    ASSERT(csv && csv->n_records == 501, "\nfailed to index into an arena in test_allocators");
+    char cell[16];
+    CSVFile_get_cell(csv, 500, 1, "%s", cell);
+    ASSERT(!strcmp(cell, "name499"), "\nfailed to read a cell indexed into an arena in test_allocators, found %s", cell);
+    ASSERT(CSVFile_set_allocator(csv, NULL) == CSV_FAILURE, "\nfailed to reject an allocator after indexing in test_allocators");
+    CSVFile_del(csv);
+    Arena_del(&arena);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_iterator_pools(void) {
+    printf("test_iterator_pools...");
+    PoolSet pools;
+    PoolSet_init(&pools, 0);
+    Allocator * allocator = PoolSet_allocator(&pools);
+
+    // the iterator and buffer deleted in one pass are reused by the next, only the first pass allocates
+    size_t n_tokens = 0;
+    for (size_t i = 0; i < 10; i++) {
+        TokenIterator * tokens = TokenIterator_new_with(allocator, "a bb ccc", NULL, 0);
+        for (char * token = TokenIterator_next(tokens); token; token = TokenIterator_next(tokens)) {
+            n_tokens++;
+        }
+        TokenIterator_del(tokens);
+    }
+    ASSERT(n_tokens == 30 && pools.n_allocs == 20 && pools.n_reuses == 18, "\nfailed to reuse pooled token iterators in test_iterator_pools, found %zu allocations and %zu reuses", pools.n_allocs, pools.n_reuses);
+
+    // a buffer grows within its size class without moving, then moves to a larger class
+    char * buffer = (char *) cl_alloc(allocator, 20);
+    ASSERT(cl_realloc(allocator, buffer, CL_POOL_MIN_SIZE * 2) == buffer, "\nfailed to grow within a size class in test_iterator_pools");
+    strcpy(buffer, "kept");
+    buffer = (char *) cl_realloc(allocator, buffer, 1000);
+    ASSERT(buffer && !strcmp(buffer, "kept"), "\nfailed to move to a larger size class in test_iterator_pools");
+    cl_free(allocator, buffer);
+    buffer = (char *) cl_alloc(allocator, (CL_POOL_MIN_SIZE << CL_POOL_CLASSES) + 1); // larger than any class
+    ASSERT(buffer, "\nfailed to allocate past the largest size class in test_iterator_pools");
+    cl_free(allocator, buffer);
+
+    char * path = "./data/csvs/test_iterator_pools.csv";
+    FILE * out = fopen(path, "wb");
+    fputs("id,name\n", out);
+    for (size_t i = 0; i < 50; i++) {
+        fprintf(out, "%zu,name%zu\n", i, i);
+    }
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    CSVFile_set_iterator_allocator(csv, allocator);
+    size_t n_allocs = pools.n_allocs, n_reuses = pools.n_reuses, n_cells = 0;
+    for (size_t i = 1; i < csv->n_records; i++) {
+        CSVFileIterator * row = CSVFile_get_row(csv, i);
+        while (CSVFileIterator_next(row)) {
+            n_cells++;
+        }
+        CSVFileIterator_stop(row);
+        CSVFileIterator_del(row);
+    }
+    n_allocs = pools.n_allocs - n_allocs;
+    n_reuses = pools.n_reuses - n_reuses;
+    ASSERT(n_cells == 100 && n_allocs == 100 && n_reuses >= n_allocs - 2, "\nfailed to reuse pooled row iterators in test_iterator_pools, found %zu allocations and %zu reuses", n_allocs, n_reuses);
+    CSVFile_del(csv);
+    PoolSet_del(&pools);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_reverse_swap(void) {
+    printf("test_reverse_swap...");
+    size_t sizes[] = {1, 2, 3, 4, 8, 16, 24, 100, 200};
+    unsigned char data[200 * 70], expected[200 * 70];
+    for (size_t isize = 0; isize < sizeof(sizes) / sizeof(sizes[0]); isize++) {
+        size_t size = sizes[isize];
+        // lengths around the 16 byte vectors and the scalar tails on both sides
+        for (size_t num = 1; num <= 70; num++) {
+            for (size_t i = 0; i < size * num; i++) {
+                data[i] = (unsigned char) (i * 7 + 1);
+            }
+            for (size_t i = 0; i < num; i++) {
+                memcpy(expected + i * size, data + (num - 1 - i) * size, size);
+            }
+            ASSERT(cl_reverse(data, data + (num - 1) * size, size) == CL_SUCCESS, "\nfailed to reverse %zu elements of size %zu in test_reverse_swap", num, size);
+            ASSERT(!memcmp(data, expected, size * num), "\nfailed reversal of %zu elements of size %zu in test_reverse_swap", num, size);
+        }
+        memcpy(expected, data + size, size);
+        memcpy(expected + size, data, size);
+        cl_swap(data, data + size, size);
+        ASSERT(!memcmp(data, expected, 2 * size), "\nfailed to swap elements of size %zu in test_reverse_swap", size);
+    }
+    int ints[3] = {1, 2, 3};
+    ASSERT(cl_reverse(ints + 2, ints, sizeof(int)) == CL_FAILURE && ints[0] == 1, "\nfailed to reject a reversed range in test_reverse_swap");
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+define_numeric_compare(int, int)
+define_numeric_compare(double, double)
+
+int test_sort(void) {
+    printf("test_sort...");
+    enum {MAX_SORT = 5000};
+    static int arr[MAX_SORT], expected[MAX_SORT];
+    size_t sizes[] = {0, 1, 2, 3, 17, 100, 1000, MAX_SORT};
+    srand(7);
+    for (size_t isize = 0; isize < sizeof(sizes) / sizeof(sizes[0]); isize++) {
+        size_t num = sizes[isize];
+        // random with many duplicates, ascending, descending and constant arrays
+        for (int kind = 0; kind < 4; kind++) {
+            for (size_t i = 0; i < num; i++) {
+                arr[i] = kind == 0 ? rand() % 50 - 25 : kind == 1 ? (int) i : kind == 2 ? (int) (num - i) : 3;
+            }
+            memcpy(expected, arr, sizeof(int) * num);
+            qsort(expected, num, sizeof(int), compare_(int, int));
+            int_sort(arr, num);
+            ASSERT(!memcmp(arr, expected, sizeof(int) * num), "\nfailed int_sort of %zu elements of kind %d in test_sort", num, kind);
+
+            for (size_t i = 0; i < num; i++) {
+                arr[num - 1 - i] = expected[i] * 40000; // wider than a byte and reversed
+            }
+            int_radix_sort(arr, num);
+            for (size_t i = 0; i < num; i++) {
+                ASSERT(arr[i] == expected[i] * 40000, "\nfailed int_radix_sort of %zu elements of kind %d in test_sort at %zu", num, kind, i);
+            }
+            memcpy(arr, expected, sizeof(int) * num);
+        }
+        for (int value = -27; value <= 27; value++) {
+            size_t index = int_lower_bound(arr, num, value);
+            ASSERT(index <= num && (!index || arr[index-1] < value) && (index == num || arr[index] >= value), "\nfailed int_lower_bound of %d in %zu elements in test_sort, found %zu", value, num, index);
+            int * found = int_bsearch(arr, num, value);
+            ASSERT(found ? *found == value : (index == num || arr[index] != value), "\nfailed int_bsearch of %d in %zu elements in test_sort", value, num);
+        }
+    }
+
+    size_t big[MAX_SORT];
+    for (size_t i = 0; i < MAX_SORT; i++) {
+        big[i] = ((size_t) rand() << 40) ^ (size_t) rand();
+    }
+    size_t_radix_sort(big, MAX_SORT);
+    for (size_t i = 1; i < MAX_SORT; i++) {
+        ASSERT(big[i-1] <= big[i], "\nfailed size_t_radix_sort at %zu in test_sort", i);
+    }
+
+    // nth_element and partition against the sorted random array
+    for (size_t i = 0; i < MAX_SORT; i++) {
+        arr[i] = rand() % 1000;
+    }
+    memcpy(expected, arr, sizeof(arr));
+    int_sort(expected, MAX_SORT);
+    size_t nths[] = {0, 1, 2500, MAX_SORT - 1};
+    for (size_t k = 0; k < 4; k++) {
+        size_t nth = nths[k];
+        int_nth_element(arr, MAX_SORT, nth);
+        ASSERT(arr[nth] == expected[nth], "\nfailed int_nth_element %zu in test_sort, found %d expected %d", nth, arr[nth], expected[nth]);
+        for (size_t i = 0; i < MAX_SORT; i++) {
+            ASSERT(i < nth ? arr[i] <= arr[nth] : arr[i] >= arr[nth], "\nfailed int_nth_element %zu order at %zu in test_sort", nth, i);
+        }
+    }
+    size_t n_less = int_partition(arr, MAX_SORT, 500);
+    ASSERT(n_less == int_lower_bound(expected, MAX_SORT, 500), "\nfailed int_partition count in test_sort, found %zu", n_less);
+    for (size_t i = 0; i < MAX_SORT; i++) {
+        ASSERT(i < n_less ? arr[i] < 500 : arr[i] >= 500, "\nfailed int_partition at %zu in test_sort", i);
+    }
+
+    // slices sort what they will visit and leave the other elements alone
+    int small[9] = {5, 0, 3, 0, 9, 0, 1, 0, 7};
+    intIterator * evens = int_slice(small, 9, 0, 8, 2);
+    ASSERT(intIterator_sort(evens) == CL_SUCCESS, "\nfailed intIterator_sort in test_sort");
+    int last = 0;
+    for_each(int, v, intIterator, evens) {
+        ASSERT(*v >= last, "\nfailed to visit a sorted slice in test_sort, found %d after %d", *v, last);
+        last = *v;
+    }
+    intIterator_del(evens);
+    ASSERT(small[0] == 1 && small[8] == 9 && small[1] == 0 && small[7] == 0, "\nfailed strided intIterator_sort in test_sort");
+    intIterator * backwards = int_slice(small, 9, 8, SIZE_MAX, -1);
+    intIterator_sort(backwards);
+    intIterator_del(backwards);
+    ASSERT(small[8] == 0 && small[0] == 9, "\nfailed reversed intIterator_sort in test_sort, found %d and %d", small[8], small[0]);
+
+    // a column collected from a csv
+    char * path = "./data/csvs/test_sort.csv";
+    FILE * out = fopen(path, "wb");
+    fputs("value\n", out);
+    for (size_t i = 0; i < 200; i++) {
+        fprintf(out, "%.2f\n", (double) (rand() % 10000) / 100.0);
+    }
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    array_comprehension_sized(double, values, atof(cell), char, cell, CSVFile, csv, 0, CSV_COLUMN, NULL, 0)
+    CSVFile_del(csv);
+    remove(path);
+    double sorted[200];
+    memcpy(sorted, values, sizeof(sorted));
+    qsort(sorted, 200, sizeof(double), compare_(double, double));
+    double_sort(values, values_size);
+    ASSERT(values_size == 200 && !memcmp(values, sorted, sizeof(sorted)), "\nfailed double_sort of a csv column in test_sort");
+    free(values);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
 int test_csv_reader(void) {
     printf("test_csv_reader...");
     CSVFile * csv;
@@ -703,6 +1310,784 @@ int test_csv_reader(void) {
     return TEST_SUCCESS;
 }
 
+int test_csv_projection(void) {
+    printf("test_csv_projection...");
+    char * names[2] = {"header", "this"};
+    size_t columns[2] = {2, 0};
+    int found = 0;
+
+    CSVFile * csv = CSVFile_open("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    ASSERT(!CSVFile_set_projection_names(csv, names, 2), "\nfailed to set projection names in test_csv_projection");
+    ASSERT(!CSVFile_read(csv), "\nfailed to read projected csv in test_csv_projection");
+    ASSERT(csv->n_records == 5, "\nfailed to find all records in projected csv in test_csv_projection, expected: 5, found: %zu", csv->n_records);
+    ASSERT(csv->records[2]->n_fields == 2, "\nfailed to project fields in test_csv_projection, expected: 2, found: %zu", csv->records[2]->n_fields);
+    CSVFile_get_cell(csv, 2, 0, "%d", &found);
+    ASSERT(found == 8, "\nfailed to find projected field by name in test_csv_projection, expected: 8, found %d", found);
+    CSVFile_get_cell(csv, 4, 1, "%d", &found);
+    ASSERT(found == 13, "\nfailed to find projected field by name in test_csv_projection, expected: 13, found %d", found);
+    ASSERT(CSVFile_get_cell(csv, 4, 2, "%d", &found) == CSV_INDEX_ERROR, "\nfailed to reject unprojected field in test_csv_projection");
+    CSVFile_del(csv);
+
+    csv = CSVFile_open("./data/csvs/2x3_missingfield.csv", CSV_READER, false, NULL, NULL);
+    ASSERT(!CSVFile_set_projection(csv, columns, 2), "\nfailed to set projection in test_csv_projection");
+    ASSERT(!CSVFile_read(csv), "\nfailed to read projected csv in test_csv_projection");
+    ASSERT(CSVFile_get_cell(csv, 0, 0, "%d", &found) == CSV_INDEX_ERROR, "\nfailed to find missing projected field in ragged record in test_csv_projection");
+    CSVFile_get_cell(csv, 0, 1, "%d", &found);
+    ASSERT(found == 1, "\nfailed to find projected field in test_csv_projection, expected: 1, found %d", found);
+    CSVFile_get_cell(csv, 1, 0, "%d", &found);
+    ASSERT(found == 5, "\nfailed to find projected field in test_csv_projection, expected: 5, found %d", found);
+    CSVFile_del(csv);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+static bool is_odd(char * field, size_t size, void * data) {
+    int value = 0;
+    sscanf(field, "%d", &value);
+    *(size_t *) data += 1;
+    return value % 2;
+}
+
+int test_csv_filters(void) {
+    printf("test_csv_filters...");
+    char * set[2] = {"4", "12"};
+    size_t n_calls = 0;
+    int found = 0;
+
+    CSVFile * csv = CSVFile_open("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    ASSERT(!CSVFile_filter_range(csv, 0, 5, 10), "\nfailed to add range filter in test_csv_filters");
+    ASSERT(!CSVFile_read(csv), "\nfailed to read filtered csv in test_csv_filters");
+    ASSERT(csv->n_records == 3 && csv->n_filtered == 2, "\nfailed to filter range in test_csv_filters, expected: 3 records, found: %zu", csv->n_records);
+    CSVFile_get_cell(csv, 2, 3, "%d", &found);
+    ASSERT(found == 12, "\nfailed to find filtered record in test_csv_filters, expected: 12, found %d", found);
+    CSVFile_del(csv);
+
+    csv = CSVFile_open("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    CSVFile_filter_equals(csv, 1, "6");
+    CSVFile_read(csv);
+    ASSERT(csv->n_records == 2, "\nfailed to filter quoted equality in test_csv_filters, expected: 2 records, found: %zu", csv->n_records);
+    CSVFile_get_cell(csv, 1, 0, "%d", &found);
+    ASSERT(found == 5, "\nfailed to find filtered record in test_csv_filters, expected: 5, found %d", found);
+    CSVFile_del(csv);
+
+    csv = CSVFile_open("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    CSVFile_filter_in_set(csv, 3, set, 2);
+    CSVFile_filter_callback(csv, 0, is_odd, &n_calls);
+    CSVFile_read(csv);
+    ASSERT(csv->n_records == 3, "\nfailed to filter set and callback in test_csv_filters, expected: 3 records, found: %zu", csv->n_records);
+    ASSERT(n_calls == 2, "\nfailed to short-circuit filters in test_csv_filters, expected: 2 calls, found: %zu", n_calls);
+    CSVFile_get_cell(csv, 2, 0, "%d", &found);
+    ASSERT(found == 9, "\nfailed to find filtered record in test_csv_filters, expected: 9, found %d", found);
+    CSVFile_del(csv);
+
+    csv = CSVFile_open("./data/csvs/string_data.csv", CSV_READER, false, NULL, NULL);
+    CSVFile_filter_prefix(csv, 2, "this has");
+    CSVFile_read(csv);
+    ASSERT(csv->n_records == 1, "\nfailed to filter prefix in test_csv_filters, expected: 1 record, found: %zu", csv->n_records);
+    CSVFile_del(csv);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_field_counts(void) {
+    printf("test_csv_field_counts...");
+    CSVFile * csv = CSVFile_new("./data/csvs/2x3_danglingcomma.csv", CSV_READER, false, NULL, NULL);
+    ASSERT(csv->max_n_fields == 4 && csv->min_n_fields == 3 && !csv->rectangular, "\nfailed to count ragged fields in test_csv_field_counts, found max: %zu, min: %zu", csv->max_n_fields, csv->min_n_fields);
+    ASSERT(csv->n_fields_histogram[3] == 1 && csv->n_fields_histogram[4] == 1, "\nfailed to build field count histogram in test_csv_field_counts");
+    ASSERT(!CSVFile_get_column(csv, 4), "\nfailed to reject column beyond max field count in test_csv_field_counts");
+    CSVFile_del(csv);
+
+    csv = CSVFile_new("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    ASSERT(csv->max_n_fields == 4 && csv->min_n_fields == 4 && csv->rectangular, "\nfailed to count rectangular fields in test_csv_field_counts, found max: %zu, min: %zu", csv->max_n_fields, csv->min_n_fields);
+    ASSERT(csv->n_fields_histogram[4] == 5, "\nfailed to build field count histogram in test_csv_field_counts");
+    CSVFile_del(csv);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_writer(void) {
+    printf("test_csv_writer...");
+    char * out_path = "./data/csvs/test_write_output.csv";
+    char * expected[2][3] = {
+                            {"plain", "has, comma", "has \"quotes\""},
+                            {"has\r\nline ending", "", "12"}
+                            };
+
+    CSVFile * csv = CSVFile_new(out_path, CSV_WRITER, false, NULL, NULL);
+    ASSERT(csv, "\nfailed to open csv for writing in test_csv_writer");
+    ASSERT(!CSVFile_set_cell(csv, 0, 0, "%s", expected[0][0]), "\nfailed to set cell in test_csv_writer");
+    CSVFile_set_cell(csv, 0, 1, "%s", expected[0][1]);
+    CSVFile_set_cell(csv, 0, 2, "%s", expected[0][2]);
+    CSVFile_set_cell(csv, 1, 0, "%s", expected[1][0]);
+    CSVFile_set_cell(csv, 1, 2, "%d", 12);
+    ASSERT(!CSVFile_write(csv), "\nfailed to write csv in test_csv_writer");
+    CSVFile_del(csv);
+
+    csv = CSVFile_new(out_path, CSV_READER, false, NULL, NULL);
+    ASSERT(csv->n_records == 2 && csv->rectangular && csv->max_n_fields == 3, "\nfailed to write non-ragged records in test_csv_writer, found %zu records", csv->n_records);
+    for (size_t irec = 0; irec < 2; irec++) {
+        size_t ifie = 0;
+        CSVFileIterator * fields = CSVFile_get_row(csv, irec);
+        for (char * found = CSVFileIterator_next(fields); CSVFileIterator_stop(fields) != ITERATOR_STOP; found = CSVFileIterator_next(fields)) {
+            ASSERT(!strcmp(found, expected[irec][ifie]), "\nfailed to read back written field in test_csv_writer at (%zu, %zu), expected: %s, found: %s", irec, ifie, expected[irec][ifie], found);
+            ifie++;
+        }
+        ASSERT(ifie == 3, "\nfailed to read back all written fields in test_csv_writer, found %zu", ifie);
+        CSVFileIterator_del(fields);
+    }
+    CSVFile_del(csv);
+    remove(out_path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_stream_writer(void) {
+    printf("test_csv_stream_writer...");
+    char * out_path = "./data/csvs/test_stream_output.csv";
+    enum {n_records = 100};
+    FILE * handle = fopen(out_path, "wb");
+    // small threshold to force flushes
+    CSVWriter * writer = CSVWriter_new(handle, NULL, 64);
+    ASSERT(writer, "\nfailed to create CSVWriter in test_csv_stream_writer");
+    for (int64_t i = 0; i < n_records; i++) {
+        CSVWriter_begin_record(writer);
+        CSVWriter_write_field_int64(writer, -i);
+        CSVWriter_write_field_double(writer, i + 0.25);
+        CSVWriter_write_field(writer, "x,\"y\"", 3); // only part of the string
+        ASSERT(!CSVWriter_end_record(writer), "\nfailed to write record %lld in test_csv_stream_writer", (long long) i);
+        ASSERT(writer->size <= writer->buffer_size, "\nfailed to bound the buffer in test_csv_stream_writer");
+    }
+    ASSERT(!CSVWriter_del(writer), "\nfailed to flush CSVWriter in test_csv_stream_writer");
+    fclose(handle);
+
+    CSVFile * csv = CSVFile_new(out_path, CSV_READER, false, NULL, NULL);
+    ASSERT(csv->n_records == n_records && csv->rectangular && csv->max_n_fields == 3, "\nfailed to read back streamed records in test_csv_stream_writer, found %zu", csv->n_records);
+    int ival = 0;
+    double dval = 0;
+    char sval[8] = {'\0'};
+    CSVFile_get_cell(csv, 42, 0, "%d", &ival);
+    CSVFile_get_cell(csv, 42, 1, "%lf", &dval);
+    CSVFile_get_cell(csv, 42, 2, "%7s", sval);
+    ASSERT(ival == -42 && dval == 42.25 && !strcmp(sval, "x,\""), "\nfailed to read back streamed fields in test_csv_stream_writer, found %d, %f, %s", ival, dval, sval);
+    CSVFile_del(csv);
+    remove(out_path);
+
+    // a caller buffer of size 0 is replaced by a default one instead of being written past
+    handle = fopen(out_path, "wb");
+    char empty[1];
+    CSVWriter stack_writer;
+    CSVWriter_init(&stack_writer, handle, "\n", empty, 0);
+    ASSERT(stack_writer.buffer != empty && stack_writer.buffer_size == CSV_WRITE_BUFFER_SIZE, "\nfailed to replace an empty buffer in test_csv_stream_writer");
+    CSVWriter_begin_record(&stack_writer);
+    CSVWriter_write_field(&stack_writer, "a", 1);
+    ASSERT(!CSVWriter_end_record(&stack_writer) && !CSVWriter_flush(&stack_writer) && stack_writer.size == 0, "\nfailed to write through a replaced buffer in test_csv_stream_writer");
+    IO_FREE(stack_writer.buffer);
+    fclose(handle);
+    remove(out_path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+// copies the file at src to dest
+static void copy_file(const char * src, const char * dest) {
+    FILE * in = fopen(src, "rb");
+    FILE * out = fopen(dest, "wb");
+    int ch;
+    while ((ch = fgetc(in)) != EOF) {
+        fputc(ch, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+int test_csv_amender(void) {
+    printf("test_csv_amender...");
+    char * amend_path = "./data/csvs/test_amend.csv";
+    char * out_path = "./data/csvs/test_amend_output.csv";
+    char found[32] = {'\0'};
+    int ival = 0;
+
+    // same width edits are patched in place
+    copy_file("./data/csvs/header.csv", amend_path);
+    CSVFile * csv = CSVFile_new(amend_path, CSV_AMENDER, true, NULL, NULL);
+    ASSERT(!CSVFile_set_cell(csv, 1, 1, "%d", 9), "\nfailed to set cell in test_csv_amender");
+    ASSERT(!CSVFile_set_cell(csv, 3, 1, "%d", 42), "\nfailed to set cell in test_csv_amender");
+    ASSERT(CSVFile_set_cell(csv, 9, 1, "%d", 42) == CSV_INDEX_ERROR, "\nfailed to reject missing cell in test_csv_amender");
+    CSVFile_get_cell(csv, 1, 1, "%d", &ival);
+    ASSERT(ival == 9, "\nfailed to read pending edit in test_csv_amender, found %d", ival);
+    ASSERT(!CSVFile_write(csv), "\nfailed to patch in place in test_csv_amender");
+    CSVFile_del(csv);
+    csv = CSVFile_new(amend_path, CSV_READER, true, NULL, NULL);
+    CSVFile_get_cell(csv, 1, 1, "%d", &ival);
+    ASSERT(ival == 9, "\nfailed to patch cell in place in test_csv_amender, found %d", ival);
+    CSVFile_get_cell(csv, 2, 1, "%d", &ival);
+    ASSERT(ival == 6, "\nfailed to leave quoted cell untouched in test_csv_amender, found %d", ival);
+    CSVFile_get_cell(csv, 3, 1, "%d", &ival);
+    ASSERT(ival == 42, "\nfailed to patch cell in place in test_csv_amender, found %d", ival);
+    CSVFile_del(csv);
+
+    // wider edits rewrite the file and re-index it
+    csv = CSVFile_new(amend_path, CSV_AMENDER, true, NULL, NULL);
+    CSVFile_set_cell(csv, 1, 0, "%s", "one, uno");
+    CSVFile_set_cell(csv, 4, 3, "%d", 1600);
+    ASSERT(!CSVFile_write(csv), "\nfailed to rewrite in test_csv_amender");
+    ASSERT(csv->n_records == 5, "\nfailed to re-index rewritten file in test_csv_amender, found %zu", csv->n_records);
+    CSVFile_get_cell(csv, 1, 0, "%[^\n]", found);
+    ASSERT(!strcmp(found, "one, uno"), "\nfailed to rewrite cell in test_csv_amender, found %s", found);
+    CSVFile_get_cell(csv, 4, 3, "%d", &ival);
+    ASSERT(ival == 1600, "\nfailed to rewrite cell in test_csv_amender, found %d", ival);
+    CSVFile_get_cell(csv, 4, 2, "%d", &ival);
+    ASSERT(ival == 15, "\nfailed to copy unedited cell in test_csv_amender, found %d", ival);
+    CSVFile_del(csv);
+
+    // edits go to file_out and the source is untouched
+    csv = CSVFile_new(amend_path, CSV_AMENDER, true, NULL, out_path);
+    CSVFile_set_cell(csv, 0, 0, "%s", "that");
+    ASSERT(!CSVFile_write(csv), "\nfailed to write amended copy in test_csv_amender");
+    CSVFile_del(csv);
+    csv = CSVFile_new(out_path, CSV_READER, true, NULL, NULL);
+    CSVFile_get_cell(csv, 0, 0, "%s", found);
+    ASSERT(!strcmp(found, "that") && csv->n_records == 5, "\nfailed to write amended copy in test_csv_amender, found %s", found);
+    CSVFile_del(csv);
+    csv = CSVFile_new(amend_path, CSV_READER, true, NULL, NULL);
+    CSVFile_get_cell(csv, 0, 0, "%s", found);
+    ASSERT(!strcmp(found, "this"), "\nfailed to leave source untouched in test_csv_amender, found %s", found);
+    CSVFile_del(csv);
+
+    // file_out is rewritten with all edits on every write, and is a copy without edits
+    char contents[64] = {'\0'};
+    FILE * in = fopen(amend_path, "wb");
+    fputs("a,b\n1,2\n", in);
+    fclose(in);
+    csv = CSVFile_new(amend_path, CSV_AMENDER, false, "\n", out_path);
+    ASSERT(!CSVFile_write(csv), "\nfailed to write unedited copy in test_csv_amender");
+    in = fopen(out_path, "rb");
+    contents[fread(contents, sizeof(char), sizeof(contents) - 1, in)] = '\0';
+    fclose(in);
+    ASSERT(!strcmp(contents, "a,b\n1,2\n"), "\nfailed to copy unedited file in test_csv_amender, found %s", contents);
+    CSVFile_set_cell(csv, 1, 0, "%d", 7);
+    ASSERT(!CSVFile_write(csv), "\nfailed to write first edit in test_csv_amender");
+    CSVFile_set_cell(csv, 1, 1, "%d", 8);
+    ASSERT(!CSVFile_write(csv), "\nfailed to write second edit in test_csv_amender");
+    CSVFile_del(csv);
+    in = fopen(out_path, "rb");
+    contents[fread(contents, sizeof(char), sizeof(contents) - 1, in)] = '\0';
+    fclose(in);
+    ASSERT(!strcmp(contents, "a,b\n7,8\n"), "\nfailed to rewrite amended copy in test_csv_amender, found %s", contents);
+
+    remove(amend_path);
+    remove(out_path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_refresh(void) {
+    printf("test_csv_refresh...");
+    char * path = "./data/csvs/test_refresh.csv";
+    char line[32] = {'\0'};
+    int ival = 0;
+
+    FILE * out = fopen(path, "wb");
+    fputs("1,2\n3,4", out); // final record still being written
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, false, "\n", NULL);
+    ASSERT(csv->n_records == 2, "\nfailed to index partial file in test_csv_refresh, found %zu", csv->n_records);
+    ASSERT(!CSVFile_refresh(csv) && csv->n_records == 2, "\nfailed to refresh unchanged file in test_csv_refresh");
+
+    out = fopen(path, "ab");
+    fputs("5\n6,7\n", out);
+    fclose(out);
+    ASSERT(!CSVFile_refresh(csv), "\nfailed to refresh in test_csv_refresh");
+    ASSERT(csv->n_records == 3, "\nfailed to index appended records in test_csv_refresh, found %zu", csv->n_records);
+    CSVFile_get_cell(csv, 1, 1, "%d", &ival);
+    ASSERT(ival == 45, "\nfailed to complete partial record in test_csv_refresh, found %d", ival);
+    CSVFile_get_cell(csv, 2, 1, "%d", &ival);
+    ASSERT(ival == 7, "\nfailed to read appended record in test_csv_refresh, found %d", ival);
+    ASSERT(csv->rectangular && csv->max_n_fields == 2, "\nfailed to update field counts in test_csv_refresh");
+    CSVFile_del(csv);
+
+    // a followed LineIterator waits for the partial line to complete, then stops on timeout
+    FILE * in = fopen(path, "rb");
+    LineIterator * lines = LineIterator_new(in, 32);
+    LineIterator_follow(lines, 1, 5);
+    size_t n_lines = 0;
+    for (char * next = LineIterator_next(lines); next; next = LineIterator_next(lines)) {
+        n_lines++;
+        if (n_lines == 3) {
+            out = fopen(path, "ab");
+            fputs("8,", out);
+            fclose(out);
+        }
+        strcpy(line, next);
+    }
+    ASSERT(n_lines == 4 && !strcmp(line, "8,"), "\nfailed to follow file in test_csv_refresh, found %zu lines", n_lines);
+    LineIterator_del(lines);
+    fclose(in);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_dialects(void) {
+    printf("test_csv_dialects...");
+    char * path = "./data/csvs/test_dialect.csv";
+    char found[32] = {'\0'};
+    int ival = 0;
+
+    // tab delimited with quoted tabs uses a dedicated scanner
+    FILE * out = fopen(path, "wb");
+    fputs("a\tb c\t\"x\ty\"\n1\t2\t3\n", out);
+    fclose(out);
+    CSVFile * csv = CSVFile_open(path, CSV_READER, false, "\n", NULL);
+    ASSERT(!CSVFile_set_dialect(csv, CSV_DIALECT_TSV), "\nfailed to set tsv dialect in test_csv_dialects");
+    ASSERT(!CSVFile_read(csv) && csv->n_records == 2 && csv->rectangular && csv->max_n_fields == 3, "\nfailed to read tsv in test_csv_dialects");
+    CSVFile_get_cell(csv, 0, 2, "%[^\n]", found);
+    ASSERT(!strcmp(found, "x\ty"), "\nfailed to read quoted tab in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 0, 1, "%[^\n]", found);
+    ASSERT(!strcmp(found, "b c"), "\nfailed to read tsv field in test_csv_dialects, found %s", found);
+    CSVFile_del(csv);
+
+    // comments, escapes, custom quotes and trimming use the general scanner
+    out = fopen(path, "wb");
+    fputs("# comment\n a ; ' b;c ' ; d\\;e \n# another\n1;'2'' ';3\n# trailing", out);
+    fclose(out);
+    csv = CSVFile_open(path, CSV_READER, false, "\n", NULL);
+    ASSERT(CSVFile_set_dialect(csv, (CSVDialect) {.delimiter = ';', .quote = ';'}), "\nfailed to reject ambiguous dialect in test_csv_dialects");
+    ASSERT(!CSVFile_set_dialect(csv, (CSVDialect) {.delimiter = ';', .quote = '\'', .escape = '\\', .comment = '#', .trim = true}), "\nfailed to set dialect in test_csv_dialects");
+    ASSERT(!CSVFile_read(csv), "\nfailed to read dialect in test_csv_dialects");
+    ASSERT(csv->n_records == 2 && csv->rectangular && csv->max_n_fields == 3, "\nfailed to skip comments in test_csv_dialects, found %zu records", csv->n_records);
+    CSVFile_get_cell(csv, 0, 0, "%[^\n]", found);
+    ASSERT(!strcmp(found, "a"), "\nfailed to trim field in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 0, 1, "%[^\n]", found);
+    ASSERT(!strcmp(found, " b;c "), "\nfailed to read quoted field in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 0, 2, "%[^\n]", found);
+    ASSERT(!strcmp(found, "d;e"), "\nfailed to unescape field in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 1, 1, "%[^\n]", found);
+    ASSERT(!strcmp(found, "2' "), "\nfailed to read doubled quote in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 1, 2, "%d", &ival);
+    ASSERT(ival == 3, "\nfailed to read field before trailing comment in test_csv_dialects, found %d", ival);
+    CSVFile_del(csv);
+
+    // a line ending split between chunks of the scanner, a quoted field across the next chunk boundary 
+    // and cells longer than the cell buffer, which are truncated
+    size_t long_size = 65535;
+    out = fopen(path, "wb");
+    for (size_t i = 0; i < long_size; i++) {
+        fputc('a', out);
+    }
+    fputs("\r\nb,\"", out);
+    for (size_t i = 0; i < long_size; i++) {
+        fputc(i % 2 ? '\n' : 'q', out);
+    }
+    fputs("\"\r\nc,d", out);
+    fclose(out);
+    csv = CSVFile_new(path, CSV_READER, false, "\r\n", NULL);
+    ASSERT(csv->n_records == 3 && csv->records[1]->field_pos[0] == long_size + 2, "\nfailed to read across scan chunks in test_csv_dialects, found %zu records", csv->n_records);
+    CSVFile_get_cell(csv, 2, 1, "%s", found);
+    ASSERT(!strcmp(found, "d"), "\nfailed to read record after scan chunks in test_csv_dialects, found %s", found);
+    CSVFile_get_cell(csv, 0, 0, "%31s", found);
+    ASSERT(strlen(found) == 31 && found[30] == 'a', "\nfailed to read truncated cell in test_csv_dialects, found %s", found);
+    CSVFile_del(csv);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_sniff(void) {
+    printf("test_csv_sniff...");
+    char * path = "./data/csvs/test_sniff.csv";
+    int ival = 0;
+
+    CSVFile * csv = CSVFile_open("./data/csvs/header.csv", CSV_READER, false, "\n", NULL);
+    ASSERT(!CSVFile_sniff(csv), "\nfailed to sniff in test_csv_sniff");
+    ASSERT(!strcmp(csv->line_ending, "\r\n") && csv->dialect.delimiter == ',' && csv->dialect.quote == '"' && csv->has_header, "\nfailed to sniff rfc4180 file in test_csv_sniff");
+    ASSERT(!CSVFile_read(csv) && csv->n_records == 5, "\nfailed to read sniffed file in test_csv_sniff");
+    CSVFile_get_cell(csv, 2, 1, "%d", &ival);
+    ASSERT(ival == 6, "\nfailed to read sniffed file in test_csv_sniff, found %d", ival);
+    CSVFile_del(csv);
+
+    FILE * out = fopen(path, "wb");
+    fputs("1\t2\t3\n4\t5\t6\n7\t8", out);
+    fclose(out);
+    CSVSniff sniff;
+    FILE * in = fopen(path, "rb");
+    ASSERT(!CSVSniff_init(&sniff, in, 0) && !ftell(in), "\nfailed to sniff handle in test_csv_sniff");
+    ASSERT(!strcmp(sniff.line_ending, "\n") && sniff.dialect.delimiter == '\t' && !sniff.has_header, "\nfailed to sniff tsv in test_csv_sniff");
+    fclose(in);
+
+    // commas within the fields do not fool the delimiter choice
+    out = fopen(path, "wb");
+    fputs("name;score\rann;1,5\rbob;2,25\r", out);
+    fclose(out);
+    in = fopen(path, "rb");
+    ASSERT(!CSVSniff_init(&sniff, in, 0), "\nfailed to sniff handle in test_csv_sniff");
+    ASSERT(!strcmp(sniff.line_ending, "\r") && sniff.dialect.delimiter == ';' && sniff.has_header, "\nfailed to sniff semicolons in test_csv_sniff");
+    fclose(in);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_recovery(void) {
+    printf("test_csv_recovery...");
+    char * path = "./data/csvs/test_recovery.csv";
+    int ival = 0;
+
+    FILE * out = fopen(path, "wb");
+    fputs("a,b\n1,x\"y\n2,\"z\"w\n3,4\n5,\"6", out);
+    fclose(out);
+
+    // without recovery, the first malformed record fails the read but is still reported
+    CSVFile * csv = CSVFile_new(path, CSV_READER, false, "\n", NULL);
+    ASSERT(csv && csv->n_errors == 1, "\nfailed to report malformed record in test_csv_recovery");
+    CSVError * error = CSVFile_get_error(csv, 0);
+    ASSERT(error->kind == CSV_ERROR_QUOTE_IN_FIELD && error->start == 4 && error->end == 10, "\nfailed to locate malformed record in test_csv_recovery, found [%zu, %zu)", error->start, error->end);
+    CSVFile_del(csv);
+
+    csv = CSVFile_open(path, CSV_READER, false, "\n", NULL);
+    ASSERT(!CSVFile_set_recovery(csv, 2), "\nfailed to set recovery in test_csv_recovery");
+    ASSERT(!CSVFile_read(csv), "\nfailed to recover from malformed records in test_csv_recovery");
+    ASSERT(csv->n_records == 2 && csv->n_errors == 3 && csv->n_error_samples == 2, "\nfailed to skip malformed records in test_csv_recovery, found %zu records, %zu errors", csv->n_records, csv->n_errors);
+    ASSERT(CSVFile_get_error(csv, 1)->kind == CSV_ERROR_AFTER_QUOTE && !CSVFile_get_error(csv, 2), "\nfailed to sample errors in test_csv_recovery");
+    CSVFile_get_cell(csv, 1, 1, "%d", &ival);
+    ASSERT(ival == 4, "\nfailed to read record after malformed records in test_csv_recovery, found %d", ival);
+    CSVFile_del(csv);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_cache(void) {
+    printf("test_csv_cache...");
+    char found[64] = {'\0'};
+    int ival = 0;
+
+    CSVFile * csv = CSVFile_new("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    // room for two decoded records of header.csv
+    ASSERT(!CSVFile_set_cache(csv, 2*(sizeof(CSVCacheRow) + 4*sizeof(size_t) + 16)), "\nfailed to set cache in test_csv_cache");
+    size_t records[6] = {1, 1, 2, 1, 3, 2};
+    size_t fields[6] = {0, 1, 0, 2, 0, 1};
+    int expected[6] = {1, 2, 5, 3, 9, 6};
+    for (size_t i = 0; i < 6; i++) {
+        CSVFile_get_cell(csv, records[i], fields[i], "%d", &ival);
+        ASSERT(ival == expected[i], "\nfailed to read cached cell in test_csv_cache, expected %d, found %d", expected[i], ival);
+    }
+    // record 2 was the least recently used when record 3 was loaded
+    ASSERT(csv->cache->hits == 2 && csv->cache->misses == 4 && csv->cache->n_rows == 2, "\nfailed to evict least recently used record in test_csv_cache, found %zu hits, %zu misses", csv->cache->hits, csv->cache->misses);
+    ASSERT(CSVFile_get_cell(csv, 9, 0, "%d", &ival) == CSV_INDEX_ERROR, "\nfailed to reject missing cell in test_csv_cache");
+    ASSERT(!CSVFile_set_cache(csv, 0) && !csv->cache, "\nfailed to remove cache in test_csv_cache");
+    CSVFile_del(csv);
+
+    // quoted fields are decoded once when their record is loaded
+    csv = CSVFile_new("./data/csvs/string_data.csv", CSV_READER, false, NULL, NULL);
+    CSVFile_set_cache(csv, 4096);
+    CSVFile_get_cell(csv, 1, 1, "%[^\n]", found);
+    ASSERT(!strcmp(found, "this \"has a double-quote"), "\nfailed to decode cached field in test_csv_cache, found %s", found);
+    CSVFile_get_cell(csv, 1, 2, "%[^\n]", found);
+    ASSERT(!strcmp(found, "this has a, comma") && csv->cache->hits == 1, "\nfailed to read cached field in test_csv_cache, found %s", found);
+    CSVFile_del(csv);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_quoted_records(void) {
+    printf("test_csv_quoted_records...");
+    char found[32] = {'\0'};
+
+    CSVFile * csv = CSVFile_new("./data/csvs/header.csv", CSV_READER, true, NULL, NULL);
+    ASSERT(csv->records[0]->quoted && !csv->records[1]->quoted && csv->records[2]->quoted && !csv->records[4]->quoted, "\nfailed to flag quoted records in test_csv_quoted_records");
+    CSVFile_get_cell(csv, 1, 3, "%s", found);
+    ASSERT(!strcmp(found, "4"), "\nfailed to read plain record in test_csv_quoted_records, found %s", found);
+    CSVFile_get_cell(csv, 2, 1, "%s", found);
+    ASSERT(!strcmp(found, "6"), "\nfailed to read quoted record in test_csv_quoted_records, found %s", found);
+    CSVFile_del(csv);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_ranges(void) {
+    printf("test_csv_ranges...");
+    char * path = "./data/csvs/test_ranges.csv";
+    char expected[32] = {'\0'};
+    char found[32] = {'\0'};
+
+    // quoted line endings must not be taken as record boundaries
+    char * data = "id,text\n1,\"a\nb\"\n2,\"c,\n\"\"d\"\"\"\n3,e\n4,\"\n5,fake\n\"\n5,f\n";
+    size_t size = strlen(data);
+    FILE * out = fopen(path, "wb");
+    fputs(data, out);
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    ASSERT(csv->n_records == 6, "\nfailed to read file in test_csv_ranges, found %zu records", csv->n_records);
+
+    for (size_t split = 1; split < size; split++) {
+        CSVFile * head = CSVFile_open_range(path, true, "\n", 0, split);
+        CSVFile * tail = CSVFile_open_range(path, true, "\n", split, size);
+        ASSERT(!CSVFile_read(head) && !CSVFile_read(tail), "\nfailed to read ranges split at %zu in test_csv_ranges", split);
+        ASSERT(head->n_records + tail->n_records == csv->n_records, "\nfailed to partition records at %zu in test_csv_ranges, found %zu + %zu", split, head->n_records, tail->n_records);
+        if (tail->n_records) {
+            CSVFile_get_cell(csv, head->n_records, 0, "%s", expected);
+            CSVFile_get_cell(tail, 0, 0, "%s", found);
+            ASSERT(!strcmp(expected, found) && !tail->has_header, "\nfailed to resynchronize range at %zu in test_csv_ranges, expected %s, found %s", split, expected, found);
+        }
+        CSVFile_del(head);
+        CSVFile_del(tail);
+    }
+
+    // a quote-free window resynchronizes without reading from the start, where an unclosed quote 
+    // would swallow every record
+    char * big_path = "./data/csvs/test_ranges_big.csv";
+    size_t n_lines = 200000;
+    out = fopen(big_path, "wb");
+    fputs("id,text\n\"0,unclosed\n", out);
+    for (size_t i = 1; i <= n_lines; i++) {
+        fprintf(out, "%zu,row\n", i);
+    }
+    size_t big_size = (size_t) ftell(out);
+    fclose(out);
+    size_t byte_start = big_size / 2;
+    CSVFile * big = CSVFile_open_range(big_path, true, "\n", byte_start, big_size);
+    ASSERT(!CSVFile_read(big) && big->n_records, "\nfailed to read quote-free range in test_csv_ranges");
+    size_t first_id = 0;
+    CSVFile_get_cell(big, 0, 0, "%zu", &first_id);
+    ASSERT(first_id + big->n_records == n_lines + 1, "\nfailed to resynchronize quote-free range in test_csv_ranges, found %zu records from id %zu", big->n_records, first_id);
+    size_t last_id = 0;
+    CSVFile_get_cell(big, big->n_records - 1, 0, "%zu", &last_id);
+    ASSERT(last_id == n_lines, "\nfailed to read to the end of quote-free range in test_csv_ranges, found last id %zu", last_id);
+    CSVFile_del(big);
+    remove(big_path);
+
+    // row views share the index
+    ASSERT(!CSVFile_open_rows(csv, 4, 3), "\nfailed to reject rows out of range in test_csv_ranges");
+    CSVFile * rows = CSVFile_open_rows(csv, 2, 3);
+    ASSERT(rows && rows->n_records == 3 && rows->records[0] == csv->records[2], "\nfailed to open rows in test_csv_ranges");
+    CSVFile_get_cell(rows, 1, 1, "%s", found);
+    ASSERT(!strcmp(found, "e") && CSVFile_read(rows) == CSV_FAILURE, "\nfailed to read row view in test_csv_ranges, found %s", found);
+    CSVFile_del(rows);
+    CSVFile_get_cell(csv, 5, 1, "%s", found);
+    ASSERT(!strcmp(found, "f"), "\nfailed to keep index after deleting view in test_csv_ranges, found %s", found);
+    CSVFile_del(csv);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_sort(void) {
+    printf("test_csv_sort...");
+    char * path = "./data/csvs/test_sort.csv";
+    char * out_path = "./data/csvs/test_sort_output.csv";
+    char * expected = "name,score\ne,-1.5\n\"a\",2\na,9\nc,10\nb,10\nd,x\n";
+    char found[128] = {'\0'};
+
+    FILE * out = fopen(path, "wb");
+    fputs("name,score\nb,10\na,9\nc,10\nd,x\ne,-1.5\n\"a\",2", out);
+    fclose(out);
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    CSVSortKey keys[2] = {{.column = 1, .type = CSV_KEY_NUMBER}, {.column = 0, .type = CSV_KEY_STRING, .descending = true}};
+    // in memory, then spilling runs of 2 or 3 records
+    size_t budgets[3] = {1 << 20, 200, 150};
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT(!CSVFile_sort_to(csv, out_path, keys, 2, budgets[i]), "\nfailed to sort with budget %zu in test_csv_sort", budgets[i]);
+        FILE * in = fopen(out_path, "rb");
+        size_t size = fread(found, sizeof(char), sizeof(found) - 1, in);
+        found[size] = '\0';
+        fclose(in);
+        ASSERT(!strcmp(found, expected), "\nfailed to sort with budget %zu in test_csv_sort, found:\n%s", budgets[i], found);
+    }
+    // fields that are not numbers still sort last in descending order
+    CSVSortKey descending = {.column = 1, .type = CSV_KEY_NUMBER, .descending = true};
+    expected = "name,score\nb,10\nc,10\na,9\n\"a\",2\ne,-1.5\nd,x\n";
+    for (size_t i = 0; i < 3; i++) {
+        ASSERT(!CSVFile_sort_to(csv, out_path, &descending, 1, budgets[i]), "\nfailed to sort descending with budget %zu in test_csv_sort", budgets[i]);
+        FILE * in = fopen(out_path, "rb");
+        size_t size = fread(found, sizeof(char), sizeof(found) - 1, in);
+        found[size] = '\0';
+        fclose(in);
+        ASSERT(!strcmp(found, expected), "\nfailed to sort descending with budget %zu in test_csv_sort, found:\n%s", budgets[i], found);
+    }
+    ASSERT(CSVFile_sort_to(csv, out_path, keys, 2, 16) == CSV_MEMORY_ERROR, "\nfailed to reject budget below one record in test_csv_sort");
+    CSVFile_del(csv);
+    remove(path);
+    remove(out_path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+int test_csv_group_by(void) {
+    printf("test_csv_group_by...");
+    char * path = "./data/csvs/test_group_by.csv";
+    char * data = "team,city,score\na,x,1\nb,x,4\n\"a\",x,3\na,y,n/a\nb,x,\n,x,2\n";
+    size_t size = strlen(data);
+    FILE * out = fopen(path, "wb");
+    fputs(data, out);
+    fclose(out);
+
+    size_t key_columns[2] = {0, 1};
+    CSVAggregate aggregates[5] = {{2, CSV_AGGREGATE_COUNT}, {2, CSV_AGGREGATE_SUM}, {2, CSV_AGGREGATE_MIN}, {2, CSV_AGGREGATE_MAX}, {2, CSV_AGGREGATE_MEAN}};
+    // groups in order of first appearance: (a, x), (b, x), (a, y), (, x)
+    char * keys[4] = {"ax", "bx", "ay", "x"};
+    double expected[4][5] = {{2, 4, 1, 3, 2}, {1, 4, 4, 4, 4}, {1, 0, NAN, NAN, NAN}, {1, 2, 2, 2, 2}};
+    CSVFile * csv = CSVFile_new(path, CSV_READER, true, "\n", NULL);
+    CSVGroupBy * groups = CSVGroupBy_new(key_columns, 2, aggregates, 5);
+    ASSERT(!CSVGroupBy_add(groups, csv), "\nfailed to aggregate in test_csv_group_by");
+
+    // partial tables over two ranges of the file merged back together
+    CSVFile * head = CSVFile_open_range(path, true, "\n", 0, size / 2);
+    CSVFile * tail = CSVFile_open_range(path, true, "\n", size / 2, size);
+    CSVGroupBy * merged = CSVGroupBy_new(key_columns, 2, aggregates, 5);
+    CSVGroupBy * partial = CSVGroupBy_new(key_columns, 2, aggregates, 5);
+    ASSERT(!CSVFile_read(head) && !CSVFile_read(tail), "\nfailed to read ranges in test_csv_group_by");
+    ASSERT(!CSVGroupBy_add(merged, head) && !CSVGroupBy_add(partial, tail) && !CSVGroupBy_merge(merged, partial), "\nfailed to merge partial aggregations in test_csv_group_by");
+
+    CSVGroupBy * results[2] = {groups, merged};
+    for (size_t r = 0; r < 2; r++) {
+        ASSERT(results[r]->n_groups == 4, "\nfailed to group records in test_csv_group_by, found %zu groups", results[r]->n_groups);
+        for (size_t g = 0; g < 4; g++) {
+            char found[8] = {'\0'};
+            size_t first = 0, second = 0;
+            char * key = CSVGroupBy_key(results[r], g, 0, &first);
+            memcpy(found, key, first);
+            key = CSVGroupBy_key(results[r], g, 1, &second);
+            memcpy(found + first, key, second);
+            ASSERT(!strcmp(found, keys[g]), "\nfailed to find key of group %zu in test_csv_group_by, found %s", g, found);
+            for (size_t a = 0; a < 5; a++) {
+                double value = CSVGroupBy_value(results[r], g, a);
+                ASSERT(isnan(expected[g][a]) ? isnan(value) : value == expected[g][a], "\nfailed aggregate %zu of group %zu in test_csv_group_by, found %f", a, g, value);
+            }
+        }
+    }
+
+    CSVGroupBy_del(groups);
+    CSVGroupBy_del(merged);
+    CSVGroupBy_del(partial);
+    CSVFile_del(head);
+    CSVFile_del(tail);
+    CSVFile_del(csv);
+    remove(path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
+typedef struct JoinRows {
+    char rows[16][64];
+    size_t n_rows;
+} JoinRows;
+
+static enum csv_status collect_join_row(void * data, char ** fields, size_t * sizes, size_t n_fields) {
+    JoinRows * rows = (JoinRows *) data;
+    char * row = rows->rows[rows->n_rows++];
+    row[0] = '\0';
+    for (size_t i = 0; i < n_fields; i++) {
+        strncat(row, fields[i], sizes[i]);
+        strcat(row, i + 1 < n_fields ? "|" : "");
+    }
+    return CSV_SUCCESS;
+}
+
+static int compare_join_rows(const void * a, const void * b) {
+    return strcmp((const char *) a, (const char *) b);
+}
+
+int test_csv_join(void) {
+    printf("test_csv_join...");
+    char * left_path = "./data/csvs/test_join_orders.csv";
+    char * right_path = "./data/csvs/test_join_customers.csv";
+    char * out_path = "./data/csvs/test_join_output.csv";
+    FILE * out = fopen(left_path, "wb");
+    fputs("order,customer\n1,b\n2,\"a\"\n3,z\n4,a\n5\n", out);
+    fclose(out);
+    out = fopen(right_path, "wb");
+    fputs("id,name\na,\"Ann, A\"\nb,Bob\na,Al\n", out);
+    fclose(out);
+    CSVFile * left = CSVFile_new(left_path, CSV_READER, true, "\n", NULL);
+    CSVFile * right = CSVFile_new(right_path, CSV_READER, true, "\n", NULL);
+
+    char * inner[6] = {"1|b|b|Bob", "2|a|a|Ann, A", "2|a|a|Al", "4|a|a|Ann, A", "4|a|a|Al", "order|customer|id|name"};
+    char * outer[8] = {"1|b|b|Bob", "2|a|a|Ann, A", "2|a|a|Al", "3|z||", "4|a|a|Ann, A", "4|a|a|Al", "5||", "order|customer|id|name"};
+    // in memory the rows follow left, spilled to partitions they are compared sorted
+    size_t budgets[2] = {0, 1};
+    for (size_t b = 0; b < 2; b++) {
+        for (size_t k = 0; k < 2; k++) {
+            char ** expected = k ? outer : inner;
+            size_t n_expected = k ? 8 : 6;
+            JoinRows rows = {.n_rows = 0};
+            ASSERT(!CSVFile_join(left, 1, right, 0, k ? CSV_JOIN_LEFT : CSV_JOIN_INNER, budgets[b], collect_join_row, &rows), "\nfailed to join with budget %zu in test_csv_join", budgets[b]);
+            ASSERT(rows.n_rows == n_expected, "\nfailed to join with budget %zu in test_csv_join, found %zu rows", budgets[b], rows.n_rows);
+            if (b) {
+                qsort(rows.rows, rows.n_rows, sizeof(rows.rows[0]), compare_join_rows);
+                char sorted[8][64];
+                for (size_t i = 0; i < n_expected; i++) {
+                    strcpy(sorted[i], expected[i]);
+                }
+                qsort(sorted, n_expected, sizeof(sorted[0]), compare_join_rows);
+                for (size_t i = 0; i < n_expected; i++) {
+                    ASSERT(!strcmp(rows.rows[i], sorted[i]), "\nfailed spilled join row %zu in test_csv_join, found %s", i, rows.rows[i]);
+                }
+            } else {
+                // the header row comes first
+                ASSERT(!strcmp(rows.rows[0], expected[n_expected-1]), "\nfailed to join headers in test_csv_join, found %s", rows.rows[0]);
+                for (size_t i = 1; i < n_expected; i++) {
+                    ASSERT(!strcmp(rows.rows[i], expected[i-1]), "\nfailed join row %zu in test_csv_join, found %s", i, rows.rows[i]);
+                }
+            }
+        }
+    }
+
+    // through the streaming writer
+    char * expected = "order,customer,id,name\n1,b,b,Bob\n2,a,a,\"Ann, A\"\n2,a,a,Al\n4,a,a,\"Ann, A\"\n4,a,a,Al\n";
+    char found[128] = {'\0'};
+    out = fopen(out_path, "wb");
+    CSVWriter * writer = CSVWriter_new(out, "\n", 64);
+    ASSERT(!CSVFile_join(left, 1, right, 0, CSV_JOIN_INNER, 0, CSVWriter_join_callback, writer), "\nfailed to join to writer in test_csv_join");
+    CSVWriter_del(writer);
+    fclose(out);
+    FILE * in = fopen(out_path, "rb");
+    size_t size = fread(found, sizeof(char), sizeof(found) - 1, in);
+    found[size] = '\0';
+    fclose(in);
+    ASSERT(!strcmp(found, expected), "\nfailed to write joined rows in test_csv_join, found:\n%s", found);
+
+    CSVFile_del(left);
+    CSVFile_del(right);
+    remove(left_path);
+    remove(right_path);
+    remove(out_path);
+
+    printf("PASS\n");
+
+    return TEST_SUCCESS;
+}
+
 int main() {
     test_LineIterator();
     test_FileLineIterator();
@@ -714,8 +2099,33 @@ int main() {
     test_string_lstrip();
     test_string_strip();
     test_array_iterators();
+    test_array_iterator_blocks();
+    test_array_iterator_inline();
+    test_parallel_for_each();
+    test_iterator_combinators();
+    test_array_comprehension();
+    test_allocators();
+    test_iterator_pools();
+    test_reverse_swap();
+    test_sort();
 
     test_csv_reader();
+    test_csv_projection();
+    test_csv_filters();
+    test_csv_field_counts();
+    test_csv_writer();
+    test_csv_stream_writer();
+    test_csv_amender();
+    test_csv_refresh();
+    test_csv_dialects();
+    test_csv_sniff();
+    test_csv_recovery();
+    test_csv_cache();
+    test_csv_quoted_records();
+    test_csv_ranges();
+    test_csv_sort();
+    test_csv_group_by();
+    test_csv_join();
     
     return 0;
 }
\ No newline at end of file